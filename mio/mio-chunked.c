@@ -0,0 +1,1008 @@
+/*
+ *  MIO, an I/O abstraction layer replicating C file I/O API.
+ *  Copyright (C) 2010  Colomban Wendling <ban@herbesfolles.org>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ * 
+ */
+
+/* chunked memory IO implementation */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mio.h"
+
+#ifndef TRUE
+# define TRUE 1
+#endif
+#ifndef FALSE
+# define FALSE 0
+#endif
+
+
+#define CHUNKED_SET_VTABLE(mio)           \
+  do {                                    \
+    mio->v_free     = chunked_free;       \
+    mio->v_read     = chunked_read;       \
+    mio->v_write    = chunked_write;      \
+    mio->v_getc     = chunked_getc;       \
+    mio->v_gets     = chunked_gets;       \
+    mio->v_ungetc   = chunked_ungetc;     \
+    mio->v_putc     = chunked_putc;       \
+    mio->v_puts     = chunked_puts;       \
+    mio->v_vprintf  = chunked_vprintf;    \
+    mio->v_clearerr = chunked_clearerr;   \
+    mio->v_eof      = chunked_eof;        \
+    mio->v_error    = chunked_error;      \
+    mio->v_seek     = chunked_seek;       \
+    mio->v_tell     = chunked_tell;       \
+    mio->v_rewind   = chunked_rewind;     \
+    mio->v_getpos   = chunked_getpos;     \
+    mio->v_setpos   = chunked_setpos;     \
+    mio->v_peek     = chunked_peek;       \
+    mio->v_consume  = chunked_consume;    \
+    mio->v_reserve  = chunked_reserve;    \
+    mio->v_commit   = chunked_commit;     \
+    mio->v_pread    = chunked_pread;      \
+    mio->v_pwrite   = chunked_pwrite;     \
+    mio->v_readv    = chunked_readv;      \
+    mio->v_writev   = chunked_writev;     \
+    mio->v_mark     = chunked_mark;       \
+    mio->v_reset    = chunked_reset;      \
+  } while (0)
+
+/* default size of the chunks */
+#define MIO_CHUNKED_CHUNK_SIZE 65536
+
+/*
+ * The data is split in chunks laid out one after the other, chunk i holding
+ * @size bytes of the stream starting at @start.  Only the last chunk ever
+ * grows, up to its @capacity, after which a new chunk is added, so the data
+ * written is never moved.  Chunks before the last one are usually full, but
+ * don't have to, e.g. after chunked_flatten() or when a write needed more
+ * contiguous room than left in the last chunk.
+ * 
+ * The read and write windows are always opened over the chunk @current.
+ */
+struct _MIOChunk {
+  unsigned char  *data;
+  size_t          start;
+  size_t          size;
+  size_t          capacity;
+};
+
+
+/*
+ * chunked_sync:
+ * @mio: A #MIO object of the type %MIO_TYPE_CHUNKED
+ * 
+ * Folds the fast path windows back into the stream's position and size, and
+ * closes them.  This must be called before looking at the stream's position or
+ * size.
+ */
+static void
+chunked_sync (MIO *mio)
+{
+  struct _MIOChunk *chunk;
+  
+  chunk = &mio->impl.chunked.chunks[mio->impl.chunked.current];
+  if (mio->read_ptr) {
+    mio->impl.chunked.pos = chunk->start +
+                            (size_t) (mio->read_ptr - chunk->data);
+    mio->read_ptr = NULL;
+    mio->read_end = NULL;
+  } else if (mio->write_ptr) {
+    size_t offset = (size_t) (mio->write_ptr - chunk->data);
+    
+    chunk->size = MAX (chunk->size, offset);
+    mio->impl.chunked.pos = chunk->start + offset;
+    mio->impl.chunked.size = MAX (mio->impl.chunked.size,
+                                  mio->impl.chunked.pos);
+    mio->write_ptr = NULL;
+    mio->write_end = NULL;
+    mio->write_data_end = NULL;
+  }
+}
+
+/*
+ * chunked_find:
+ * @mio: A #MIO object of the type %MIO_TYPE_CHUNKED
+ * @pos: A position in the stream, smaller than its size
+ * 
+ * Finds the chunk holding the byte at @pos, without changing the stream.
+ * 
+ * Returns: The index of the chunk holding @pos.
+ */
+static size_t
+chunked_find (MIO    *mio,
+              size_t  pos)
+{
+  const struct _MIOChunk *chunks  = mio->impl.chunked.chunks;
+  size_t                  lo      = mio->impl.chunked.current;
+  size_t                  hi;
+  
+  if (pos < chunks[lo].start || pos - chunks[lo].start >= chunks[lo].size) {
+    lo = 0;
+    hi = mio->impl.chunked.n_chunks - 1;
+    /* the last chunk starting at or before @pos is the one holding it, as
+     * empty chunks start at the same position as the next one */
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo + 1) / 2;
+      
+      if (chunks[mid].start <= pos) {
+        lo = mid;
+      } else {
+        hi = mid - 1;
+      }
+    }
+  }
+  
+  return lo;
+}
+
+/*
+ * chunked_add_chunk:
+ * @mio: A #MIO object of the type %MIO_TYPE_CHUNKED
+ * @capacity: The minimal capacity of the new chunk
+ * 
+ * Adds an empty chunk at the end of the stream.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise, with errno set.
+ */
+static int
+chunked_add_chunk (MIO    *mio,
+                   size_t  capacity)
+{
+  int success = TRUE;
+  
+  if (mio->impl.chunked.n_chunks == mio->impl.chunked.n_allocated) {
+    size_t            n_allocated = mio->impl.chunked.n_allocated * 2;
+    struct _MIOChunk *chunks;
+    
+    chunks = realloc (mio->impl.chunked.chunks, n_allocated * sizeof *chunks);
+    if (! chunks) {
+      success = FALSE;
+    } else {
+      mio->impl.chunked.chunks = chunks;
+      mio->impl.chunked.n_allocated = n_allocated;
+    }
+  }
+  if (success) {
+    struct _MIOChunk *chunk;
+    
+    chunk = &mio->impl.chunked.chunks[mio->impl.chunked.n_chunks];
+    capacity = MAX (capacity, mio->impl.chunked.chunk_size);
+    chunk->data = malloc (capacity);
+    if (! chunk->data) {
+      success = FALSE;
+    } else {
+      chunk->start = mio->impl.chunked.size;
+      chunk->size = 0;
+      chunk->capacity = capacity;
+      mio->impl.chunked.n_chunks++;
+    }
+  }
+  if (! success) {
+    mio->impl.chunked.error = TRUE;
+    errno = ENOMEM;
+  }
+  
+  return success;
+}
+
+/*
+ * chunked_write_at:
+ * @mio: A #MIO object of the type %MIO_TYPE_CHUNKED
+ * @pos: Position at which write, not after the end of the stream
+ * @ptr: The data to write, or %NULL to write zeros
+ * @n: The number of bytes to write
+ * 
+ * Writes data to the stream, overwriting the existing data and then appending
+ * to the last chunk, adding new ones as needed.  This doesn't move the cursor.
+ * The stream must be synchronized.
+ * 
+ * Returns: The number of bytes written, which is only smaller than @n if memory
+ *          ran out.
+ */
+static size_t
+chunked_write_at (MIO        *mio,
+                  size_t      pos,
+                  const void *ptr,
+                  size_t      n)
+{
+  size_t done = 0;
+  
+  line_index_invalidate (mio, (off_t) pos);
+  while (done < n) {
+    struct _MIOChunk *chunk;
+    size_t            offset;
+    size_t            count;
+    
+    if (pos < mio->impl.chunked.size) {
+      chunk = &mio->impl.chunked.chunks[chunked_find (mio, pos)];
+      offset = pos - chunk->start;
+      count = chunk->size - offset;
+    } else {
+      chunk = &mio->impl.chunked.chunks[mio->impl.chunked.n_chunks - 1];
+      if (chunk->size == chunk->capacity) {
+        if (! chunked_add_chunk (mio, 0)) {
+          break;
+        }
+        chunk = &mio->impl.chunked.chunks[mio->impl.chunked.n_chunks - 1];
+      }
+      offset = chunk->size;
+      count = chunk->capacity - offset;
+    }
+    count = MIN (count, n - done);
+    if (ptr) {
+      memcpy (&chunk->data[offset], (const unsigned char *) ptr + done, count);
+    } else {
+      memset (&chunk->data[offset], 0, count);
+    }
+    chunk->size = MAX (chunk->size, offset + count);
+    done += count;
+    pos += count;
+    mio->impl.chunked.size = MAX (mio->impl.chunked.size, pos);
+  }
+  
+  return done;
+}
+
+/*
+ * chunked_flatten:
+ * @mio: A #MIO object of the type %MIO_TYPE_CHUNKED
+ * 
+ * Gathers all the data of the stream in a single chunk.  The stream must be
+ * synchronized.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise, with errno set.
+ */
+static int
+chunked_flatten (MIO *mio)
+{
+  int     success = TRUE;
+  size_t  n_used  = 0;
+  size_t  last    = 0;
+  size_t  i;
+  
+  for (i = 0; i < mio->impl.chunked.n_chunks; i++) {
+    if (mio->impl.chunked.chunks[i].size > 0) {
+      n_used++;
+      last = i;
+    }
+  }
+  if (n_used <= 1) {
+    struct _MIOChunk chunk = mio->impl.chunked.chunks[last];
+    
+    /* the data already is contiguous, only drop the empty chunks */
+    for (i = 0; i < mio->impl.chunked.n_chunks; i++) {
+      if (i != last) {
+        free (mio->impl.chunked.chunks[i].data);
+      }
+    }
+    mio->impl.chunked.chunks[0] = chunk;
+    mio->impl.chunked.n_chunks = 1;
+    mio->impl.chunked.current = 0;
+  } else {
+    unsigned char *data;
+    
+    data = malloc (mio->impl.chunked.size);
+    if (! data) {
+      errno = ENOMEM;
+      success = FALSE;
+    } else {
+      for (i = 0; i < mio->impl.chunked.n_chunks; i++) {
+        struct _MIOChunk *chunk = &mio->impl.chunked.chunks[i];
+        
+        if (chunk->size > 0) {
+          memcpy (&data[chunk->start], chunk->data, chunk->size);
+        }
+        free (chunk->data);
+      }
+      mio->impl.chunked.chunks[0].data = data;
+      mio->impl.chunked.chunks[0].start = 0;
+      mio->impl.chunked.chunks[0].size = mio->impl.chunked.size;
+      mio->impl.chunked.chunks[0].capacity = mio->impl.chunked.size;
+      mio->impl.chunked.n_chunks = 1;
+      mio->impl.chunked.current = 0;
+    }
+  }
+  
+  return success;
+}
+
+/*
+ * chunked_fill:
+ * @mio: A #MIO object of the type %MIO_TYPE_CHUNKED
+ * 
+ * Opens the read window at the current position, up to the end of the chunk
+ * holding it.  The stream must be synchronized, and no character must be
+ * pushed back.
+ * 
+ * Returns: The number of bytes available in the read window.
+ */
+static size_t
+chunked_fill (MIO *mio)
+{
+  size_t n = 0;
+  
+  if (mio->impl.chunked.pos < mio->impl.chunked.size) {
+    struct _MIOChunk *chunk;
+    
+    mio->impl.chunked.current = chunked_find (mio, mio->impl.chunked.pos);
+    chunk = &mio->impl.chunked.chunks[mio->impl.chunked.current];
+    mio->read_ptr = &chunk->data[mio->impl.chunked.pos - chunk->start];
+    mio->read_end = &chunk->data[chunk->size];
+    n = (size_t) (mio->read_end - mio->read_ptr);
+  }
+  
+  return n;
+}
+
+/*
+ * chunked_open_write_window:
+ * @mio: A #MIO object of the type %MIO_TYPE_CHUNKED
+ * 
+ * Opens the write window at the current position, up to the end of the chunk
+ * holding it, or of its capacity for the last chunk.  The stream must be
+ * synchronized, and no character must be pushed back.
+ * 
+ * Returns: The number of bytes available in the write window.
+ */
+static size_t
+chunked_open_write_window (MIO *mio)
+{
+  size_t            pos = mio->impl.chunked.pos;
+  struct _MIOChunk *chunk;
+  
+  if (pos < mio->impl.chunked.size) {
+    mio->impl.chunked.current = chunked_find (mio, pos);
+  } else {
+    mio->impl.chunked.current = mio->impl.chunked.n_chunks - 1;
+  }
+  chunk = &mio->impl.chunked.chunks[mio->impl.chunked.current];
+  mio->write_ptr = &chunk->data[pos - chunk->start];
+  if (mio->impl.chunked.current == mio->impl.chunked.n_chunks - 1) {
+    mio->write_end = &chunk->data[chunk->capacity];
+  } else {
+    mio->write_end = &chunk->data[chunk->size];
+  }
+  if (pos < mio->impl.chunked.size) {
+    mio->write_data_end = &chunk->data[chunk->size];
+  }
+  
+  return (size_t) (mio->write_end - mio->write_ptr);
+}
+
+/*
+ * chunked_open:
+ * @mio: A #MIO object
+ * @chunk_size: The size of the chunks, or 0 for the default
+ * 
+ * Initializes @mio to work on an empty chunked memory stream.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static int
+chunked_open (MIO    *mio,
+              size_t  chunk_size)
+{
+  int success = FALSE;
+  
+  mio->impl.chunked.n_allocated = 8;
+  mio->impl.chunked.chunks = malloc (mio->impl.chunked.n_allocated *
+                                     sizeof *mio->impl.chunked.chunks);
+  if (! mio->impl.chunked.chunks) {
+    errno = ENOMEM;
+  } else {
+    /* an empty first chunk, so that there always is a last one */
+    mio->impl.chunked.chunks[0].data = NULL;
+    mio->impl.chunked.chunks[0].start = 0;
+    mio->impl.chunked.chunks[0].size = 0;
+    mio->impl.chunked.chunks[0].capacity = 0;
+    mio->impl.chunked.n_chunks = 1;
+    mio->impl.chunked.chunk_size = (chunk_size > 0) ? chunk_size
+                                                    : MIO_CHUNKED_CHUNK_SIZE;
+    mio->impl.chunked.current = 0;
+    mio->impl.chunked.pos = 0;
+    mio->impl.chunked.size = 0;
+    mio->impl.chunked.scratch = NULL;
+    mio->impl.chunked.reserved = 0;
+    mio->impl.chunked.ungetch = EOF;
+    mio->impl.chunked.error = FALSE;
+    mio->impl.chunked.eof = FALSE;
+    success = TRUE;
+  }
+  
+  return success;
+}
+
+static void
+chunked_free (MIO *mio)
+{
+  size_t i;
+  
+  chunked_sync (mio);
+  for (i = 0; i < mio->impl.chunked.n_chunks; i++) {
+    free (mio->impl.chunked.chunks[i].data);
+  }
+  free (mio->impl.chunked.chunks);
+  free (mio->impl.chunked.scratch);
+  mio->impl.chunked.chunks = NULL;
+  mio->impl.chunked.n_chunks = 0;
+  mio->impl.chunked.scratch = NULL;
+  mio->impl.chunked.size = 0;
+  mio->impl.chunked.pos = 0;
+}
+
+static size_t
+chunked_read (MIO    *mio,
+              void   *ptr_,
+              size_t  size,
+              size_t  nmemb)
+{
+  size_t n_read = 0;
+  
+  chunked_sync (mio);
+  if (size != 0 && nmemb != 0) {
+    size_t          n     = size * nmemb;
+    size_t          got   = 0;
+    unsigned char  *ptr   = ptr_;
+    
+    if (mio->impl.chunked.ungetch != EOF) {
+      *ptr = (unsigned char) mio->impl.chunked.ungetch;
+      mio->impl.chunked.ungetch = EOF;
+      mio->impl.chunked.pos++;
+      got++;
+    }
+    while (got < n) {
+      size_t avail = chunked_fill (mio);
+      
+      if (avail == 0) {
+        break;
+      }
+      if (avail > n - got) {
+        avail = n - got;
+      }
+      memcpy (&ptr[got], mio->read_ptr, avail);
+      mio->read_ptr += avail;
+      chunked_sync (mio);
+      got += avail;
+    }
+    if (mio->impl.chunked.pos >= mio->impl.chunked.size) {
+      mio->impl.chunked.eof = TRUE;
+    }
+    n_read = got / size;
+  }
+  
+  return n_read;
+}
+
+static size_t
+chunked_write (MIO         *mio,
+               const void  *ptr,
+               size_t       size,
+               size_t       nmemb)
+{
+  size_t n_written = 0;
+  
+  chunked_sync (mio);
+  mio->impl.chunked.ungetch = EOF;
+  if (size != 0 && nmemb != 0) {
+    size_t n = chunked_write_at (mio, mio->impl.chunked.pos, ptr,
+                                 size * nmemb);
+    
+    mio->impl.chunked.pos += n;
+    n_written = n / size;
+  }
+  
+  return n_written;
+}
+
+static int
+chunked_putc (MIO  *mio,
+              int   c)
+{
+  int           rv  = EOF;
+  unsigned char ch  = (unsigned char) c;
+  
+  chunked_sync (mio);
+  mio->impl.chunked.ungetch = EOF;
+  if (chunked_write_at (mio, mio->impl.chunked.pos, &ch, 1) == 1) {
+    mio->impl.chunked.pos++;
+    rv = (int) ch;
+    /* open the write window over the rest of the chunk */
+    chunked_open_write_window (mio);
+  }
+  
+  return rv;
+}
+
+static int
+chunked_puts (MIO        *mio,
+              const char *s)
+{
+  int     rv = EOF;
+  size_t  len;
+  
+  chunked_sync (mio);
+  mio->impl.chunked.ungetch = EOF;
+  len = strlen (s);
+  if (chunked_write_at (mio, mio->impl.chunked.pos, s, len) == len) {
+    mio->impl.chunked.pos += len;
+    rv = 1;
+  }
+  
+  return rv;
+}
+
+__attribute__((__format__ (__printf__, 2, 0)))
+static int
+chunked_vprintf (MIO         *mio,
+                 const char  *format,
+                 va_list      ap)
+{
+  return format_vprintf (mio, format, ap);
+}
+
+static int
+chunked_getc (MIO *mio)
+{
+  int rv = EOF;
+  
+  chunked_sync (mio);
+  if (mio->impl.chunked.ungetch != EOF) {
+    rv = mio->impl.chunked.ungetch;
+    mio->impl.chunked.ungetch = EOF;
+    mio->impl.chunked.pos++;
+  } else if (chunked_fill (mio) > 0) {
+    rv = *mio->read_ptr++;
+  } else {
+    mio->impl.chunked.eof = TRUE;
+  }
+  
+  return rv;
+}
+
+static int
+chunked_ungetc (MIO  *mio,
+                int   ch)
+{
+  int rv = EOF;
+  
+  chunked_sync (mio);
+  /* the position can't go negative, let mio_ungetc() handle it */
+  if (ch != EOF && mio->impl.chunked.ungetch == EOF &&
+      mio->impl.chunked.pos > 0) {
+    rv = mio->impl.chunked.ungetch = ch;
+    mio->impl.chunked.pos--;
+    mio->impl.chunked.eof = FALSE;
+  }
+  
+  return rv;
+}
+
+static char *
+chunked_gets (MIO    *mio,
+              char   *s,
+              size_t  size)
+{
+  char *rv = NULL;
+  
+  chunked_sync (mio);
+  if (size > 0) {
+    size_t i = 0;
+    
+    if (mio->impl.chunked.ungetch != EOF && size > 1) {
+      s[i] = (char) mio->impl.chunked.ungetch;
+      mio->impl.chunked.ungetch = EOF;
+      mio->impl.chunked.pos++;
+      i++;
+    }
+    while (i < size - 1 && (i == 0 || s[i - 1] != '\n')) {
+      size_t          n = chunked_fill (mio);
+      unsigned char  *nl;
+      
+      if (n == 0) {
+        break;
+      }
+      if (n > size - 1 - i) {
+        n = size - 1 - i;
+      }
+      nl = memchr (mio->read_ptr, '\n', n);
+      if (nl) {
+        n = (size_t) (nl - mio->read_ptr) + 1;
+      }
+      memcpy (&s[i], mio->read_ptr, n);
+      mio->read_ptr += n;
+      chunked_sync (mio);
+      i += n;
+    }
+    if (i > 0) {
+      s[i] = 0;
+      rv = s;
+    }
+    if (mio->impl.chunked.pos >= mio->impl.chunked.size) {
+      mio->impl.chunked.eof = TRUE;
+    }
+  }
+  
+  return rv;
+}
+
+static void
+chunked_clearerr (MIO *mio)
+{
+  mio->impl.chunked.error = FALSE;
+  mio->impl.chunked.eof = FALSE;
+}
+
+static int
+chunked_eof (MIO *mio)
+{
+  return mio->impl.chunked.eof != FALSE;
+}
+
+static int
+chunked_error (MIO *mio)
+{
+  return mio->impl.chunked.error != FALSE;
+}
+
+static int
+chunked_seek (MIO  *mio,
+              long  offset,
+              int   whence)
+{
+  int     rv = -1;
+  size_t  base;
+  
+  chunked_sync (mio);
+  switch (whence) {
+    case SEEK_SET:  base = 0;                         break;
+    case SEEK_CUR:  base = mio->impl.chunked.pos;     break;
+    case SEEK_END:  base = mio->impl.chunked.size;    break;
+    default:        base = (size_t) -1;               break;
+  }
+  if (base == (size_t) -1 ||
+      (offset < 0 && (size_t) -offset > base) ||
+      (offset > 0 && (size_t) offset > mio->impl.chunked.size - base)) {
+    errno = EINVAL;
+  } else {
+    mio->impl.chunked.pos = (size_t) ((ssize_t) base + offset);
+    mio->impl.chunked.eof = FALSE;
+    mio->impl.chunked.ungetch = EOF;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static long
+chunked_tell (MIO *mio)
+{
+  long rv = -1;
+  
+  chunked_sync (mio);
+  if (mio->impl.chunked.pos > LONG_MAX) {
+    #ifdef EOVERFLOW
+    errno = EOVERFLOW;
+    #endif
+  } else {
+    rv = (long) mio->impl.chunked.pos;
+  }
+  
+  return rv;
+}
+
+static void
+chunked_rewind (MIO *mio)
+{
+  chunked_sync (mio);
+  mio->impl.chunked.pos = 0;
+  mio->impl.chunked.ungetch = EOF;
+  mio->impl.chunked.eof = FALSE;
+  mio->impl.chunked.error = FALSE;
+}
+
+static int
+chunked_getpos (MIO    *mio,
+                MIOPos *pos)
+{
+  chunked_sync (mio);
+  pos->impl.chunked = mio->impl.chunked.pos;
+  
+  return 0;
+}
+
+static int
+chunked_setpos (MIO    *mio,
+                MIOPos *pos)
+{
+  int rv = -1;
+  
+  chunked_sync (mio);
+  if (pos->impl.chunked > mio->impl.chunked.size) {
+    errno = EINVAL;
+  } else {
+    mio->impl.chunked.ungetch = EOF;
+    mio->impl.chunked.pos = pos->impl.chunked;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static const unsigned char *
+chunked_peek (MIO    *mio,
+              size_t *avail)
+{
+  const unsigned char *ptr = NULL;
+  
+  chunked_sync (mio);
+  *avail = 0;
+  if (mio->impl.chunked.ungetch != EOF && chunked_fill (mio) > 0 &&
+      *mio->read_ptr == mio->impl.chunked.ungetch) {
+    /* the pushed back character is the one in the chunk, forget it */
+    mio->impl.chunked.ungetch = EOF;
+  }
+  chunked_sync (mio);
+  if (mio->impl.chunked.ungetch != EOF) {
+    ptr = &mem_bytes[(unsigned char) mio->impl.chunked.ungetch];
+    *avail = 1;
+  } else if ((*avail = chunked_fill (mio)) > 0) {
+    ptr = mio->read_ptr;
+  } else {
+    mio->impl.chunked.eof = TRUE;
+  }
+  
+  return ptr;
+}
+
+static int
+chunked_consume (MIO   *mio,
+                 size_t n)
+{
+  int rv = -1;
+  
+  chunked_sync (mio);
+  if (mio->impl.chunked.ungetch != EOF) {
+    /* chunked_peek() only gave the pushed back character */
+    if (n > 1) {
+      errno = EINVAL;
+    } else {
+      if (n == 1) {
+        mio->impl.chunked.ungetch = EOF;
+        mio->impl.chunked.pos++;
+      }
+      rv = 0;
+    }
+  } else if (n > mio->impl.chunked.size - mio->impl.chunked.pos) {
+    errno = EINVAL;
+  } else {
+    mio->impl.chunked.pos += n;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static void *
+chunked_reserve (MIO   *mio,
+                 size_t n)
+{
+  void *ptr = NULL;
+  
+  chunked_sync (mio);
+  mio->impl.chunked.ungetch = EOF;
+  mio->impl.chunked.reserved = 0;
+  if (mio->impl.chunked.pos == mio->impl.chunked.size) {
+    struct _MIOChunk *chunk;
+    
+    /* appending, give room right in the last chunk */
+    chunk = &mio->impl.chunked.chunks[mio->impl.chunked.n_chunks - 1];
+    if ((chunk->capacity > chunk->size && chunk->capacity - chunk->size >= n) ||
+        chunked_add_chunk (mio, n)) {
+      line_index_invalidate (mio, (off_t) mio->impl.chunked.pos);
+      chunked_open_write_window (mio);
+      ptr = mio->write_ptr;
+    }
+  } else {
+    unsigned char *scratch;
+    
+    /* overwriting, use a separate buffer and copy it on commit so that the
+     * data past the committed bytes is left alone */
+    scratch = realloc (mio->impl.chunked.scratch, MAX (n, 1));
+    if (! scratch) {
+      mio->impl.chunked.error = TRUE;
+      errno = ENOMEM;
+    } else {
+      mio->impl.chunked.scratch = scratch;
+      mio->impl.chunked.reserved = n;
+      ptr = scratch;
+    }
+  }
+  
+  return ptr;
+}
+
+static int
+chunked_commit (MIO   *mio,
+                size_t n)
+{
+  int rv = -1;
+  
+  /* mio_write_commit() already handled everything within the write window */
+  if (n == 0) {
+    rv = 0;
+  } else if (n > mio->impl.chunked.reserved) {
+    errno = EINVAL;
+  } else {
+    chunked_sync (mio);
+    if (chunked_write_at (mio, mio->impl.chunked.pos, mio->impl.chunked.scratch,
+                          n) == n) {
+      mio->impl.chunked.pos += n;
+      rv = 0;
+    }
+  }
+  mio->impl.chunked.reserved = 0;
+  
+  return rv;
+}
+
+static ssize_t
+chunked_pread (MIO   *mio,
+               void  *ptr_,
+               size_t count,
+               off_t  offset)
+{
+  const struct _MIOChunk *chunks  = mio->impl.chunked.chunks;
+  const struct _MIOChunk *window  = &chunks[mio->impl.chunked.current];
+  size_t                  size    = mio->impl.chunked.size;
+  size_t                  window_size;
+  unsigned char          *ptr     = ptr_;
+  size_t                  got     = 0;
+  
+  /* we must not change the stream's state here for concurrent calls to be
+   * safe, so don't fold the write window back but only peek at it */
+  window_size = window->size;
+  if (mio->write_ptr) {
+    window_size = MAX (window_size, (size_t) (mio->write_ptr - window->data));
+    size = MAX (size, window->start + window_size);
+  }
+  count = MIN (count, ((size_t) -1) >> 1);
+  if (offset < (off_t) size) {
+    size_t pos = (size_t) offset;
+    size_t i;
+    
+    count = MIN (count, size - pos);
+    i = chunked_find (mio, pos);
+    while (got < count) {
+      const struct _MIOChunk *chunk = &chunks[i++];
+      size_t                  n;
+      
+      n = (chunk == window) ? window_size : chunk->size;
+      if (pos - chunk->start >= n) {
+        continue;
+      }
+      n = MIN (n - (pos - chunk->start), count - got);
+      memcpy (&ptr[got], &chunk->data[pos - chunk->start], n);
+      got += n;
+      pos += n;
+    }
+  }
+  
+  return (ssize_t) got;
+}
+
+static ssize_t
+chunked_pwrite (MIO        *mio,
+                const void *ptr,
+                size_t      count,
+                off_t       offset)
+{
+  ssize_t rv = -1;
+  
+  chunked_sync (mio);
+  count = MIN (count, ((size_t) -1) >> 1);
+  if (offset != (off_t) (size_t) offset ||
+      (size_t) offset > ((size_t) -1) - count) {
+    #ifdef EFBIG
+    errno = EFBIG;
+    #endif
+  } else {
+    size_t start  = (size_t) offset;
+    size_t size   = mio->impl.chunked.size;
+    
+    /* fill the gap like a file system would do */
+    if ((start <= size ||
+         chunked_write_at (mio, size, NULL, start - size) == start - size) &&
+        chunked_write_at (mio, start, ptr, count) == count) {
+      rv = (ssize_t) count;
+    }
+  }
+  
+  return rv;
+}
+
+static size_t
+chunked_readv (MIO                 *mio,
+               const struct iovec  *iov,
+               int                  iovcnt)
+{
+  size_t  n_read = 0;
+  int     i;
+  
+  for (i = 0; i < iovcnt; i++) {
+    size_t n = chunked_read (mio, iov[i].iov_base, 1, iov[i].iov_len);
+    
+    n_read += n;
+    if (n < iov[i].iov_len) {
+      break;
+    }
+  }
+  
+  return n_read;
+}
+
+static size_t
+chunked_writev (MIO                 *mio,
+                const struct iovec  *iov,
+                int                  iovcnt)
+{
+  size_t  n_written = 0;
+  int     i;
+  
+  for (i = 0; i < iovcnt; i++) {
+    size_t n = chunked_write (mio, iov[i].iov_base, 1, iov[i].iov_len);
+    
+    n_written += n;
+    if (n < iov[i].iov_len) {
+      break;
+    }
+  }
+  
+  return n_written;
+}
+
+static int
+chunked_mark (MIO *mio)
+{
+  chunked_sync (mio);
+  mio->mark.offset = (off_t) mio->impl.chunked.pos;
+  mio->mark.ungetch = mio->impl.chunked.ungetch;
+  
+  return 0;
+}
+
+static int
+chunked_reset (MIO *mio)
+{
+  chunked_sync (mio);
+  mio->impl.chunked.pos = (size_t) mio->mark.offset;
+  mio->impl.chunked.ungetch = mio->mark.ungetch;
+  mio->impl.chunked.eof = FALSE;
+  
+  return 0;
+}
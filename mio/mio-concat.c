@@ -0,0 +1,868 @@
+/*
+ *  MIO, an I/O abstraction layer replicating C file I/O API.
+ *  Copyright (C) 2010  Colomban Wendling <ban@herbesfolles.org>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ * 
+ */
+
+/* concatenation IO implementation, reading several segments in a row */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mio.h"
+
+#ifndef TRUE
+# define TRUE 1
+#endif
+#ifndef FALSE
+# define FALSE 0
+#endif
+
+
+#define CONCAT_SET_VTABLE(mio)          \
+  do {                                  \
+    mio->v_free     = concat_free;      \
+    mio->v_read     = concat_read;      \
+    mio->v_write    = concat_write;     \
+    mio->v_getc     = concat_getc;      \
+    mio->v_gets     = concat_gets;      \
+    mio->v_ungetc   = concat_ungetc;    \
+    mio->v_putc     = concat_putc;      \
+    mio->v_puts     = concat_puts;      \
+    mio->v_vprintf  = concat_vprintf;   \
+    mio->v_clearerr = concat_clearerr;  \
+    mio->v_eof      = concat_eof;       \
+    mio->v_error    = concat_error;     \
+    mio->v_seek     = concat_seek;      \
+    mio->v_tell     = concat_tell;      \
+    mio->v_rewind   = concat_rewind;    \
+    mio->v_getpos   = concat_getpos;    \
+    mio->v_setpos   = concat_setpos;    \
+    mio->v_peek     = concat_peek;      \
+    mio->v_consume  = concat_consume;   \
+    mio->v_reserve  = concat_reserve;   \
+    mio->v_commit   = concat_commit;    \
+    mio->v_pread    = concat_pread;     \
+    mio->v_pwrite   = concat_pwrite;    \
+    mio->v_readv    = concat_readv;     \
+    mio->v_writev   = concat_writev;    \
+    mio->v_mark     = concat_mark;      \
+    mio->v_reset    = concat_reset;     \
+  } while (0)
+
+/* size of the buffer used to read from #MIO segments */
+#define MIO_CONCAT_BUFFER_SIZE BUFSIZ
+
+/*
+ * Segments given as raw data, and the ones that are memory streams, are read
+ * in place.  The others are read with mio_pread() into a buffer holding
+ * @buf_len bytes of the stream starting at @buf_offset, which never spans
+ * several segments.  The read window points in either of them, @window being
+ * at the position @window_offset in the stream.
+ */
+struct _MIOConcatSegment {
+  MIO                  *mio;
+  const unsigned char  *data;
+  off_t                 start;
+  off_t                 size;
+};
+
+
+/*
+ * concat_sync:
+ * @mio: A #MIO object of the type %MIO_TYPE_CONCAT
+ * 
+ * Folds the read window back into the stream's position, and closes it.  This
+ * must be called before looking at the stream's position.
+ */
+static void
+concat_sync (MIO *mio)
+{
+  if (mio->read_ptr) {
+    mio->impl.concat.pos = mio->impl.concat.window_offset +
+                           (off_t) (mio->read_ptr - mio->impl.concat.window);
+    mio->read_ptr = NULL;
+    mio->read_end = NULL;
+  }
+}
+
+/*
+ * concat_lookup:
+ * @mio: A #MIO object of the type %MIO_TYPE_CONCAT
+ * @pos: A position in the stream, smaller than its size
+ * 
+ * Finds the segment holding the byte at @pos, trying the last one used first.
+ * 
+ * Returns: The segment holding @pos.
+ */
+static struct _MIOConcatSegment *
+concat_lookup (MIO  *mio,
+               off_t pos)
+{
+  struct _MIOConcatSegment *segments = mio->impl.concat.segments;
+  size_t                    i        = mio->impl.concat.current;
+  
+  if (pos < segments[i].start || pos - segments[i].start >= segments[i].size) {
+    size_t lo = 0;
+    size_t hi = mio->impl.concat.n_segments - 1;
+    
+    /* the last segment starting at or before @pos is the one holding it, as
+     * empty segments start at the same position as the next one */
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo + 1) / 2;
+      
+      if (segments[mid].start <= pos) {
+        lo = mid;
+      } else {
+        hi = mid - 1;
+      }
+    }
+    mio->impl.concat.current = i = lo;
+  }
+  
+  return &segments[i];
+}
+
+/*
+ * concat_segment_pread:
+ * @mio: A #MIO object of the type %MIO_TYPE_CONCAT
+ * @segment: A segment of @mio
+ * @ptr: Pointer to the memory to fill
+ * @count: Maximum number of bytes to read, not going past the end of @segment
+ * @offset: Position in the stream, inside @segment
+ * 
+ * Reads data from a single segment, without touching the stream's state.
+ * 
+ * Returns: The number of bytes read, or -1 on failure, with errno set.
+ */
+static ssize_t
+concat_segment_pread (MIO                              *mio,
+                      const struct _MIOConcatSegment   *segment,
+                      void                             *ptr,
+                      size_t                            count,
+                      off_t                             offset)
+{
+  ssize_t rv;
+  
+  if (! segment->mio) {
+    memcpy (ptr, &segment->data[offset - segment->start], count);
+    rv = (ssize_t) count;
+  } else {
+    rv = mio_pread (segment->mio, ptr, count, offset - segment->start);
+    if (rv == 0 && count > 0) {
+      /* the segment got shorter since the stream was created */
+      #ifdef EIO
+      errno = EIO;
+      #endif
+      rv = -1;
+    }
+  }
+  
+  return rv;
+}
+
+/*
+ * concat_fill:
+ * @mio: A #MIO object of the type %MIO_TYPE_CONCAT
+ * 
+ * Opens the read window at the current position, up to the end of the segment
+ * holding it.  The stream must be synchronized, and no character must be
+ * pushed back.
+ * 
+ * Returns: The number of bytes available in the read window.
+ */
+static size_t
+concat_fill (MIO *mio)
+{
+  size_t  n   = 0;
+  off_t   pos = mio->impl.concat.pos;
+  
+  if (pos >= 0 && pos < mio->impl.concat.size) {
+    struct _MIOConcatSegment *segment = concat_lookup (mio, pos);
+    size_t                    len;
+    
+    if (! segment->mio) {
+      mio->impl.concat.window = (unsigned char *) segment->data;
+      mio->impl.concat.window_offset = segment->start;
+      len = (size_t) segment->size;
+    } else {
+      if (pos < mio->impl.concat.buf_offset ||
+          pos - mio->impl.concat.buf_offset >=
+          (off_t) mio->impl.concat.buf_len) {
+        size_t  count = mio->impl.concat.buf_size;
+        ssize_t rv;
+        
+        if ((off_t) count > segment->start + segment->size - pos) {
+          count = (size_t) (segment->start + segment->size - pos);
+        }
+        mio->impl.concat.buf_offset = pos;
+        mio->impl.concat.buf_len = 0;
+        rv = concat_segment_pread (mio, segment, mio->impl.concat.buf, count,
+                                   pos);
+        if (rv < 0) {
+          mio->impl.concat.error = TRUE;
+        } else {
+          mio->impl.concat.buf_len = (size_t) rv;
+        }
+      }
+      mio->impl.concat.window = mio->impl.concat.buf;
+      mio->impl.concat.window_offset = mio->impl.concat.buf_offset;
+      len = mio->impl.concat.buf_len;
+    }
+    if (pos - mio->impl.concat.window_offset < (off_t) len) {
+      mio->read_ptr = mio->impl.concat.window +
+                      (pos - mio->impl.concat.window_offset);
+      mio->read_end = mio->impl.concat.window + len;
+      n = (size_t) (mio->read_end - mio->read_ptr);
+    }
+  }
+  
+  return n;
+}
+
+/*
+ * concat_segment_size:
+ * @mio: A #MIO object
+ * @size: Return location for the size of @mio
+ * 
+ * Gets the size of a #MIO object used as a segment, restoring its position.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static int
+concat_segment_size (MIO   *mio,
+                     off_t *size)
+{
+  int     success = FALSE;
+  MIOPos  pos;
+  
+  if (mio_getpos (mio, &pos) == 0) {
+    long end = -1;
+    
+    if (mio_seek (mio, 0, SEEK_END) == 0) {
+      end = mio_tell (mio);
+    }
+    if (mio_setpos (mio, &pos) == 0 && end >= 0) {
+      *size = (off_t) end;
+      success = TRUE;
+    }
+  }
+  
+  return success;
+}
+
+/*
+ * concat_open:
+ * @mio: A #MIO object
+ * @segments: The segments to concatenate
+ * @n_segments: The number of elements in @segments
+ * 
+ * Initializes @mio to read @segments one after the other.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static int
+concat_open (MIO              *mio,
+             const MIOSegment *segments,
+             size_t            n_segments)
+{
+  int                       success   = TRUE;
+  int                       need_buf  = FALSE;
+  off_t                     size      = 0;
+  struct _MIOConcatSegment *array;
+  size_t                    i;
+  
+  /* keep one segment even if there is none, so there is always a current one */
+  array = malloc (MAX (n_segments, 1) * sizeof *array);
+  if (! array) {
+    errno = ENOMEM;
+    success = FALSE;
+  } else {
+    array[0].mio = NULL;
+    array[0].data = NULL;
+    array[0].start = 0;
+    array[0].size = 0;
+  }
+  for (i = 0; success && i < n_segments; i++) {
+    MIO *segment = segments[i].mio;
+    
+    array[i].mio = NULL;
+    array[i].data = segments[i].data;
+    array[i].start = size;
+    array[i].size = (off_t) segments[i].size;
+    if (segment && segment->type == MIO_TYPE_MEMORY) {
+      size_t mem_size;
+      
+      /* read memory streams in place */
+      array[i].data = mio_memory_get_data (segment, &mem_size);
+      array[i].size = (off_t) mem_size;
+    } else if (segment) {
+      array[i].mio = segment;
+      array[i].data = NULL;
+      success = concat_segment_size (segment, &array[i].size);
+      need_buf = TRUE;
+    } else if (array[i].size < 0 ||
+               (size_t) array[i].size != segments[i].size) {
+      #ifdef EOVERFLOW
+      errno = EOVERFLOW;
+      #endif
+      success = FALSE;
+    }
+    if (success && array[i].size > MIO_OFF_MAX - size) {
+      #ifdef EOVERFLOW
+      errno = EOVERFLOW;
+      #endif
+      success = FALSE;
+    }
+    if (success) {
+      size += array[i].size;
+    }
+  }
+  mio->impl.concat.buf = NULL;
+  mio->impl.concat.buf_size = 0;
+  if (success && need_buf) {
+    mio->impl.concat.buf_size = MIO_CONCAT_BUFFER_SIZE;
+    mio->impl.concat.buf = malloc (mio->impl.concat.buf_size);
+    if (! mio->impl.concat.buf) {
+      errno = ENOMEM;
+      success = FALSE;
+    }
+  }
+  if (! success) {
+    free (array);
+  } else {
+    mio->impl.concat.segments = array;
+    mio->impl.concat.n_segments = MAX (n_segments, 1);
+    mio->impl.concat.current = 0;
+    mio->impl.concat.size = size;
+    mio->impl.concat.pos = 0;
+    mio->impl.concat.window = NULL;
+    mio->impl.concat.window_offset = 0;
+    mio->impl.concat.buf_offset = 0;
+    mio->impl.concat.buf_len = 0;
+    mio->impl.concat.ungetch = EOF;
+    mio->impl.concat.error = FALSE;
+    mio->impl.concat.eof = FALSE;
+  }
+  
+  return success;
+}
+
+static void
+concat_free (MIO *mio)
+{
+  concat_sync (mio);
+  free (mio->impl.concat.segments);
+  free (mio->impl.concat.buf);
+  mio->impl.concat.segments = NULL;
+  mio->impl.concat.n_segments = 0;
+  mio->impl.concat.buf = NULL;
+  mio->impl.concat.size = 0;
+  mio->impl.concat.pos = 0;
+}
+
+static size_t
+concat_read (MIO    *mio,
+             void   *ptr_,
+             size_t  size,
+             size_t  nmemb)
+{
+  size_t n_read = 0;
+  
+  concat_sync (mio);
+  if (size != 0 && nmemb != 0) {
+    size_t          n     = size * nmemb;
+    size_t          got   = 0;
+    unsigned char  *ptr   = ptr_;
+    
+    if (mio->impl.concat.ungetch != EOF) {
+      *ptr = (unsigned char) mio->impl.concat.ungetch;
+      mio->impl.concat.ungetch = EOF;
+      mio->impl.concat.pos++;
+      got++;
+    }
+    while (got < n) {
+      size_t avail = concat_fill (mio);
+      
+      if (avail == 0) {
+        break;
+      }
+      if (avail > n - got) {
+        avail = n - got;
+      }
+      memcpy (&ptr[got], mio->read_ptr, avail);
+      mio->read_ptr += avail;
+      concat_sync (mio);
+      got += avail;
+    }
+    if (mio->impl.concat.pos >= mio->impl.concat.size) {
+      mio->impl.concat.eof = TRUE;
+    }
+    n_read = got / size;
+  }
+  
+  return n_read;
+}
+
+static size_t
+concat_write (MIO         *mio,
+              const void  *ptr,
+              size_t       size,
+              size_t       nmemb)
+{
+  mio->impl.concat.error = TRUE;
+  errno = EBADF;
+  
+  return 0;
+}
+
+static int
+concat_putc (MIO  *mio,
+             int   c)
+{
+  mio->impl.concat.error = TRUE;
+  errno = EBADF;
+  
+  return EOF;
+}
+
+static int
+concat_puts (MIO        *mio,
+             const char *s)
+{
+  mio->impl.concat.error = TRUE;
+  errno = EBADF;
+  
+  return EOF;
+}
+
+__attribute__((__format__ (__printf__, 2, 0)))
+static int
+concat_vprintf (MIO         *mio,
+                const char  *format,
+                va_list      ap)
+{
+  mio->impl.concat.error = TRUE;
+  errno = EBADF;
+  
+  return -1;
+}
+
+static int
+concat_getc (MIO *mio)
+{
+  int rv = EOF;
+  
+  concat_sync (mio);
+  if (mio->impl.concat.ungetch != EOF) {
+    rv = mio->impl.concat.ungetch;
+    mio->impl.concat.ungetch = EOF;
+    mio->impl.concat.pos++;
+  } else if (concat_fill (mio) > 0) {
+    rv = *mio->read_ptr++;
+  } else if (mio->impl.concat.pos >= mio->impl.concat.size) {
+    mio->impl.concat.eof = TRUE;
+  }
+  
+  return rv;
+}
+
+static int
+concat_ungetc (MIO  *mio,
+               int   ch)
+{
+  int rv = EOF;
+  
+  concat_sync (mio);
+  if (ch != EOF && mio->impl.concat.ungetch == EOF) {
+    rv = mio->impl.concat.ungetch = ch;
+    mio->impl.concat.pos--;
+    mio->impl.concat.eof = FALSE;
+  }
+  
+  return rv;
+}
+
+static char *
+concat_gets (MIO    *mio,
+             char   *s,
+             size_t  size)
+{
+  char *rv = NULL;
+  
+  concat_sync (mio);
+  if (size > 0) {
+    size_t i = 0;
+    
+    if (mio->impl.concat.ungetch != EOF && size > 1) {
+      s[i] = (char) mio->impl.concat.ungetch;
+      mio->impl.concat.ungetch = EOF;
+      mio->impl.concat.pos++;
+      i++;
+    }
+    while (i < size - 1 && (i == 0 || s[i - 1] != '\n')) {
+      size_t          n = concat_fill (mio);
+      unsigned char  *nl;
+      
+      if (n == 0) {
+        break;
+      }
+      if (n > size - 1 - i) {
+        n = size - 1 - i;
+      }
+      nl = memchr (mio->read_ptr, '\n', n);
+      if (nl) {
+        n = (size_t) (nl - mio->read_ptr) + 1;
+      }
+      memcpy (&s[i], mio->read_ptr, n);
+      mio->read_ptr += n;
+      concat_sync (mio);
+      i += n;
+    }
+    if (i > 0) {
+      s[i] = 0;
+      rv = s;
+    }
+    if (mio->impl.concat.pos >= mio->impl.concat.size) {
+      mio->impl.concat.eof = TRUE;
+    }
+  }
+  
+  return rv;
+}
+
+static void
+concat_clearerr (MIO *mio)
+{
+  mio->impl.concat.error = FALSE;
+  mio->impl.concat.eof = FALSE;
+}
+
+static int
+concat_eof (MIO *mio)
+{
+  return mio->impl.concat.eof != FALSE;
+}
+
+static int
+concat_error (MIO *mio)
+{
+  return mio->impl.concat.error != FALSE;
+}
+
+static int
+concat_seek (MIO  *mio,
+             long  offset,
+             int   whence)
+{
+  int   rv = -1;
+  off_t base;
+  
+  concat_sync (mio);
+  switch (whence) {
+    case SEEK_SET:  base = 0;                       break;
+    case SEEK_CUR:  base = mio->impl.concat.pos;    break;
+    case SEEK_END:  base = mio->impl.concat.size;   break;
+    default:        base = -1;                      break;
+  }
+  if (base < 0 ||
+      (offset < 0 && (off_t) -offset > base) ||
+      (offset > 0 && (off_t) offset > mio->impl.concat.size - base)) {
+    errno = EINVAL;
+  } else {
+    mio->impl.concat.pos = base + offset;
+    mio->impl.concat.eof = FALSE;
+    mio->impl.concat.ungetch = EOF;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static long
+concat_tell (MIO *mio)
+{
+  long rv = -1;
+  
+  concat_sync (mio);
+  if (mio->impl.concat.pos > LONG_MAX) {
+    #ifdef EOVERFLOW
+    errno = EOVERFLOW;
+    #endif
+  } else if (mio->impl.concat.pos < 0) {
+    /* this happens if ungetc() was called at the start of the stream */
+    #ifdef EIO
+    errno = EIO;
+    #endif
+  } else {
+    rv = (long) mio->impl.concat.pos;
+  }
+  
+  return rv;
+}
+
+static void
+concat_rewind (MIO *mio)
+{
+  concat_sync (mio);
+  mio->impl.concat.pos = 0;
+  mio->impl.concat.ungetch = EOF;
+  mio->impl.concat.eof = FALSE;
+  mio->impl.concat.error = FALSE;
+}
+
+static int
+concat_getpos (MIO    *mio,
+               MIOPos *pos)
+{
+  int rv = -1;
+  
+  concat_sync (mio);
+  if (mio->impl.concat.pos < 0) {
+    /* this happens if ungetc() was called at the start of the stream */
+    #ifdef EIO
+    errno = EIO;
+    #endif
+  } else {
+    pos->impl.concat = mio->impl.concat.pos;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static int
+concat_setpos (MIO    *mio,
+               MIOPos *pos)
+{
+  int rv = -1;
+  
+  concat_sync (mio);
+  if (pos->impl.concat > mio->impl.concat.size) {
+    errno = EINVAL;
+  } else {
+    mio->impl.concat.ungetch = EOF;
+    mio->impl.concat.pos = pos->impl.concat;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static const unsigned char *
+concat_peek (MIO    *mio,
+             size_t *avail)
+{
+  const unsigned char *ptr = NULL;
+  
+  concat_sync (mio);
+  *avail = 0;
+  if (mio->impl.concat.ungetch != EOF &&
+      mio->impl.concat.pos >= 0 && concat_fill (mio) > 0 &&
+      *mio->read_ptr == mio->impl.concat.ungetch) {
+    /* the pushed back character is the one in the segment, forget it */
+    mio->impl.concat.ungetch = EOF;
+  }
+  concat_sync (mio);
+  if (mio->impl.concat.ungetch != EOF) {
+    ptr = &mem_bytes[(unsigned char) mio->impl.concat.ungetch];
+    *avail = 1;
+  } else if ((*avail = concat_fill (mio)) > 0) {
+    ptr = mio->read_ptr;
+  } else if (mio->impl.concat.pos >= mio->impl.concat.size) {
+    mio->impl.concat.eof = TRUE;
+  }
+  
+  return ptr;
+}
+
+static int
+concat_consume (MIO   *mio,
+                size_t n)
+{
+  int rv = -1;
+  
+  concat_sync (mio);
+  if (mio->impl.concat.ungetch != EOF) {
+    /* concat_peek() only gave the pushed back character */
+    if (n > 1) {
+      errno = EINVAL;
+    } else {
+      if (n == 1) {
+        mio->impl.concat.ungetch = EOF;
+        mio->impl.concat.pos++;
+      }
+      rv = 0;
+    }
+  } else if ((off_t) n > mio->impl.concat.size - mio->impl.concat.pos) {
+    errno = EINVAL;
+  } else {
+    mio->impl.concat.pos += (off_t) n;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static void *
+concat_reserve (MIO   *mio,
+                size_t n)
+{
+  mio->impl.concat.error = TRUE;
+  errno = EBADF;
+  
+  return NULL;
+}
+
+static int
+concat_commit (MIO   *mio,
+               size_t n)
+{
+  int rv = -1;
+  
+  if (n == 0) {
+    rv = 0;
+  } else {
+    errno = EBADF;
+  }
+  
+  return rv;
+}
+
+static ssize_t
+concat_pread (MIO   *mio,
+              void  *ptr_,
+              size_t count,
+              off_t  offset)
+{
+  ssize_t                   rv        = 0;
+  struct _MIOConcatSegment *segments  = mio->impl.concat.segments;
+  unsigned char            *ptr       = ptr_;
+  size_t                    got       = 0;
+  size_t                    lo        = 0;
+  size_t                    hi        = mio->impl.concat.n_segments - 1;
+  
+  count = MIN (count, ((size_t) -1) >> 1);
+  if (offset < mio->impl.concat.size &&
+      (off_t) count > mio->impl.concat.size - offset) {
+    count = (size_t) (mio->impl.concat.size - offset);
+  }
+  /* don't use concat_lookup() as it updates the stream, which would not be
+   * thread-safe */
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo + 1) / 2;
+    
+    if (segments[mid].start <= offset) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  while (offset < mio->impl.concat.size && got < count) {
+    const struct _MIOConcatSegment *segment = &segments[lo];
+    size_t                          n;
+    
+    if (offset - segment->start >= segment->size) {
+      lo++;
+      continue;
+    }
+    n = (size_t) (segment->start + segment->size - offset);
+    n = MIN (n, count - got);
+    rv = concat_segment_pread (mio, segment, &ptr[got], n, offset);
+    if (rv < 0) {
+      break;
+    }
+    got += (size_t) rv;
+    offset += (off_t) rv;
+  }
+  if (rv >= 0) {
+    rv = (ssize_t) got;
+  }
+  
+  return rv;
+}
+
+static ssize_t
+concat_pwrite (MIO        *mio,
+               const void *ptr,
+               size_t      count,
+               off_t       offset)
+{
+  errno = EBADF;
+  
+  return -1;
+}
+
+static size_t
+concat_readv (MIO                 *mio,
+              const struct iovec  *iov,
+              int                  iovcnt)
+{
+  size_t  n_read = 0;
+  int     i;
+  
+  for (i = 0; i < iovcnt; i++) {
+    size_t n = concat_read (mio, iov[i].iov_base, 1, iov[i].iov_len);
+    
+    n_read += n;
+    if (n < iov[i].iov_len) {
+      break;
+    }
+  }
+  
+  return n_read;
+}
+
+static size_t
+concat_writev (MIO                 *mio,
+               const struct iovec  *iov,
+               int                  iovcnt)
+{
+  mio->impl.concat.error = TRUE;
+  errno = EBADF;
+  
+  return 0;
+}
+
+static int
+concat_mark (MIO *mio)
+{
+  concat_sync (mio);
+  mio->mark.offset = mio->impl.concat.pos;
+  mio->mark.ungetch = mio->impl.concat.ungetch;
+  
+  return 0;
+}
+
+static int
+concat_reset (MIO *mio)
+{
+  concat_sync (mio);
+  mio->impl.concat.pos = mio->mark.offset;
+  mio->impl.concat.ungetch = mio->mark.ungetch;
+  mio->impl.concat.eof = FALSE;
+  
+  return 0;
+}
@@ -0,0 +1,1284 @@
+/*
+ *  MIO, an I/O abstraction layer replicating C file I/O API.
+ *  Copyright (C) 2010  Colomban Wendling <ban@herbesfolles.org>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ * 
+ */
+
+/* file descriptor IO implementation */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+# include <sys/types.h>
+# include <unistd.h>
+#endif
+
+#include "mio.h"
+
+#ifndef TRUE
+# define TRUE 1
+#endif
+#ifndef FALSE
+# define FALSE 0
+#endif
+
+
+#ifdef HAVE_UNISTD_H
+
+#define FD_SET_VTABLE(mio)            \
+  do {                                \
+    mio->v_free     = fd_free;        \
+    mio->v_read     = fd_read;        \
+    mio->v_write    = fd_write;       \
+    mio->v_getc     = fd_getc;        \
+    mio->v_gets     = fd_gets;        \
+    mio->v_ungetc   = fd_ungetc;      \
+    mio->v_putc     = fd_putc;        \
+    mio->v_puts     = fd_puts;        \
+    mio->v_vprintf  = fd_vprintf;     \
+    mio->v_clearerr = fd_clearerr;    \
+    mio->v_eof      = fd_eof;         \
+    mio->v_error    = fd_error;       \
+    mio->v_seek     = fd_seek;        \
+    mio->v_tell     = fd_tell;        \
+    mio->v_rewind   = fd_rewind;      \
+    mio->v_getpos   = fd_getpos;      \
+    mio->v_setpos   = fd_setpos;      \
+    mio->v_peek     = fd_peek;        \
+    mio->v_consume  = fd_consume;     \
+    mio->v_reserve  = fd_reserve;     \
+    mio->v_commit   = fd_commit;      \
+    mio->v_pread    = fd_pread;       \
+    mio->v_pwrite   = fd_pwrite;      \
+    mio->v_readv    = fd_readv;       \
+    mio->v_writev   = fd_writev;      \
+    mio->v_mark     = fd_mark;        \
+    mio->v_reset    = fd_reset;       \
+  } while (0)
+
+/* default size of the internal buffer */
+#define MIO_FD_BUFFER_SIZE 65536
+/* maximum number of vectors passed to a single readv() or writev() call, well
+ * below the IOV_MAX of any system */
+#define MIO_FD_IOV_MAX 64
+
+/*
+ * The buffer either holds data read from the file starting at @offset (@len
+ * bytes, the cursor being at @pos), or data waiting to be written at @offset
+ * (@dirty bytes, the cursor being at the end of them).  In both cases the
+ * position of the file descriptor is @offset + @len, so that the logical
+ * position of the stream is always @offset + @pos without any system call.
+ */
+
+
+/*
+ * fd_sync:
+ * @mio: A #MIO object of the type %MIO_TYPE_FD
+ * 
+ * Folds the fast path windows back into the stream's state, and closes them.
+ * This must be called before looking at the stream's position.
+ */
+static void
+fd_sync (MIO *mio)
+{
+  if (mio->read_ptr) {
+    mio->impl.fd.pos = (size_t) (mio->read_ptr - mio->impl.fd.buf);
+    mio->read_ptr = NULL;
+    mio->read_end = NULL;
+  } else if (mio->write_ptr) {
+    mio->impl.fd.pos = (size_t) (mio->write_ptr - mio->impl.fd.buf);
+    mio->impl.fd.dirty = mio->impl.fd.pos;
+    mio->write_ptr = NULL;
+    mio->write_end = NULL;
+  }
+}
+
+/*
+ * fd_write_all:
+ * @mio: A #MIO object of the type %MIO_TYPE_FD
+ * @ptr: Data to write
+ * @n: Length of @ptr
+ * 
+ * Writes @n bytes straight to the file descriptor, retrying on partial writes
+ * and interruptions.
+ * 
+ * Returns: The number of bytes actually written.
+ */
+static size_t
+fd_write_all (MIO                  *mio,
+              const unsigned char  *ptr,
+              size_t                n)
+{
+  size_t done = 0;
+  
+  while (done < n) {
+    ssize_t rv = write (mio->impl.fd.fd, &ptr[done], n - done);
+    
+    if (rv > 0) {
+      done += (size_t) rv;
+    } else if (rv < 0 && errno == EINTR) {
+      continue;
+    } else {
+      mio->impl.fd.error = TRUE;
+      break;
+    }
+  }
+  mio->impl.fd.offset += (off_t) done;
+  
+  return done;
+}
+
+/*
+ * fd_flush:
+ * @mio: A #MIO object of the type %MIO_TYPE_FD
+ * 
+ * Writes out the staged data, if any.  The stream must be synchronized.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static int
+fd_flush (MIO *mio)
+{
+  int success = TRUE;
+  
+  if (mio->impl.fd.dirty > 0) {
+    size_t n = mio->impl.fd.dirty;
+    
+    success = (fd_write_all (mio, mio->impl.fd.buf, n) == n);
+    mio->impl.fd.dirty = 0;
+    mio->impl.fd.pos = 0;
+  }
+  
+  return success;
+}
+
+/*
+ * fd_drop_buffer:
+ * @mio: A #MIO object of the type %MIO_TYPE_FD
+ * 
+ * Forgets the data read ahead, moving the file descriptor back to the logical
+ * position of the stream if needed.  The stream must be synchronized and must
+ * not have pending writes.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static int
+fd_drop_buffer (MIO *mio)
+{
+  int success = TRUE;
+  
+  if (mio->impl.fd.dirty > 0 || mio->impl.fd.len == 0) {
+    /* nothing read ahead */
+  } else if (mio->impl.fd.pos < mio->impl.fd.len) {
+    off_t target = mio->impl.fd.offset + (off_t) mio->impl.fd.pos;
+    
+    if (lseek (mio->impl.fd.fd, target, SEEK_SET) == (off_t) -1) {
+      success = FALSE;
+    }
+  }
+  if (success && mio->impl.fd.len > 0) {
+    mio->impl.fd.offset += (off_t) mio->impl.fd.pos;
+    mio->impl.fd.len = 0;
+    mio->impl.fd.pos = 0;
+    mio->impl.fd.patched = FALSE;
+  }
+  
+  return success;
+}
+
+/*
+ * fd_retain:
+ * @mio: A #MIO object of the type %MIO_TYPE_FD with a mark
+ * 
+ * Makes room after the buffered data while keeping the data read since the
+ * mark for mio_reset(), moving it to the start of the buffer and growing the
+ * buffer if it fills more than half of it.
+ * 
+ * Returns: %TRUE on success, %FALSE if the mark has to be dropped.
+ */
+static int
+fd_retain (MIO *mio)
+{
+  int     success = FALSE;
+  size_t  keep    = mio->impl.fd.len - (size_t) mio->mark.offset;
+  
+  if (keep > mio->mark.limit) {
+    /* too far from the mark */
+  } else if (mio->impl.fd.len < mio->impl.fd.buf_size) {
+    success = TRUE;
+  } else {
+    if (keep > mio->impl.fd.buf_size / 2) {
+      /* keep a spare byte as in the constructor, see fd_ungetc() */
+      unsigned char *buf = realloc (mio->impl.fd.buf, keep * 2 + 1);
+      
+      if (buf) {
+        mio->impl.fd.buf = buf;
+        mio->impl.fd.buf_size = keep * 2;
+      }
+    }
+    if (keep <= mio->impl.fd.buf_size / 2) {
+      memmove (mio->impl.fd.buf, &mio->impl.fd.buf[mio->mark.offset], keep);
+      mio->impl.fd.offset += mio->mark.offset;
+      mio->impl.fd.len = keep;
+      mio->mark.offset = 0;
+      success = TRUE;
+    }
+  }
+  
+  return success;
+}
+
+/*
+ * fd_fill:
+ * @mio: A #MIO object of the type %MIO_TYPE_FD
+ * 
+ * Refills the buffer from the file descriptor, and opens the read window over
+ * the new data.  The buffer must have been consumed and must not have pending
+ * writes.  If there is a mark, the data read since it is kept in the buffer,
+ * see fd_retain().
+ * 
+ * Returns: The number of bytes available in the read window.
+ */
+static size_t
+fd_fill (MIO *mio)
+{
+  ssize_t rv;
+  
+  if (mio->mark.active && ! fd_retain (mio)) {
+    mio->mark.active = FALSE;
+  }
+  if (! mio->mark.active) {
+    mio->impl.fd.offset += (off_t) mio->impl.fd.len;
+    mio->impl.fd.len = 0;
+    mio->impl.fd.patched = FALSE;
+  }
+  mio->impl.fd.pos = mio->impl.fd.len;
+  do {
+    rv = read (mio->impl.fd.fd, &mio->impl.fd.buf[mio->impl.fd.len],
+               mio->impl.fd.buf_size - mio->impl.fd.len);
+  } while (rv < 0 && errno == EINTR);
+  if (rv > 0) {
+    mio->impl.fd.len += (size_t) rv;
+    mio->read_ptr = &mio->impl.fd.buf[mio->impl.fd.pos];
+    mio->read_end = &mio->impl.fd.buf[mio->impl.fd.len];
+  } else if (rv == 0) {
+    mio->impl.fd.eof = TRUE;
+  } else {
+    mio->impl.fd.error = TRUE;
+  }
+  
+  return mio->impl.fd.len - mio->impl.fd.pos;
+}
+
+/*
+ * fd_start_write:
+ * @mio: A #MIO object of the type %MIO_TYPE_FD
+ * @n: Number of bytes about to be written
+ * 
+ * Prepares the buffer to stage @n bytes, dropping the data read ahead,
+ * flushing the staged data if there is not enough room left and growing the
+ * buffer if @n is bigger than it.  The stream must be synchronized.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static int
+fd_start_write (MIO    *mio,
+                size_t  n)
+{
+  int success = FALSE;
+  
+  if (! fd_drop_buffer (mio)) {
+    mio->impl.fd.error = TRUE;
+  } else if (n > mio->impl.fd.buf_size - mio->impl.fd.dirty &&
+             ! fd_flush (mio)) {
+    /* error already set */
+  } else if (n > mio->impl.fd.buf_size) {
+    /* keep a spare byte as in the constructor, see fd_ungetc() */
+    unsigned char *buf = realloc (mio->impl.fd.buf, n + 1);
+    
+    if (buf) {
+      mio->impl.fd.buf = buf;
+      mio->impl.fd.buf_size = n;
+      success = TRUE;
+    }
+  } else {
+    success = TRUE;
+  }
+  
+  return success;
+}
+
+static void
+fd_free (MIO *mio)
+{
+  fd_sync (mio);
+  fd_flush (mio);
+  free (mio->impl.fd.buf);
+  if (mio->impl.fd.close_func) {
+    mio->impl.fd.close_func (mio->impl.fd.fd);
+  }
+  mio->impl.fd.close_func = NULL;
+  mio->impl.fd.fd = -1;
+  mio->impl.fd.buf = NULL;
+  mio->impl.fd.buf_size = 0;
+  mio->impl.fd.len = 0;
+  mio->impl.fd.pos = 0;
+}
+
+static size_t
+fd_read (MIO    *mio,
+         void   *ptr_,
+         size_t  size,
+         size_t  nmemb)
+{
+  size_t n_read = 0;
+  
+  fd_sync (mio);
+  if (size != 0 && nmemb != 0 && fd_flush (mio)) {
+    size_t          n     = size * nmemb;
+    size_t          got   = 0;
+    unsigned char  *ptr   = ptr_;
+    
+    while (got < n) {
+      size_t avail = mio->impl.fd.len - mio->impl.fd.pos;
+      
+      if (avail > 0) {
+        if (avail > n - got) {
+          avail = n - got;
+        }
+        memcpy (&ptr[got], &mio->impl.fd.buf[mio->impl.fd.pos], avail);
+        mio->impl.fd.pos += avail;
+        got += avail;
+      } else if (n - got >= mio->impl.fd.buf_size && ! mio->mark.active) {
+        /* big read, bypass the buffer */
+        ssize_t rv;
+        
+        mio->impl.fd.offset += (off_t) mio->impl.fd.len;
+        mio->impl.fd.len = 0;
+        mio->impl.fd.pos = 0;
+        mio->impl.fd.patched = FALSE;
+        do {
+          rv = read (mio->impl.fd.fd, &ptr[got], n - got);
+        } while (rv < 0 && errno == EINTR);
+        if (rv > 0) {
+          mio->impl.fd.offset += (off_t) rv;
+          got += (size_t) rv;
+        } else {
+          if (rv == 0) {
+            mio->impl.fd.eof = TRUE;
+          } else {
+            mio->impl.fd.error = TRUE;
+          }
+          break;
+        }
+      } else {
+        if (fd_fill (mio) == 0) {
+          break;
+        }
+        /* we handle the buffer directly */
+        mio->read_ptr = NULL;
+        mio->read_end = NULL;
+      }
+    }
+    n_read = got / size;
+  }
+  
+  return n_read;
+}
+
+/*
+ * fd_write_bytes:
+ * @mio: A #MIO object of the type %MIO_TYPE_FD
+ * @ptr: Data to write
+ * @n: Length of @ptr
+ * 
+ * Writes @n bytes to the stream, staging them in the buffer unless they don't
+ * fit in it.
+ * 
+ * Returns: The number of bytes actually written.
+ */
+static size_t
+fd_write_bytes (MIO        *mio,
+                const void *ptr,
+                size_t      n)
+{
+  size_t n_written = 0;
+  
+  fd_sync (mio);
+  if (n >= mio->impl.fd.buf_size) {
+    /* too big for the buffer, bypass it */
+    if (! fd_drop_buffer (mio)) {
+      mio->impl.fd.error = TRUE;
+    } else if (fd_flush (mio)) {
+      n_written = fd_write_all (mio, ptr, n);
+    }
+  } else if (fd_start_write (mio, n)) {
+    memcpy (&mio->impl.fd.buf[mio->impl.fd.dirty], ptr, n);
+    mio->impl.fd.dirty += n;
+    mio->impl.fd.pos = mio->impl.fd.dirty;
+    n_written = n;
+  }
+  
+  return n_written;
+}
+
+static size_t
+fd_write (MIO         *mio,
+          const void  *ptr,
+          size_t       size,
+          size_t       nmemb)
+{
+  size_t n_written = 0;
+  
+  if (size != 0 && nmemb != 0) {
+    n_written = fd_write_bytes (mio, ptr, size * nmemb) / size;
+  }
+  
+  return n_written;
+}
+
+static int
+fd_putc (MIO  *mio,
+         int   c)
+{
+  int rv = EOF;
+  
+  fd_sync (mio);
+  if (fd_start_write (mio, 1)) {
+    mio->impl.fd.buf[mio->impl.fd.dirty] = (unsigned char) c;
+    mio->impl.fd.dirty++;
+    mio->impl.fd.pos = mio->impl.fd.dirty;
+    rv = (int) ((unsigned char) c);
+    /* open the write window over the remaining buffer space */
+    mio->write_ptr = &mio->impl.fd.buf[mio->impl.fd.dirty];
+    mio->write_end = &mio->impl.fd.buf[mio->impl.fd.buf_size];
+  }
+  
+  return rv;
+}
+
+static int
+fd_puts (MIO        *mio,
+         const char *s)
+{
+  size_t len = strlen (s);
+  
+  return (fd_write_bytes (mio, s, len) == len) ? 1 : EOF;
+}
+
+__attribute__((__format__ (__printf__, 2, 0)))
+static int
+fd_vprintf (MIO         *mio,
+            const char  *format,
+            va_list      ap)
+{
+  return format_vprintf (mio, format, ap);
+}
+
+static int
+fd_getc (MIO *mio)
+{
+  int rv = EOF;
+  
+  fd_sync (mio);
+  if (fd_flush (mio)) {
+    if (mio->impl.fd.pos < mio->impl.fd.len) {
+      /* open the read window over the remaining data */
+      mio->read_ptr = &mio->impl.fd.buf[mio->impl.fd.pos];
+      mio->read_end = &mio->impl.fd.buf[mio->impl.fd.len];
+    } else {
+      fd_fill (mio);
+    }
+    if (mio->read_ptr < mio->read_end) {
+      rv = *mio->read_ptr++;
+    }
+  }
+  
+  return rv;
+}
+
+static int
+fd_ungetc (MIO  *mio,
+           int   ch)
+{
+  int rv = EOF;
+  
+  fd_sync (mio);
+  if (ch != EOF && fd_flush (mio)) {
+    if (mio->impl.fd.pos == 0 && mio->impl.fd.len <= mio->impl.fd.buf_size) {
+      /* make room for the character by moving the data forward, using the
+       * spare byte at the end of the buffer if needed */
+      memmove (&mio->impl.fd.buf[1], mio->impl.fd.buf, mio->impl.fd.len);
+      mio->impl.fd.offset--;
+      mio->impl.fd.len++;
+      mio->impl.fd.pos++;
+      mio->impl.fd.patched = TRUE;
+    }
+    if (mio->impl.fd.pos > 0) {
+      mio->impl.fd.pos--;
+      if (mio->impl.fd.buf[mio->impl.fd.pos] != (unsigned char) ch) {
+        mio->impl.fd.buf[mio->impl.fd.pos] = (unsigned char) ch;
+        mio->impl.fd.patched = TRUE;
+      }
+      mio->impl.fd.eof = FALSE;
+      rv = (int) ((unsigned char) ch);
+    }
+  }
+  
+  return rv;
+}
+
+static char *
+fd_gets (MIO    *mio,
+         char   *s,
+         size_t  size)
+{
+  char *rv = NULL;
+  
+  fd_sync (mio);
+  if (size > 0 && fd_flush (mio)) {
+    size_t i = 0;
+    
+    while (i < size - 1) {
+      size_t          n;
+      unsigned char  *nl;
+      
+      if (mio->impl.fd.pos >= mio->impl.fd.len) {
+        if (fd_fill (mio) == 0) {
+          break;
+        }
+        mio->read_ptr = NULL;
+        mio->read_end = NULL;
+      }
+      n = mio->impl.fd.len - mio->impl.fd.pos;
+      if (n > size - 1 - i) {
+        n = size - 1 - i;
+      }
+      nl = memchr (&mio->impl.fd.buf[mio->impl.fd.pos], '\n', n);
+      if (nl) {
+        n = (size_t) (nl - &mio->impl.fd.buf[mio->impl.fd.pos]) + 1;
+      }
+      memcpy (&s[i], &mio->impl.fd.buf[mio->impl.fd.pos], n);
+      mio->impl.fd.pos += n;
+      i += n;
+      if (nl) {
+        break;
+      }
+    }
+    if (i > 0 || size == 1) {
+      s[i] = 0;
+      rv = s;
+    }
+  }
+  
+  return rv;
+}
+
+static void
+fd_clearerr (MIO *mio)
+{
+  mio->impl.fd.error = FALSE;
+  mio->impl.fd.eof = FALSE;
+}
+
+static int
+fd_eof (MIO *mio)
+{
+  return mio->impl.fd.eof != FALSE;
+}
+
+static int
+fd_error (MIO *mio)
+{
+  return mio->impl.fd.error != FALSE;
+}
+
+/*
+ * fd_seek_to:
+ * @mio: A #MIO object of the type %MIO_TYPE_FD
+ * @target: The absolute position to move to
+ * 
+ * Moves the cursor to @target.  Positions inside the buffered data are
+ * reached without any system call.
+ * 
+ * Returns: 0 on success, -1 otherwise.
+ */
+static int
+fd_seek_to (MIO  *mio,
+            off_t target)
+{
+  int rv = -1;
+  
+  if (target < 0) {
+    errno = EINVAL;
+  } else if (mio->impl.fd.dirty == 0 && ! mio->impl.fd.patched &&
+             target >= mio->impl.fd.offset &&
+             target - mio->impl.fd.offset <= (off_t) mio->impl.fd.len) {
+    mio->impl.fd.pos = (size_t) (target - mio->impl.fd.offset);
+    rv = 0;
+  } else if (fd_flush (mio)) {
+    if (lseek (mio->impl.fd.fd, target, SEEK_SET) != (off_t) -1) {
+      mio->impl.fd.offset = target;
+      mio->impl.fd.len = 0;
+      mio->impl.fd.pos = 0;
+      mio->impl.fd.patched = FALSE;
+      rv = 0;
+    }
+  }
+  if (rv == 0) {
+    mio->impl.fd.eof = FALSE;
+  }
+  
+  return rv;
+}
+
+static int
+fd_seek (MIO  *mio,
+         long  offset,
+         int   whence)
+{
+  int rv = -1;
+  
+  fd_sync (mio);
+  switch (whence) {
+    case SEEK_SET:
+      rv = fd_seek_to (mio, (off_t) offset);
+      break;
+    
+    case SEEK_CUR:
+      rv = fd_seek_to (mio, mio->impl.fd.offset + (off_t) mio->impl.fd.pos +
+                            (off_t) offset);
+      break;
+    
+    case SEEK_END:
+      /* we need to ask the system anyway */
+      if (fd_flush (mio)) {
+        off_t end = lseek (mio->impl.fd.fd, 0, SEEK_END);
+        
+        if (end == (off_t) -1 ||
+            lseek (mio->impl.fd.fd, mio->impl.fd.offset + (off_t) mio->impl.fd.len,
+                   SEEK_SET) == (off_t) -1) {
+          /* errno is already set */
+        } else {
+          rv = fd_seek_to (mio, end + (off_t) offset);
+        }
+      }
+      break;
+    
+    default:
+      errno = EINVAL;
+  }
+  
+  return rv;
+}
+
+static long
+fd_tell (MIO *mio)
+{
+  long  rv = -1;
+  off_t pos;
+  
+  fd_sync (mio);
+  pos = mio->impl.fd.offset + (off_t) mio->impl.fd.pos;
+  if (pos < 0) {
+    /* this happens if ungetc() was called at the start of the stream */
+    #ifdef EIO
+    errno = EIO;
+    #endif
+  } else if (pos > LONG_MAX) {
+    #ifdef EOVERFLOW
+    errno = EOVERFLOW;
+    #endif
+  } else {
+    rv = (long) pos;
+  }
+  
+  return rv;
+}
+
+static void
+fd_rewind (MIO *mio)
+{
+  fd_sync (mio);
+  fd_seek_to (mio, 0);
+  mio->impl.fd.error = FALSE;
+}
+
+static int
+fd_getpos (MIO    *mio,
+           MIOPos *pos)
+{
+  int rv = -1;
+  
+  fd_sync (mio);
+  pos->impl.fd = mio->impl.fd.offset + (off_t) mio->impl.fd.pos;
+  if (pos->impl.fd < 0) {
+    /* this happens if ungetc() was called at the start of the stream */
+    #ifdef EIO
+    errno = EIO;
+    #endif
+  } else {
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static int
+fd_setpos (MIO    *mio,
+           MIOPos *pos)
+{
+  fd_sync (mio);
+  
+  return fd_seek_to (mio, pos->impl.fd);
+}
+
+static const unsigned char *
+fd_peek (MIO    *mio,
+         size_t *avail)
+{
+  const unsigned char *ptr = NULL;
+  
+  fd_sync (mio);
+  *avail = 0;
+  if (fd_flush (mio) &&
+      (mio->impl.fd.pos < mio->impl.fd.len || fd_fill (mio) > 0)) {
+    mio->read_ptr = &mio->impl.fd.buf[mio->impl.fd.pos];
+    mio->read_end = &mio->impl.fd.buf[mio->impl.fd.len];
+    ptr = mio->read_ptr;
+    *avail = mio->impl.fd.len - mio->impl.fd.pos;
+  }
+  
+  return ptr;
+}
+
+static int
+fd_consume (MIO   *mio,
+            size_t n)
+{
+  int rv = -1;
+  
+  fd_sync (mio);
+  if (mio->impl.fd.dirty > 0 || n > mio->impl.fd.len - mio->impl.fd.pos) {
+    errno = EINVAL;
+  } else {
+    mio->impl.fd.pos += n;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static void *
+fd_reserve (MIO   *mio,
+            size_t n)
+{
+  void *ptr = NULL;
+  
+  fd_sync (mio);
+  if (fd_start_write (mio, n)) {
+    mio->write_ptr = &mio->impl.fd.buf[mio->impl.fd.dirty];
+    mio->write_end = &mio->impl.fd.buf[mio->impl.fd.buf_size];
+    ptr = mio->write_ptr;
+  }
+  
+  return ptr;
+}
+
+static int
+fd_commit (MIO   *mio,
+           size_t n)
+{
+  int rv = -1;
+  
+  /* mio_write_commit() already handled everything within the write window */
+  if (n == 0) {
+    rv = 0;
+  } else {
+    errno = EINVAL;
+  }
+  
+  return rv;
+}
+
+static ssize_t
+fd_pread (MIO   *mio,
+          void  *ptr,
+          size_t count,
+          off_t  offset)
+{
+  ssize_t rv = -1;
+
+#ifdef HAVE_PREAD
+  /* only flush pending writes so concurrent reads don't touch the stream */
+  if (mio->write_ptr || mio->impl.fd.dirty > 0) {
+    fd_sync (mio);
+    fd_flush (mio);
+  }
+  do {
+    rv = pread (mio->impl.fd.fd, ptr, count, offset);
+  } while (rv < 0 && errno == EINTR);
+#else
+  #ifdef ENOSYS
+  errno = ENOSYS;
+  #endif
+#endif
+
+  return rv;
+}
+
+static ssize_t
+fd_pwrite (MIO        *mio,
+           const void *ptr,
+           size_t      count,
+           off_t       offset)
+{
+  ssize_t rv = -1;
+
+#ifdef HAVE_PWRITE
+  fd_sync (mio);
+  if (fd_flush (mio)) {
+    do {
+      rv = pwrite (mio->impl.fd.fd, ptr, count, offset);
+    } while (rv < 0 && errno == EINTR);
+  }
+  if (rv > 0 && mio->impl.fd.len > 0) {
+    /* update the part of the read-ahead data that was overwritten */
+    off_t start = MAX (offset, mio->impl.fd.offset);
+    off_t end   = MIN (offset + (off_t) rv,
+                       mio->impl.fd.offset + (off_t) mio->impl.fd.len);
+    
+    if (start < end) {
+      memcpy (&mio->impl.fd.buf[start - mio->impl.fd.offset],
+              (const unsigned char *) ptr + (start - offset),
+              (size_t) (end - start));
+    }
+  }
+#else
+  #ifdef ENOSYS
+  errno = ENOSYS;
+  #endif
+#endif
+
+  return rv;
+}
+
+#if defined (HAVE_READV) || defined (HAVE_WRITEV)
+
+/*
+ * fd_iov_batch:
+ * @vec: Array to fill
+ * @max: Size of @vec
+ * @iov: The vectors to take from
+ * @iovcnt: Number of vectors in @iov
+ * @i: Index of the first vector to take
+ * @skip: Number of bytes already transferred from @iov[@i]
+ * 
+ * Fills @vec with what remains to be transferred of @iov, leaving out empty
+ * vectors.
+ * 
+ * Returns: The number of vectors stored in @vec.
+ */
+static int
+fd_iov_batch (struct iovec        *vec,
+              int                  max,
+              const struct iovec  *iov,
+              int                  iovcnt,
+              int                  i,
+              size_t               skip)
+{
+  int n = 0;
+  
+  for (; i < iovcnt && n < max; i++) {
+    if (iov[i].iov_len > skip) {
+      vec[n].iov_base = (unsigned char *) iov[i].iov_base + skip;
+      vec[n].iov_len = iov[i].iov_len - skip;
+      n++;
+    }
+    skip = 0;
+  }
+  
+  return n;
+}
+
+/*
+ * fd_iov_advance:
+ * @iov: The vectors being transferred
+ * @i: Return location for the index of the current vector
+ * @skip: Return location for the number of bytes transferred from @iov[*@i]
+ * @n: Number of bytes just transferred
+ * 
+ * Moves the position in @iov forward by @n bytes.
+ */
+static void
+fd_iov_advance (const struct iovec *iov,
+                int                *i,
+                size_t             *skip,
+                size_t              n)
+{
+  while (n > 0) {
+    size_t left = iov[*i].iov_len - *skip;
+    
+    if (n < left) {
+      *skip += n;
+      n = 0;
+    } else {
+      n -= left;
+      (*i)++;
+      *skip = 0;
+    }
+  }
+}
+
+#endif /* HAVE_READV || HAVE_WRITEV */
+
+#ifdef HAVE_READV
+
+/*
+ * fd_readv_direct:
+ * @mio: A #MIO object of the type %MIO_TYPE_FD
+ * @iov: The vectors to fill
+ * @iovcnt: Number of vectors in @iov
+ * @i: Index of the first vector to fill
+ * @skip: Number of bytes already stored in @iov[@i]
+ * 
+ * Reads straight from the file descriptor into the vectors, bypassing the
+ * buffer.  The data read ahead must have been consumed.
+ * 
+ * Returns: The number of bytes actually read.
+ */
+static size_t
+fd_readv_direct (MIO                 *mio,
+                 const struct iovec  *iov,
+                 int                  iovcnt,
+                 int                  i,
+                 size_t               skip)
+{
+  struct iovec  vec[MIO_FD_IOV_MAX];
+  size_t        got = 0;
+  int           n;
+  
+  mio->impl.fd.offset += (off_t) mio->impl.fd.len;
+  mio->impl.fd.len = 0;
+  mio->impl.fd.pos = 0;
+  mio->impl.fd.patched = FALSE;
+  while ((n = fd_iov_batch (vec, MIO_FD_IOV_MAX, iov, iovcnt, i, skip)) > 0) {
+    ssize_t rv;
+    
+    do {
+      rv = readv (mio->impl.fd.fd, vec, n);
+    } while (rv < 0 && errno == EINTR);
+    if (rv > 0) {
+      mio->impl.fd.offset += (off_t) rv;
+      got += (size_t) rv;
+      fd_iov_advance (iov, &i, &skip, (size_t) rv);
+    } else {
+      if (rv == 0) {
+        mio->impl.fd.eof = TRUE;
+      } else {
+        mio->impl.fd.error = TRUE;
+      }
+      break;
+    }
+  }
+  
+  return got;
+}
+
+#endif /* HAVE_READV */
+
+/*
+ * fd_writev_all:
+ * @mio: A #MIO object of the type %MIO_TYPE_FD
+ * @iov: The vectors to write
+ * @iovcnt: Number of vectors in @iov
+ * 
+ * Writes the staged data followed by @iov straight to the file descriptor,
+ * gathering them in as few system calls as possible and retrying on partial
+ * writes and interruptions.  The stream must be synchronized and must not
+ * have data read ahead.
+ * 
+ * Returns: The number of bytes of @iov actually written.
+ */
+static size_t
+fd_writev_all (MIO                 *mio,
+               const struct iovec  *iov,
+               int                  iovcnt)
+{
+  size_t done = 0;
+
+#ifdef HAVE_WRITEV
+  struct iovec  vec[MIO_FD_IOV_MAX];
+  size_t        head  = mio->impl.fd.dirty;
+  size_t        skip  = 0;
+  int           i     = 0;
+  
+  for (;;) {
+    int     n = 0;
+    ssize_t rv;
+    
+    if (head > 0) {
+      vec[0].iov_base = &mio->impl.fd.buf[mio->impl.fd.dirty - head];
+      vec[0].iov_len = head;
+      n = 1;
+    }
+    n += fd_iov_batch (&vec[n], MIO_FD_IOV_MAX - n, iov, iovcnt, i, skip);
+    if (n == 0) {
+      break;
+    }
+    do {
+      rv = writev (mio->impl.fd.fd, vec, n);
+    } while (rv < 0 && errno == EINTR);
+    if (rv > 0) {
+      size_t m = (size_t) rv;
+      size_t h = MIN (m, head);
+      
+      mio->impl.fd.offset += (off_t) rv;
+      head -= h;
+      done += m - h;
+      fd_iov_advance (iov, &i, &skip, m - h);
+    } else {
+      mio->impl.fd.error = TRUE;
+      break;
+    }
+  }
+  mio->impl.fd.dirty = 0;
+  mio->impl.fd.pos = 0;
+#else
+  int i;
+  
+  if (fd_flush (mio)) {
+    for (i = 0; i < iovcnt && ! mio->impl.fd.error; i++) {
+      done += fd_write_all (mio, iov[i].iov_base, iov[i].iov_len);
+    }
+  }
+#endif
+
+  return done;
+}
+
+static size_t
+fd_readv (MIO                 *mio,
+          const struct iovec  *iov,
+          int                  iovcnt)
+{
+  size_t  got   = 0;
+  size_t  want  = 0;
+  size_t  skip  = 0;
+  int     i     = 0;
+  int     j;
+  
+  fd_sync (mio);
+  if (! fd_flush (mio)) {
+    i = iovcnt;
+  }
+  /* start with the data read ahead */
+  while (i < iovcnt && mio->impl.fd.pos < mio->impl.fd.len) {
+    size_t n = MIN (iov[i].iov_len - skip,
+                    mio->impl.fd.len - mio->impl.fd.pos);
+    
+    memcpy ((unsigned char *) iov[i].iov_base + skip,
+            &mio->impl.fd.buf[mio->impl.fd.pos], n);
+    mio->impl.fd.pos += n;
+    got += n;
+    skip += n;
+    if (skip == iov[i].iov_len) {
+      i++;
+      skip = 0;
+    }
+  }
+  for (j = i; j < iovcnt; j++) {
+    want += iov[j].iov_len;
+  }
+  want -= skip;
+#ifdef HAVE_READV
+  if (want >= mio->impl.fd.buf_size && ! mio->mark.active) {
+    /* big read, bypass the buffer */
+    got += fd_readv_direct (mio, iov, iovcnt, i, skip);
+    i = iovcnt;
+  }
+#endif
+  for (; i < iovcnt; i++) {
+    size_t len  = iov[i].iov_len - skip;
+    size_t n    = fd_read (mio, (unsigned char *) iov[i].iov_base + skip, 1,
+                           len);
+    
+    got += n;
+    skip = 0;
+    if (n < len) {
+      break;
+    }
+  }
+  
+  return got;
+}
+
+static size_t
+fd_writev (MIO                 *mio,
+           const struct iovec  *iov,
+           int                  iovcnt)
+{
+  size_t  n_written = 0;
+  size_t  total     = 0;
+  int     i;
+  
+  fd_sync (mio);
+  for (i = 0; i < iovcnt; i++) {
+    total += iov[i].iov_len;
+  }
+  if (total >= mio->impl.fd.buf_size) {
+    /* too big for the buffer, bypass it */
+    if (! fd_drop_buffer (mio)) {
+      mio->impl.fd.error = TRUE;
+    } else {
+      n_written = fd_writev_all (mio, iov, iovcnt);
+    }
+  } else if (total > 0 && fd_start_write (mio, total)) {
+    /* the whole batch fits in the buffer, stage it at once */
+    for (i = 0; i < iovcnt; i++) {
+      memcpy (&mio->impl.fd.buf[mio->impl.fd.dirty], iov[i].iov_base,
+              iov[i].iov_len);
+      mio->impl.fd.dirty += iov[i].iov_len;
+    }
+    mio->impl.fd.pos = mio->impl.fd.dirty;
+    n_written = total;
+  }
+  
+  return n_written;
+}
+
+static int
+fd_mark (MIO *mio)
+{
+  int rv = -1;
+  
+  fd_sync (mio);
+  if (fd_flush (mio)) {
+    mio->mark.offset = (off_t) mio->impl.fd.pos;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static int
+fd_reset (MIO *mio)
+{
+  /* the data since the mark is still in the buffer, see fd_fill() */
+  fd_sync (mio);
+  mio->impl.fd.pos = (size_t) mio->mark.offset;
+  mio->impl.fd.eof = FALSE;
+  
+  return 0;
+}
+
+/*
+ * fd_sync_descriptor:
+ * @mio: A #MIO object of the type %MIO_TYPE_FD
+ * 
+ * Writes out the staged data and moves the file descriptor to the logical
+ * position of the stream, so it can be used directly.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static int
+fd_sync_descriptor (MIO *mio)
+{
+  fd_sync (mio);
+  
+  return fd_flush (mio) && fd_drop_buffer (mio);
+}
+
+/*
+ * fd_open:
+ * @mio: A #MIO object
+ * @fd: The file descriptor to work on
+ * @buffer_size: Size of the internal buffer, or 0 for the default
+ * @close_func: Function to close @fd with, or %NULL
+ * 
+ * Initializes @mio as a file descriptor stream.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise, with errno set.
+ */
+static int
+fd_open (MIO         *mio,
+         int          fd,
+         size_t       buffer_size,
+         MIOCloseFunc close_func)
+{
+  off_t offset;
+  
+  if (buffer_size == 0) {
+    buffer_size = MIO_FD_BUFFER_SIZE;
+  }
+  /* the current position, or 0 for non-seekable descriptors */
+  offset = lseek (fd, 0, SEEK_CUR);
+  if (offset == (off_t) -1) {
+    offset = 0;
+  }
+  mio->impl.fd.fd = fd;
+  mio->impl.fd.close_func = close_func;
+  /* a spare byte is allocated for fd_ungetc() */
+  mio->impl.fd.buf = (buffer_size < (size_t) -1) ? malloc (buffer_size + 1)
+                                                 : NULL;
+  mio->impl.fd.buf_size = buffer_size;
+  mio->impl.fd.offset = offset;
+  mio->impl.fd.len = 0;
+  mio->impl.fd.pos = 0;
+  mio->impl.fd.dirty = 0;
+  mio->impl.fd.patched = FALSE;
+  mio->impl.fd.error = FALSE;
+  mio->impl.fd.eof = FALSE;
+  if (! mio->impl.fd.buf) {
+    errno = ENOMEM;
+  }
+  
+  return mio->impl.fd.buf != NULL;
+}
+
+#else /* ! HAVE_UNISTD_H */
+
+#define FD_SET_VTABLE(mio) do { } while (0)
+
+static int
+fd_sync_descriptor (MIO *mio)
+{
+  return FALSE;
+}
+
+static int
+fd_open (MIO         *mio,
+         int          fd,
+         size_t       buffer_size,
+         MIOCloseFunc close_func)
+{
+  #ifdef ENOSYS
+  errno = ENOSYS;
+  #endif
+  
+  return FALSE;
+}
+
+#endif /* HAVE_UNISTD_H */
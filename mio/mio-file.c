@@ -20,12 +20,32 @@
 
 /* file IO implementation */
 
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
 #include <stdarg.h>
+#include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
+#if defined (HAVE_SYS_STAT_H) && defined (HAVE_FSTAT)
+# include <sys/types.h>
+# include <sys/stat.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
 
 #include "mio.h"
 
+#ifndef TRUE
+# define TRUE 1
+#endif
+#ifndef FALSE
+# define FALSE 0
+#endif
+
 
 #define FILE_SET_VTABLE(mio)          \
   do {                                \
@@ -46,26 +66,299 @@
     mio->v_rewind   = file_rewind;    \
     mio->v_getpos   = file_getpos;    \
     mio->v_setpos   = file_setpos;    \
+    mio->v_peek     = file_peek;      \
+    mio->v_consume  = file_consume;   \
+    mio->v_reserve  = file_reserve;   \
+    mio->v_commit   = file_commit;    \
+    mio->v_pread    = file_pread;     \
+    mio->v_pwrite   = file_pwrite;    \
+    mio->v_readv    = file_readv;     \
+    mio->v_writev   = file_writev;    \
+    mio->v_mark     = file_mark;      \
+    mio->v_reset    = file_reset;     \
   } while (0)
 
 
+/* size of the internal buffer used on regular files */
+#define MIO_FILE_BUFFER_SIZE BUFSIZ
+
+
+/*
+ * file_buffer_size:
+ * @fp: A #FILE object
+ * 
+ * Chooses the size of the internal buffer for @fp.  Only regular files get a
+ * real buffer: reading ahead on a terminal or a pipe could block waiting for
+ * data the caller doesn't need yet, and holding back writes would break
+ * stdio's line buffering.  Such streams get a 1-byte buffer, which is just
+ * enough to support mio_ungetc(), and are marked unbuffered meaning no read
+ * ahead nor write staging.
+ * 
+ * Returns: The size of the buffer to use.
+ */
+static size_t
+file_buffer_size (FILE *fp)
+{
+  size_t size = 1;
+#if defined (HAVE_SYS_STAT_H) && defined (HAVE_FSTAT)
+  struct stat st;
+  
+  if (fstat (fileno (fp), &st) == 0 && S_ISREG (st.st_mode)) {
+    size = MIO_FILE_BUFFER_SIZE;
+  }
+#endif
+
+  return size;
+}
+
+/*
+ * file_sync:
+ * @mio: A #MIO object of the type %MIO_TYPE_FILE
+ * 
+ * Synchronizes the underlying #FILE object with the logical position of the
+ * stream, by flushing the staged writes or by moving back before the data
+ * read ahead, and closes the fast path windows.
+ * 
+ * Returns: 0 on success, %EOF otherwise.
+ */
+static int
+file_sync (MIO *mio)
+{
+  int rv = 0;
+  
+  if (mio->read_ptr) {
+    long unread = (long) (mio->read_end - mio->read_ptr);
+    
+    if (unread > 0 && fseek (mio->impl.file.fp, -unread, SEEK_CUR) != 0) {
+      rv = EOF;
+    }
+    mio->read_ptr = NULL;
+    mio->read_end = NULL;
+  } else if (mio->write_ptr) {
+    size_t n = (size_t) (mio->write_ptr - mio->impl.file.buf);
+    
+    if (n > 0 && fwrite (mio->impl.file.buf, 1, n, mio->impl.file.fp) != n) {
+      rv = EOF;
+    }
+    mio->write_ptr = NULL;
+    mio->write_end = NULL;
+  }
+  
+  return rv;
+}
+
+/*
+ * file_alloc_buffer:
+ * @mio: A #MIO object of the type %MIO_TYPE_FILE
+ * 
+ * Allocates the internal buffer if not already done.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static int
+file_alloc_buffer (MIO *mio)
+{
+  if (! mio->impl.file.buf) {
+    mio->impl.file.buf = malloc (mio->impl.file.buf_size);
+  }
+  
+  return mio->impl.file.buf != NULL;
+}
+
+/*
+ * file_retain:
+ * @mio: A #MIO object of the type %MIO_TYPE_FILE with a mark
+ * 
+ * Makes room after the read window while keeping the data read since the mark
+ * for mio_reset(), moving it to the start of the buffer and growing the buffer
+ * if it fills more than half of it.  The read window must be empty.
+ * 
+ * Returns: %TRUE on success, %FALSE if the mark has to be dropped.
+ */
+static int
+file_retain (MIO *mio)
+{
+  int     success = FALSE;
+  size_t  keep    = (size_t) (mio->read_end - mio->impl.file.buf) -
+                    (size_t) mio->mark.offset;
+  
+  if (keep > mio->mark.limit) {
+    /* too far from the mark */
+  } else if (mio->read_end < mio->impl.file.buf + mio->impl.file.buf_size) {
+    success = TRUE;
+  } else {
+    if (keep > mio->impl.file.buf_size / 2) {
+      unsigned char *buf = realloc (mio->impl.file.buf, keep * 2);
+      
+      if (buf) {
+        mio->impl.file.buf = buf;
+        mio->impl.file.buf_size = keep * 2;
+      }
+    }
+    if (keep <= mio->impl.file.buf_size / 2) {
+      memmove (mio->impl.file.buf,
+               mio->impl.file.buf + mio->mark.offset, keep);
+      mio->mark.offset = 0;
+      mio->read_end = mio->impl.file.buf + keep;
+      mio->read_ptr = mio->read_end;
+      success = TRUE;
+    }
+  }
+  
+  return success;
+}
+
+/*
+ * file_fill:
+ * @mio: A #MIO object of the type %MIO_TYPE_FILE
+ * 
+ * Refills the read window from the underlying #FILE object.  The read window
+ * must be empty.  If there is a mark, the data read since it is kept in the
+ * buffer, see file_retain().
+ * 
+ * Returns: The number of bytes available in the read window.
+ */
+static size_t
+file_fill (MIO *mio)
+{
+  size_t n = 0;
+  
+  if (mio->write_ptr) {
+    file_sync (mio);
+  }
+  if (file_alloc_buffer (mio)) {
+    unsigned char *ptr = mio->impl.file.buf;
+    
+    if (mio->mark.active) {
+      if (file_retain (mio)) {
+        ptr = mio->read_end;
+      } else {
+        mio->mark.active = FALSE;
+      }
+    }
+    n = fread (ptr, 1,
+               mio->impl.file.buffered
+                 ? (size_t) (mio->impl.file.buf + mio->impl.file.buf_size - ptr)
+                 : 1,
+               mio->impl.file.fp);
+    mio->read_ptr = ptr;
+    mio->read_end = ptr + n;
+    if (n == 0 && feof (mio->impl.file.fp)) {
+      mio->impl.file.eof = TRUE;
+    }
+  }
+  
+  return n;
+}
+
+/*
+ * file_write_bytes:
+ * @mio: A #MIO object of the type %MIO_TYPE_FILE
+ * @ptr: Data to write
+ * @n: Length of @ptr
+ * 
+ * Writes @n bytes to the stream, going through the write window if the stream
+ * is buffered.
+ * 
+ * Returns: The number of bytes actually written.
+ */
+static size_t
+file_write_bytes (MIO        *mio,
+                  const void *ptr,
+                  size_t      n)
+{
+  size_t n_written = 0;
+  
+  if (mio->read_ptr) {
+    file_sync (mio);
+  }
+  mio->impl.file.dirty = TRUE;
+  if (mio->impl.file.buffered && file_alloc_buffer (mio)) {
+    if (! mio->write_ptr) {
+      mio->write_ptr = mio->impl.file.buf;
+      mio->write_end = mio->impl.file.buf + mio->impl.file.buf_size;
+    }
+    if (n > (size_t) (mio->write_end - mio->write_ptr)) {
+      file_sync (mio);
+      mio->write_ptr = mio->impl.file.buf;
+      mio->write_end = mio->impl.file.buf + mio->impl.file.buf_size;
+    }
+    if (n <= (size_t) (mio->write_end - mio->write_ptr)) {
+      memcpy (mio->write_ptr, ptr, n);
+      mio->write_ptr += n;
+      n_written = n;
+    } else {
+      /* too big for the buffer, bypass it */
+      n_written = fwrite (ptr, 1, n, mio->impl.file.fp);
+    }
+  } else {
+    n_written = fwrite (ptr, 1, n, mio->impl.file.fp);
+  }
+  
+  return n_written;
+}
+
 static void
 file_free (MIO *mio)
 {
+  file_sync (mio);
+  free (mio->impl.file.buf);
   if (mio->impl.file.close_func) {
     mio->impl.file.close_func (mio->impl.file.fp);
   }
   mio->impl.file.close_func = NULL;
   mio->impl.file.fp = NULL;
+  mio->impl.file.buf = NULL;
+  mio->impl.file.buf_size = 0;
 }
 
 static size_t
 file_read (MIO    *mio,
-           void   *ptr,
+           void   *ptr_,
            size_t  size,
            size_t  nmemb)
 {
-  return fread (ptr, size, nmemb, mio->impl.file.fp);
+  size_t n_read = 0;
+  
+  if (size != 0 && nmemb != 0) {
+    size_t          n     = size * nmemb;
+    size_t          got   = 0;
+    unsigned char  *ptr   = ptr_;
+    
+    if (mio->write_ptr) {
+      file_sync (mio);
+    }
+    if (mio->read_ptr < mio->read_end) {
+      got = (size_t) (mio->read_end - mio->read_ptr);
+      if (got > n) {
+        got = n;
+      }
+      memcpy (ptr, mio->read_ptr, got);
+      mio->read_ptr += got;
+    }
+    /* with a mark, go through the buffer so the data is kept */
+    while (got < n && mio->mark.active && file_fill (mio) > 0) {
+      size_t avail = (size_t) (mio->read_end - mio->read_ptr);
+      
+      if (avail > n - got) {
+        avail = n - got;
+      }
+      memcpy (&ptr[got], mio->read_ptr, avail);
+      mio->read_ptr += avail;
+      got += avail;
+    }
+    if (got < n && ! mio->mark.active) {
+      size_t r = fread (&ptr[got], 1, n - got, mio->impl.file.fp);
+      
+      if (r < n - got && feof (mio->impl.file.fp)) {
+        mio->impl.file.eof = TRUE;
+      }
+      got += r;
+    }
+    n_read = got / size;
+  }
+  
+  return n_read;
 }
 
 static size_t
@@ -74,21 +367,31 @@ file_write (MIO         *mio,
             size_t       size,
             size_t       nmemb)
 {
-  return fwrite (ptr, size, nmemb, mio->impl.file.fp);
+  size_t n_written = 0;
+  
+  if (size != 0 && nmemb != 0) {
+    n_written = file_write_bytes (mio, ptr, size * nmemb) / size;
+  }
+  
+  return n_written;
 }
 
 static int
 file_putc (MIO  *mio,
            int   c)
 {
-  return fputc (c, mio->impl.file.fp);
+  unsigned char b = (unsigned char) c;
+  
+  return (file_write_bytes (mio, &b, 1) == 1) ? (int) b : EOF;
 }
 
 static int
 file_puts (MIO        *mio,
            const char *s)
 {
-  return fputs (s, mio->impl.file.fp);
+  size_t len = strlen (s);
+  
+  return (file_write_bytes (mio, s, len) == len) ? 1 : EOF;
 }
 
 __attribute__((__format__ (__printf__, 2, 0)))
@@ -97,20 +400,54 @@ file_vprintf (MIO         *mio,
               const char  *format,
               va_list      ap)
 {
-  return vfprintf (mio->impl.file.fp, format, ap);
+  return format_vprintf (mio, format, ap);
 }
 
 static int
 file_getc (MIO *mio)
 {
-  return fgetc (mio->impl.file.fp);
+  int rv = EOF;
+  
+  if (mio->read_ptr < mio->read_end || file_fill (mio) > 0) {
+    rv = *mio->read_ptr++;
+  }
+  
+  return rv;
 }
 
 static int
 file_ungetc (MIO  *mio,
              int   ch)
 {
-  return ungetc (ch, mio->impl.file.fp);
+  int rv = EOF;
+  
+  if (ch != EOF) {
+    if (mio->write_ptr) {
+      file_sync (mio);
+    }
+    if (! mio->read_ptr && file_alloc_buffer (mio)) {
+      /* start an empty window at the end of the buffer */
+      mio->read_ptr = mio->impl.file.buf + mio->impl.file.buf_size;
+      mio->read_end = mio->read_ptr;
+    }
+    if (mio->read_ptr == mio->impl.file.buf &&
+        mio->read_end < mio->impl.file.buf + mio->impl.file.buf_size) {
+      /* make room for the character by moving the window forward */
+      size_t n = (size_t) (mio->read_end - mio->read_ptr);
+      
+      memmove (mio->read_ptr + 1, mio->read_ptr, n);
+      mio->read_ptr++;
+      mio->read_end++;
+    }
+    if (mio->read_ptr > mio->impl.file.buf) {
+      mio->read_ptr--;
+      *mio->read_ptr = (unsigned char) ch;
+      mio->impl.file.eof = FALSE;
+      rv = (int) ((unsigned char) ch);
+    }
+  }
+  
+  return rv;
 }
 
 static char *
@@ -118,19 +455,53 @@ file_gets (MIO    *mio,
            char   *s,
            size_t  size)
 {
-  return fgets (s, (int)size, mio->impl.file.fp);
+  char *rv = NULL;
+  
+  if (size > 0) {
+    size_t i = 0;
+    
+    while (i < size - 1) {
+      size_t          n;
+      unsigned char  *nl;
+      
+      if (mio->read_ptr >= mio->read_end && file_fill (mio) == 0) {
+        break;
+      }
+      n = (size_t) (mio->read_end - mio->read_ptr);
+      if (n > size - 1 - i) {
+        n = size - 1 - i;
+      }
+      nl = memchr (mio->read_ptr, '\n', n);
+      if (nl) {
+        n = (size_t) (nl - mio->read_ptr) + 1;
+      }
+      memcpy (&s[i], mio->read_ptr, n);
+      mio->read_ptr += n;
+      i += n;
+      if (nl) {
+        break;
+      }
+    }
+    if (i > 0 || size == 1) {
+      s[i] = 0;
+      rv = s;
+    }
+  }
+  
+  return rv;
 }
 
 static void
 file_clearerr (MIO *mio)
 {
   clearerr (mio->impl.file.fp);
+  mio->impl.file.eof = FALSE;
 }
 
 static int
 file_eof (MIO *mio)
 {
-  return feof (mio->impl.file.fp);
+  return mio->impl.file.eof != FALSE;
 }
 
 static int
@@ -144,31 +515,305 @@ file_seek (MIO  *mio,
            long  offset,
            int   whence)
 {
-  return fseek (mio->impl.file.fp, offset, whence);
+  int rv = -1;
+  
+  if (! mio->write_ptr || file_sync (mio) == 0) {
+    if (mio->read_ptr && whence == SEEK_CUR) {
+      offset -= (long) (mio->read_end - mio->read_ptr);
+    }
+    rv = fseek (mio->impl.file.fp, offset, whence);
+    /* on failure the FILE position didn't change, so the window stays valid */
+    if (rv == 0) {
+      mio->read_ptr = NULL;
+      mio->read_end = NULL;
+      mio->impl.file.eof = FALSE;
+    }
+  }
+  
+  return rv;
 }
 
 static long
 file_tell (MIO *mio)
 {
-  return ftell (mio->impl.file.fp);
+  long rv;
+  
+  rv = ftell (mio->impl.file.fp);
+  if (rv != -1) {
+    if (mio->read_ptr) {
+      rv -= (long) (mio->read_end - mio->read_ptr);
+    } else if (mio->write_ptr) {
+      rv += (long) (mio->write_ptr - mio->impl.file.buf);
+    }
+    if (rv < 0) {
+      /* this happens if ungetc() was called at the start of the stream */
+      #ifdef EIO
+      errno = EIO;
+      #endif
+      rv = -1;
+    }
+  }
+  
+  return rv;
 }
 
 static void
 file_rewind (MIO *mio)
 {
+  file_sync (mio);
   rewind (mio->impl.file.fp);
+  mio->read_ptr = NULL;
+  mio->read_end = NULL;
+  mio->impl.file.eof = FALSE;
 }
 
 static int
 file_getpos (MIO    *mio,
              MIOPos *pos)
 {
-  return fgetpos (mio->impl.file.fp, &pos->impl.file);
+  int rv = -1;
+  
+  if (! mio->write_ptr || file_sync (mio) == 0) {
+    rv = fgetpos (mio->impl.file.fp, &pos->impl.file.pos);
+    /* we can't do arithmetic on a fpos_t, so remember how much we read ahead
+     * for file_setpos() to move back */
+    pos->impl.file.unread = 0;
+    if (mio->read_ptr) {
+      pos->impl.file.unread = (size_t) (mio->read_end - mio->read_ptr);
+    }
+  }
+  
+  return rv;
 }
 
 static int
 file_setpos (MIO    *mio,
              MIOPos *pos)
 {
-  return fsetpos (mio->impl.file.fp, &pos->impl.file);
+  int rv = -1;
+  
+  if (! mio->write_ptr || file_sync (mio) == 0) {
+    rv = fsetpos (mio->impl.file.fp, &pos->impl.file.pos);
+    if (rv == 0 && pos->impl.file.unread > 0) {
+      rv = fseek (mio->impl.file.fp, -(long) pos->impl.file.unread, SEEK_CUR);
+    }
+    if (rv == 0) {
+      mio->read_ptr = NULL;
+      mio->read_end = NULL;
+      mio->impl.file.eof = FALSE;
+    }
+  }
+  
+  return rv;
+}
+
+static const unsigned char *
+file_peek (MIO    *mio,
+           size_t *avail)
+{
+  const unsigned char *ptr = NULL;
+  
+  *avail = 0;
+  if (mio->read_ptr < mio->read_end || file_fill (mio) > 0) {
+    ptr = mio->read_ptr;
+    *avail = (size_t) (mio->read_end - mio->read_ptr);
+  }
+  
+  return ptr;
+}
+
+static int
+file_consume (MIO   *mio,
+              size_t n)
+{
+  int rv = -1;
+  
+  /* mio_consume() already handled everything within the read window */
+  if (n == 0) {
+    rv = 0;
+  } else {
+    errno = EINVAL;
+  }
+  
+  return rv;
+}
+
+static void *
+file_reserve (MIO   *mio,
+              size_t n)
+{
+  void *ptr = NULL;
+  
+  if (file_sync (mio) == 0 && file_alloc_buffer (mio)) {
+    if (n > mio->impl.file.buf_size) {
+      unsigned char *buf = realloc (mio->impl.file.buf, n);
+      
+      if (buf) {
+        mio->impl.file.buf = buf;
+        mio->impl.file.buf_size = n;
+      }
+    }
+    if (n <= mio->impl.file.buf_size) {
+      ptr = mio->impl.file.buf;
+      mio->impl.file.dirty = TRUE;
+      /* unbuffered streams write the data right away in file_commit() */
+      if (mio->impl.file.buffered) {
+        mio->write_ptr = mio->impl.file.buf;
+        mio->write_end = mio->impl.file.buf + mio->impl.file.buf_size;
+      }
+    }
+  }
+  
+  return ptr;
+}
+
+static int
+file_commit (MIO   *mio,
+             size_t n)
+{
+  int rv = -1;
+  
+  /* mio_write_commit() already handled everything within the write window */
+  if (n == 0) {
+    rv = 0;
+  } else if (mio->impl.file.buffered) {
+    errno = EINVAL;
+  } else if (n > mio->impl.file.buf_size) {
+    errno = EINVAL;
+  } else if (fwrite (mio->impl.file.buf, 1, n, mio->impl.file.fp) == n) {
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static ssize_t
+file_pread (MIO   *mio,
+            void  *ptr,
+            size_t count,
+            off_t  offset)
+{
+  ssize_t rv = -1;
+
+#ifdef HAVE_PREAD
+  /* only flush pending writes so concurrent reads don't touch the stream */
+  if (mio->write_ptr) {
+    file_sync (mio);
+  }
+  if (mio->impl.file.dirty) {
+    fflush (mio->impl.file.fp);
+    mio->impl.file.dirty = FALSE;
+  }
+  do {
+    rv = pread (fileno (mio->impl.file.fp), ptr, count, offset);
+  } while (rv < 0 && errno == EINTR);
+#else
+  #ifdef ENOSYS
+  errno = ENOSYS;
+  #endif
+#endif
+
+  return rv;
+}
+
+static ssize_t
+file_pwrite (MIO        *mio,
+             const void *ptr,
+             size_t      count,
+             off_t       offset)
+{
+  ssize_t rv = -1;
+
+#ifdef HAVE_PWRITE
+  /* drop both our read-ahead data and stdio's, as they may become stale.
+   * fseek() alone isn't enough as some implementations keep their buffer
+   * when the target lies within it, but POSIX requires fflush() to discard
+   * it on seekable input streams */
+  if (file_sync (mio) == 0 &&
+      fflush (mio->impl.file.fp) == 0 &&
+      fseek (mio->impl.file.fp, 0, SEEK_CUR) == 0) {
+    mio->impl.file.dirty = FALSE;
+    do {
+      rv = pwrite (fileno (mio->impl.file.fp), ptr, count, offset);
+    } while (rv < 0 && errno == EINTR);
+  }
+#else
+  #ifdef ENOSYS
+  errno = ENOSYS;
+  #endif
+#endif
+
+  return rv;
+}
+
+static size_t
+file_readv (MIO                 *mio,
+            const struct iovec  *iov,
+            int                  iovcnt)
+{
+  size_t  n_read = 0;
+  int     i;
+  
+  for (i = 0; i < iovcnt; i++) {
+    size_t n = file_read (mio, iov[i].iov_base, 1, iov[i].iov_len);
+    
+    n_read += n;
+    if (n < iov[i].iov_len) {
+      break;
+    }
+  }
+  
+  return n_read;
+}
+
+static size_t
+file_writev (MIO                 *mio,
+             const struct iovec  *iov,
+             int                  iovcnt)
+{
+  size_t  n_written = 0;
+  int     i;
+  
+  for (i = 0; i < iovcnt; i++) {
+    size_t n = file_write (mio, iov[i].iov_base, 1, iov[i].iov_len);
+    
+    n_written += n;
+    if (n < iov[i].iov_len) {
+      break;
+    }
+  }
+  
+  return n_written;
+}
+
+static int
+file_mark (MIO *mio)
+{
+  int rv = -1;
+  
+  if (mio->write_ptr && file_sync (mio) != 0) {
+    /* errno is already set */
+  } else if (! file_alloc_buffer (mio)) {
+    errno = ENOMEM;
+  } else {
+    if (! mio->read_ptr) {
+      /* start an empty window, the data will be kept after it */
+      mio->read_ptr = mio->impl.file.buf;
+      mio->read_end = mio->read_ptr;
+    }
+    mio->mark.offset = (off_t) (mio->read_ptr - mio->impl.file.buf);
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static int
+file_reset (MIO *mio)
+{
+  /* the data since the mark is still in the buffer, see file_fill() */
+  mio->read_ptr = mio->impl.file.buf + mio->mark.offset;
+  mio->impl.file.eof = FALSE;
+  
+  return 0;
 }
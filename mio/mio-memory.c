@@ -38,8 +38,18 @@
 #include <stdarg.h>
 #include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#if defined (HAVE_FCNTL_H) && defined (HAVE_UNISTD_H)
+# include <sys/types.h>
+# include <fcntl.h>
+# include <unistd.h>
+# define MEM_HAVE_UNIX_IO 1
+#endif
+#if defined (HAVE_SYS_STAT_H) && defined (HAVE_FSTAT)
+# include <sys/stat.h>
+#endif
 
 #include "mio.h"
 
@@ -53,6 +63,29 @@
 #ifndef MAX
 # define MAX(a, b) ((a) < (b) ? (b) : (a))
 #endif
+#ifndef MIN
+# define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+/* largest value an off_t can hold */
+#define MIO_OFF_MAX \
+  ((off_t) ((((unsigned long long) 1) << (sizeof (off_t) * CHAR_BIT - 1)) - 1))
+
+#ifdef HAVE_GLIB
+# define MIO_ATOMIC_GET(p)            (g_atomic_int_get (p))
+# define MIO_ATOMIC_INC(p)            (g_atomic_int_inc (p))
+# define MIO_ATOMIC_DEC_AND_TEST(p)   (g_atomic_int_dec_and_test (p))
+#elif defined (__GNUC__) && \
+      ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+# define MIO_ATOMIC_GET(p)            (__sync_fetch_and_add ((p), 0))
+# define MIO_ATOMIC_INC(p)            ((void) __sync_fetch_and_add ((p), 1))
+# define MIO_ATOMIC_DEC_AND_TEST(p)   (__sync_fetch_and_sub ((p), 1) == 1)
+#else
+/* FIXME: not thread-safe */
+# define MIO_ATOMIC_GET(p)            (*(p))
+# define MIO_ATOMIC_INC(p)            ((void) (*(p))++)
+# define MIO_ATOMIC_DEC_AND_TEST(p)   (--(*(p)) == 0)
+#endif
 
 
 #define MEM_SET_VTABLE(mio)           \
@@ -74,19 +107,217 @@
     mio->v_rewind   = mem_rewind;     \
     mio->v_getpos   = mem_getpos;     \
     mio->v_setpos   = mem_setpos;     \
+    mio->v_peek     = mem_peek;       \
+    mio->v_consume  = mem_consume;    \
+    mio->v_reserve  = mem_reserve;    \
+    mio->v_commit   = mem_commit;     \
+    mio->v_pread    = mem_pread;      \
+    mio->v_pwrite   = mem_pwrite;     \
+    mio->v_readv    = mem_readv;      \
+    mio->v_writev   = mem_writev;     \
+    mio->v_mark     = mem_mark;       \
+    mio->v_reset    = mem_reset;      \
   } while (0)
 
 
 /* minimal reallocation chunk size */
 #define MIO_CHUNK_SIZE 4096
+/* default growth policy, see mio_memory_set_growth() */
+#define MIO_GROWTH_FACTOR     2.0
+#define MIO_GROWTH_MAX_STEP   0
+
+
+/* all byte values, used to give a pushed back character to mem_peek() callers
+ * since it doesn't live in the buffer */
+#define MEM_BYTES_4(n)  (n), (n) + 1, (n) + 2, (n) + 3
+#define MEM_BYTES_16(n) MEM_BYTES_4 (n), MEM_BYTES_4 ((n) + 4), \
+                        MEM_BYTES_4 ((n) + 8), MEM_BYTES_4 ((n) + 12)
+#define MEM_BYTES_64(n) MEM_BYTES_16 (n), MEM_BYTES_16 ((n) + 16), \
+                        MEM_BYTES_16 ((n) + 32), MEM_BYTES_16 ((n) + 48)
+static const unsigned char mem_bytes[256] = {
+  MEM_BYTES_64 (0), MEM_BYTES_64 (64), MEM_BYTES_64 (128), MEM_BYTES_64 (192)
+};
+
+
+/* reference-counted data shared between several streams, see mio_dup() */
+struct _MIOShared {
+  int           ref_count;
+  void         *data;
+  MIOFreeFunc   free_func;
+};
+
+/*
+ * shared_new:
+ * @data: The data to share
+ * @free_func: Function to destroy @data with when the last reference is
+ *             dropped, or %NULL
+ * 
+ * Creates a new shared data holder with a single reference.
+ * 
+ * Returns: A new shared data holder, or %NULL on failure.
+ */
+static struct _MIOShared *
+shared_new (void        *data,
+            MIOFreeFunc  free_func)
+{
+  struct _MIOShared *shared;
+  
+  shared = malloc (sizeof *shared);
+  if (shared) {
+    shared->ref_count = 1;
+    shared->data = data;
+    shared->free_func = free_func;
+  }
+  
+  return shared;
+}
 
+static void
+shared_ref (struct _MIOShared *shared)
+{
+  MIO_ATOMIC_INC (&shared->ref_count);
+}
+
+static void
+shared_unref (struct _MIOShared *shared)
+{
+  if (MIO_ATOMIC_DEC_AND_TEST (&shared->ref_count)) {
+    if (shared->free_func) {
+      shared->free_func (shared->data);
+    }
+    free (shared);
+  }
+}
+
+
+/* number of lines between two samples of a line index */
+#define MIO_LINE_INDEX_STEP 64
+
+/* offsets of the start of one line out of MIO_LINE_INDEX_STEP, built lazily as
+ * the data is scanned, see mio_seek_line() */
+struct _MIOLineIndex {
+  off_t  *samples;    /* start of lines 1, MIO_LINE_INDEX_STEP + 1, ... */
+  size_t  n_samples;
+  size_t  allocated;
+  off_t   scanned;    /* number of bytes indexed */
+  size_t  lines;      /* number of newlines in the indexed bytes */
+};
+
+/*
+ * line_index_invalidate:
+ * @mio: A #MIO object
+ * @offset: Offset of the first byte that changed
+ * 
+ * Drops the part of the line index of @mio that covers data from @offset on,
+ * so it gets scanned again when needed.
+ */
+static void
+line_index_invalidate (MIO   *mio,
+                       off_t  offset)
+{
+  struct _MIOLineIndex *index = mio->line_index;
+  
+  if (index && offset < index->scanned) {
+    /* a sample at @offset is still valid as it only depends on the data
+     * before it */
+    while (index->n_samples > 1 &&
+           index->samples[index->n_samples - 1] > offset) {
+      index->n_samples--;
+    }
+    index->scanned = index->samples[index->n_samples - 1];
+    index->lines = (index->n_samples - 1) * MIO_LINE_INDEX_STEP;
+  }
+}
+
+
+/*
+ * mem_sync:
+ * @mio: A #MIO object of the type %MIO_TYPE_MEMORY
+ * 
+ * Folds the fast path windows (see MIO_GETC() and MIO_PUTC()) back into the
+ * stream's position and size, and closes them.  This must be called before
+ * looking at the stream's position or size.
+ */
+static void
+mem_sync (MIO *mio)
+{
+  if (mio->read_ptr) {
+    mio->impl.mem.pos = (size_t) (mio->read_ptr - mio->impl.mem.buf);
+    mio->read_ptr = NULL;
+    mio->read_end = NULL;
+  } else if (mio->write_ptr) {
+    mio->impl.mem.pos = (size_t) (mio->write_ptr - mio->impl.mem.buf);
+    mio->impl.mem.size = MAX (mio->impl.mem.size, mio->impl.mem.pos);
+    mio->write_ptr = NULL;
+    mio->write_end = NULL;
+    mio->write_data_end = NULL;
+  }
+}
+
+/*
+ * mem_unshare:
+ * @mio: A #MIO object of the type %MIO_TYPE_MEMORY
+ * 
+ * Makes sure the buffer of @mio isn't shared with other streams before it gets
+ * modified, by taking a private copy of it if needed.  This requires both a
+ * reallocation and a free function, as the copy has to be managed by @mio.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise, with errno set.
+ */
+static int
+mem_unshare (MIO *mio)
+{
+  int                 success = TRUE;
+  struct _MIOShared  *shared  = mio->impl.mem.shared;
+  
+  if (LIKELY (! shared)) {
+    /* nothing to do */
+  } else if (MIO_ATOMIC_GET (&shared->ref_count) == 1 &&
+             mio->impl.mem.buf == shared->data &&
+             mio->impl.mem.free_func == shared->free_func) {
+    /* we are the last user of the buffer, take it back (unless we are only a
+     * slice of it, see mio_new_slice()) */
+    free (shared);
+    mio->impl.mem.shared = NULL;
+  } else if (! mio->impl.mem.realloc_func || ! mio->impl.mem.free_func) {
+    errno = EBADF;
+    success = FALSE;
+  } else {
+    unsigned char *buf = NULL;
+    
+    if (mio->impl.mem.size > 0) {
+      buf = mio->impl.mem.realloc_func (NULL, mio->impl.mem.size);
+    }
+    if (mio->impl.mem.size > 0 && ! buf) {
+      errno = ENOMEM;
+      success = FALSE;
+    } else {
+      if (buf) {
+        memcpy (buf, mio->impl.mem.buf, mio->impl.mem.size);
+      }
+      shared_unref (shared);
+      mio->impl.mem.shared = NULL;
+      mio->impl.mem.buf = buf;
+      mio->impl.mem.allocated_size = mio->impl.mem.size;
+    }
+  }
+  
+  return success;
+}
 
 static void
 mem_free (MIO *mio)
 {
-  if (mio->impl.mem.free_func) {
+  mem_sync (mio);
+  if (mio->impl.mem.shared) {
+    shared_unref (mio->impl.mem.shared);
+    mio->impl.mem.shared = NULL;
+  } else if (mio->impl.mem.free_func) {
     mio->impl.mem.free_func (mio->impl.mem.buf);
   }
+  free (mio->impl.mem.scratch);
+  mio->impl.mem.scratch = NULL;
+  mio->impl.mem.reserved = 0;
   mio->impl.mem.buf = NULL;
   mio->impl.mem.pos = 0;
   mio->impl.mem.size = 0;
@@ -105,6 +336,7 @@ mem_read (MIO    *mio,
 {
   size_t n_read = 0;
   
+  mem_sync (mio);
   if (size != 0 && nmemb != 0) {
     size_t          size_avail  = mio->impl.mem.size - mio->impl.mem.pos;
     size_t          copy_bytes  = size * nmemb;
@@ -136,6 +368,70 @@ mem_read (MIO    *mio,
   return n_read;
 }
 
+/*
+ * mem_try_set_capacity:
+ * @mio: A #MIO object of the type %MIO_TYPE_MEMORY
+ * @capacity: Requested allocation size, not smaller than the data size
+ * 
+ * Tries to reallocate the underlying buffer of an in-memory #MIO object to
+ * exactly @capacity bytes, without changing the data size.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static int
+mem_try_set_capacity (MIO    *mio,
+                      size_t  capacity)
+{
+  int success = FALSE;
+  
+  if (mio->impl.mem.realloc_func && mem_unshare (mio)) {
+    unsigned char *newbuf;
+    
+    newbuf = mio->impl.mem.realloc_func (mio->impl.mem.buf, capacity);
+    if (LIKELY (newbuf || capacity == 0)) {
+      mio->impl.mem.buf = newbuf;
+      mio->impl.mem.allocated_size = capacity;
+      success = TRUE;
+    }
+  }
+  
+  return success;
+}
+
+/*
+ * mem_grown_capacity:
+ * @mio: A #MIO object of the type %MIO_TYPE_MEMORY
+ * @min_size: The minimal size needed
+ * 
+ * Computes the size to which grow the underlying buffer of an in-memory #MIO
+ * object following its growth policy, so that it can hold at least @min_size
+ * bytes.
+ * 
+ * Returns: The new capacity for the buffer.
+ */
+static size_t
+mem_grown_capacity (MIO    *mio,
+                    size_t  min_size)
+{
+  size_t  allocated = mio->impl.mem.allocated_size;
+  size_t  step      = MIO_CHUNK_SIZE;
+  double  grown     = (double) allocated * mio->impl.mem.growth_factor;
+  
+  if (grown > (double) allocated + (double) step) {
+    step = (grown < (double) ((size_t) -1)) ? (size_t) grown - allocated
+                                            : (size_t) -1;
+  }
+  if (mio->impl.mem.growth_max_step > 0 &&
+      step > mio->impl.mem.growth_max_step) {
+    step = MAX (mio->impl.mem.growth_max_step, MIO_CHUNK_SIZE);
+  }
+  if (step > ((size_t) -1) - allocated) {
+    step = ((size_t) -1) - allocated;
+  }
+  
+  return MAX (allocated + step, min_size);
+}
+
 /*
  * mem_try_resize:
  * @mio: A #MIO object of the type %MIO_TYPE_MEMORY
@@ -152,7 +448,7 @@ mem_try_resize (MIO    *mio,
 {
   int success = FALSE;
   
-  if (mio->impl.mem.realloc_func) {
+  if (mio->impl.mem.realloc_func && mem_unshare (mio)) {
     if (UNLIKELY (new_size == ((size_t) -1))) {
       #ifdef EOVERFLOW
       errno = EOVERFLOW;
@@ -163,15 +459,9 @@ mem_try_resize (MIO    *mio,
           mio->impl.mem.size = new_size;
           success = TRUE;
         } else {
-          size_t          newsize;
-          unsigned char  *newbuf;
-          
-          newsize = MAX (mio->impl.mem.allocated_size + MIO_CHUNK_SIZE,
-                         new_size);
-          newbuf = mio->impl.mem.realloc_func (mio->impl.mem.buf, newsize);
-          if (newbuf) {
-            mio->impl.mem.buf = newbuf;
-            mio->impl.mem.allocated_size = newsize;
+          if (mem_try_set_capacity (mio, mem_grown_capacity (mio, new_size)) ||
+              /* the policy may be too greedy, retry with the bare minimum */
+              mem_try_set_capacity (mio, new_size)) {
             mio->impl.mem.size = new_size;
             success = TRUE;
           }
@@ -179,6 +469,7 @@ mem_try_resize (MIO    *mio,
       } else {
         unsigned char *newbuf;
         
+        line_index_invalidate (mio, (off_t) new_size);
         newbuf = mio->impl.mem.realloc_func (mio->impl.mem.buf, new_size);
         if (LIKELY (newbuf || new_size == 0)) {
           mio->impl.mem.buf = newbuf;
@@ -206,11 +497,173 @@ mem_try_resize (MIO    *mio,
 static int
 mem_try_ensure_space (MIO    *mio,
                       size_t  n)
+{
+  int success = mem_unshare (mio);
+  
+  line_index_invalidate (mio, (off_t) mio->impl.mem.pos);
+  if (success && mio->impl.mem.pos + n > mio->impl.mem.size) {
+    success = mem_try_resize (mio, mio->impl.mem.pos + n);
+  }
+  
+  return success;
+}
+
+/*
+ * mem_try_reserve:
+ * @mio: A #MIO object
+ * @n: Requested size from the current (cursor) position
+ * 
+ * Tries to ensure there is enough allocated space for @n bytes to be written
+ * from the current cursor position, without changing the size of the data.
+ * 
+ * Returns: %TRUE if there is enough space, %FALSE otherwise.
+ */
+static int
+mem_try_reserve (MIO    *mio,
+                 size_t  n)
 {
   int success = TRUE;
   
-  if (mio->impl.mem.pos + n > mio->impl.mem.size) {
+  if (UNLIKELY (n >= ((size_t) -1) - mio->impl.mem.pos)) {
+    #ifdef EOVERFLOW
+    errno = EOVERFLOW;
+    #endif
+    success = FALSE;
+  } else if (! mem_unshare (mio)) {
+    success = FALSE;
+  } else if (mio->impl.mem.pos + n > mio->impl.mem.allocated_size) {
+    size_t size = mio->impl.mem.size;
+    
     success = mem_try_resize (mio, mio->impl.mem.pos + n);
+    mio->impl.mem.size = size;
+  }
+  
+  return success;
+}
+
+#if defined (HAVE_SYS_STAT_H) && defined (HAVE_FSTAT)
+/*
+ * mem_size_hint:
+ * @fd: A file descriptor
+ * 
+ * Gets the size of the file behind @fd, if it is a regular file.
+ * 
+ * Returns: The file size, or 0 if it is unknown.
+ */
+static size_t
+mem_size_hint (int fd)
+{
+  size_t      size = 0;
+  struct stat st;
+  
+  if (fstat (fd, &st) == 0 && S_ISREG (st.st_mode) && st.st_size > 0 &&
+      st.st_size == (off_t) (size_t) st.st_size) {
+    size = (size_t) st.st_size;
+  }
+  
+  return size;
+}
+#endif
+
+/*
+ * mem_load_file:
+ * @mio: An empty #MIO object of the type %MIO_TYPE_MEMORY
+ * @filename: The file to load
+ * 
+ * Reads the whole content of @filename into the buffer of @mio.  When the size
+ * of the file is known beforehand, the buffer is allocated only once with one
+ * spare byte so the end of the file is seen without growing it.  Otherwise
+ * (pipes, procfs, ...) the buffer grows following the growth policy.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise, with errno set.
+ */
+static int
+mem_load_file (MIO        *mio,
+               const char *filename)
+{
+  int     success = FALSE;
+  size_t  hint    = 0;
+#ifdef MEM_HAVE_UNIX_IO
+  int     fd;
+  
+  fd = open (filename, O_RDONLY);
+  if (fd >= 0) {
+# if defined (HAVE_SYS_STAT_H) && defined (HAVE_FSTAT)
+    hint = mem_size_hint (fd);
+# endif
+#else
+  FILE   *fp;
+  
+  fp = fopen (filename, "rb");
+  if (fp) {
+# if defined (HAVE_SYS_STAT_H) && defined (HAVE_FSTAT)
+    hint = mem_size_hint (fileno (fp));
+# endif
+#endif
+    if (hint > 0 && hint < (size_t) -1) {
+      hint++;
+    } else {
+      hint = MIO_CHUNK_SIZE;
+    }
+    success = TRUE;
+    while (success) {
+      size_t  avail;
+      size_t  n;
+      
+      if (mio->impl.mem.size >= mio->impl.mem.allocated_size) {
+        size_t capacity = hint;
+        
+        if (mio->impl.mem.allocated_size > 0) {
+          capacity = mem_grown_capacity (mio, mio->impl.mem.size + 1);
+        }
+        
+        if (capacity <= mio->impl.mem.size) {
+          #ifdef EFBIG
+          errno = EFBIG;
+          #endif
+          success = FALSE;
+          break;
+        } else if (! mem_try_set_capacity (mio, capacity)) {
+          errno = ENOMEM;
+          success = FALSE;
+          break;
+        }
+      }
+      avail = mio->impl.mem.allocated_size - mio->impl.mem.size;
+#ifdef MEM_HAVE_UNIX_IO
+      {
+        ssize_t rv = read (fd, &mio->impl.mem.buf[mio->impl.mem.size],
+                           MIN (avail, ((size_t) -1) >> 1));
+        
+        if (rv < 0) {
+          if (errno != EINTR) {
+            success = FALSE;
+          }
+          continue;
+        }
+        n = (size_t) rv;
+      }
+#else
+      n = fread (&mio->impl.mem.buf[mio->impl.mem.size], 1, avail, fp);
+      if (n == 0 && ferror (fp)) {
+        success = FALSE;
+      }
+#endif
+      if (n == 0) {
+        break;
+      }
+      mio->impl.mem.size += n;
+    }
+#ifdef MEM_HAVE_UNIX_IO
+    {
+      int errnum = errno;
+      
+      close (fd);
+      errno = errnum;
+    }
+#else
+    fclose (fp);
+#endif
   }
   
   return success;
@@ -224,6 +677,7 @@ mem_write (MIO         *mio,
 {
   size_t n_written = 0;
   
+  mem_sync (mio);
   if (size != 0 && nmemb != 0) {
     if (mem_try_ensure_space (mio, size * nmemb)) {
       memcpy (&mio->impl.mem.buf[mio->impl.mem.pos], ptr, size * nmemb);
@@ -241,10 +695,19 @@ mem_putc (MIO  *mio,
 {
   int rv = EOF;
   
+  mem_sync (mio);
   if (mem_try_ensure_space (mio, 1)) {
     mio->impl.mem.buf[mio->impl.mem.pos] = (unsigned char) c;
     mio->impl.mem.pos++;
     rv = (int) ((unsigned char) c);
+    /* open the write window over the remaining allocated space */
+    if (mio->impl.mem.ungetch == EOF) {
+      mio->write_ptr = &mio->impl.mem.buf[mio->impl.mem.pos];
+      mio->write_end = &mio->impl.mem.buf[mio->impl.mem.allocated_size];
+      if (mio->impl.mem.pos < mio->impl.mem.size) {
+        mio->write_data_end = &mio->impl.mem.buf[mio->impl.mem.size];
+      }
+    }
   }
   
   return rv;
@@ -257,6 +720,7 @@ mem_puts (MIO        *mio,
   int     rv = EOF;
   size_t  len;
   
+  mem_sync (mio);
   len = strlen (s);
   if (mem_try_ensure_space (mio, len)) {
     memcpy (&mio->impl.mem.buf[mio->impl.mem.pos], s, len);
@@ -273,46 +737,7 @@ mem_vprintf (MIO         *mio,
              const char  *format,
              va_list      ap)
 {
-  int     rv = -1;
-  size_t  n;
-  size_t  old_pos;
-  size_t  old_size;
-  va_list ap_copy;
-#ifndef HAVE_GLIB
-  char    dummy;
-#endif
-  
-  old_pos = mio->impl.mem.pos;
-  old_size = mio->impl.mem.size;
-  /* compute the size we will need into the buffer */
-#ifndef HAVE_GLIB
-  va_copy (ap_copy, ap);
-  n = (size_t) vsnprintf (&dummy, 1, format, ap_copy) + 1;
-#else
-  G_VA_COPY (ap_copy, ap);
-  n = g_printf_string_upper_bound (format, ap_copy);
-#endif
-  va_end (ap_copy);
-  if (mem_try_ensure_space (mio, n)) {
-    unsigned char c;
-    
-    /* backup character at n+1 that will be overwritten by a \0 ... */
-    c = mio->impl.mem.buf[mio->impl.mem.pos + (n - 1)];
-    rv = vsprintf ((char *) &mio->impl.mem.buf[mio->impl.mem.pos], format, ap);
-    /* ...and restore it */
-    mio->impl.mem.buf[mio->impl.mem.pos + (n - 1)] = c;
-    if (LIKELY (rv >= 0 && (size_t) rv == (n - 1))) {
-      /* re-compute the actual size since we might have allocated one byte
-       * more than needed */
-      mio->impl.mem.size = MAX (old_size, old_pos + (unsigned int) rv);
-      mio->impl.mem.pos += (unsigned int) rv;
-    } else {
-      mio->impl.mem.size = old_size;
-      rv = -1;
-    }
-  }
-  
-  return rv;
+  return format_vprintf (mio, format, ap);
 }
 
 static int
@@ -320,6 +745,7 @@ mem_getc (MIO *mio)
 {
   int rv = EOF;
   
+  mem_sync (mio);
   if (mio->impl.mem.ungetch != EOF) {
     rv = mio->impl.mem.ungetch;
     mio->impl.mem.ungetch = EOF;
@@ -327,6 +753,9 @@ mem_getc (MIO *mio)
   } else if (mio->impl.mem.pos < mio->impl.mem.size) {
     rv = mio->impl.mem.buf[mio->impl.mem.pos];
     mio->impl.mem.pos++;
+    /* open the read window over the remaining data */
+    mio->read_ptr = &mio->impl.mem.buf[mio->impl.mem.pos];
+    mio->read_end = &mio->impl.mem.buf[mio->impl.mem.size];
   } else {
     mio->impl.mem.eof = TRUE;
   }
@@ -340,6 +769,7 @@ mem_ungetc (MIO  *mio,
 {
   int rv = EOF;
   
+  mem_sync (mio);
   if (ch != EOF && mio->impl.mem.ungetch == EOF) {
     rv = mio->impl.mem.ungetch = ch;
     mio->impl.mem.pos--;
@@ -356,22 +786,31 @@ mem_gets (MIO    *mio,
 {
   char *rv = NULL;
   
+  mem_sync (mio);
   if (size > 0) {
     size_t i = 0;
     
-    if (mio->impl.mem.ungetch != EOF) {
+    if (mio->impl.mem.ungetch != EOF && size > 1) {
       s[i] = (char) mio->impl.mem.ungetch;
       mio->impl.mem.ungetch = EOF;
       mio->impl.mem.pos++;
       i++;
     }
-    for (; mio->impl.mem.pos < mio->impl.mem.size && i < (size - 1); i++) {
-      s[i] = (char) mio->impl.mem.buf[mio->impl.mem.pos];
-      mio->impl.mem.pos++;
-      if (s[i] == '\n') {
-        i++;
-        break;
+    if (mio->impl.mem.pos < mio->impl.mem.size && i < size - 1 &&
+        (i == 0 || s[i - 1] != '\n')) {
+      const unsigned char  *p = &mio->impl.mem.buf[mio->impl.mem.pos];
+      const unsigned char  *nl;
+      size_t                n;
+      
+      n = MIN (size - 1 - i, mio->impl.mem.size - mio->impl.mem.pos);
+      /* memchr() is usually heavily optimized, much more than a simple loop */
+      nl = memchr (p, '\n', n);
+      if (nl) {
+        n = (size_t) (nl - p) + 1;
       }
+      memcpy (&s[i], p, n);
+      mio->impl.mem.pos += n;
+      i += n;
     }
     if (i > 0) {
       s[i] = 0;
@@ -412,6 +851,7 @@ mem_seek (MIO  *mio,
 {
   int rv = -1;
   
+  mem_sync (mio);
   switch (whence) {
     case SEEK_SET:
       if (offset < 0 || (size_t) offset > mio->impl.mem.size) {
@@ -457,6 +897,7 @@ mem_tell (MIO *mio)
 {
   long rv = -1;
   
+  mem_sync (mio);
   if (mio->impl.mem.pos > LONG_MAX) {
     #ifdef EOVERFLOW
     errno = EOVERFLOW;
@@ -471,6 +912,7 @@ mem_tell (MIO *mio)
 static void
 mem_rewind (MIO *mio)
 {
+  mem_sync (mio);
   mio->impl.mem.pos = 0;
   mio->impl.mem.ungetch = EOF;
   mio->impl.mem.eof = FALSE;
@@ -483,6 +925,7 @@ mem_getpos (MIO    *mio,
 {
   int rv = -1;
   
+  mem_sync (mio);
   if (mio->impl.mem.pos == (size_t) -1) {
     /* this happens if ungetc() was called at the start of the stream */
     #ifdef EIO
@@ -502,6 +945,7 @@ mem_setpos (MIO    *mio,
 {
   int rv = -1;
   
+  mem_sync (mio);
   if (pos->impl.mem > mio->impl.mem.size) {
     errno = EINVAL;
   } else {
@@ -512,3 +956,250 @@ mem_setpos (MIO    *mio,
   
   return rv;
 }
+
+static const unsigned char *
+mem_peek (MIO    *mio,
+          size_t *avail)
+{
+  const unsigned char *ptr = NULL;
+  
+  mem_sync (mio);
+  *avail = 0;
+  if (mio->impl.mem.ungetch != EOF &&
+      mio->impl.mem.pos < mio->impl.mem.size &&
+      mio->impl.mem.buf[mio->impl.mem.pos] == mio->impl.mem.ungetch) {
+    /* the pushed back character is the one in the buffer, forget it */
+    mio->impl.mem.ungetch = EOF;
+  }
+  if (mio->impl.mem.ungetch != EOF) {
+    ptr = &mem_bytes[(unsigned char) mio->impl.mem.ungetch];
+    *avail = 1;
+  } else if (mio->impl.mem.pos < mio->impl.mem.size) {
+    mio->read_ptr = &mio->impl.mem.buf[mio->impl.mem.pos];
+    mio->read_end = &mio->impl.mem.buf[mio->impl.mem.size];
+    ptr = mio->read_ptr;
+    *avail = mio->impl.mem.size - mio->impl.mem.pos;
+  } else {
+    mio->impl.mem.eof = TRUE;
+  }
+  
+  return ptr;
+}
+
+static int
+mem_consume (MIO   *mio,
+             size_t n)
+{
+  int rv = -1;
+  
+  mem_sync (mio);
+  if (mio->impl.mem.ungetch != EOF) {
+    /* mem_peek() only gave the pushed back character */
+    if (n > 1) {
+      errno = EINVAL;
+    } else {
+      if (n == 1) {
+        mio->impl.mem.ungetch = EOF;
+        mio->impl.mem.pos++;
+      }
+      rv = 0;
+    }
+  } else if (n > mio->impl.mem.size - mio->impl.mem.pos) {
+    errno = EINVAL;
+  } else {
+    mio->impl.mem.pos += n;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static void *
+mem_reserve (MIO   *mio,
+             size_t n)
+{
+  void *ptr = NULL;
+  
+  mem_sync (mio);
+  mio->impl.mem.reserved = 0;
+  /* always allocate something so that even an empty reservation on an empty
+   * stream gives a valid pointer */
+  if (mem_try_reserve (mio, MAX (n, 1))) {
+    if (mio->impl.mem.pos < mio->impl.mem.size) {
+      unsigned char *scratch;
+      
+      /* overwriting, use a separate buffer and copy it on commit so that the
+       * data past the committed bytes is left alone */
+      scratch = realloc (mio->impl.mem.scratch, MAX (n, 1));
+      if (! scratch) {
+        mio->impl.mem.error = TRUE;
+        errno = ENOMEM;
+      } else {
+        mio->impl.mem.scratch = scratch;
+        mio->impl.mem.reserved = n;
+        ptr = scratch;
+      }
+    } else {
+      line_index_invalidate (mio, (off_t) mio->impl.mem.pos);
+      mio->write_ptr = &mio->impl.mem.buf[mio->impl.mem.pos];
+      mio->write_end = &mio->impl.mem.buf[mio->impl.mem.allocated_size];
+      ptr = mio->write_ptr;
+    }
+  }
+  
+  return ptr;
+}
+
+static int
+mem_commit (MIO   *mio,
+            size_t n)
+{
+  int rv = -1;
+  
+  /* mio_write_commit() already handled everything within the write window */
+  if (n == 0) {
+    rv = 0;
+  } else if (n > mio->impl.mem.reserved) {
+    errno = EINVAL;
+  } else {
+    mem_sync (mio);
+    if (mem_try_ensure_space (mio, n)) {
+      memcpy (&mio->impl.mem.buf[mio->impl.mem.pos], mio->impl.mem.scratch,
+              n);
+      mio->impl.mem.pos += n;
+      rv = 0;
+    }
+  }
+  mio->impl.mem.reserved = 0;
+  
+  return rv;
+}
+
+static ssize_t
+mem_pread (MIO   *mio,
+           void  *ptr,
+           size_t count,
+           off_t  offset)
+{
+  ssize_t rv    = 0;
+  size_t  size  = mio->impl.mem.size;
+  
+  /* we must not change the stream's state here for concurrent calls to be
+   * safe, so don't fold the write window back but only peek at it */
+  if (mio->write_ptr) {
+    size = MAX (size, (size_t) (mio->write_ptr - mio->impl.mem.buf));
+  }
+  if (offset < (off_t) size) {
+    size_t n = size - (size_t) offset;
+    
+    n = MIN (n, MIN (count, ((size_t) -1) >> 1));
+    memcpy (ptr, &mio->impl.mem.buf[offset], n);
+    rv = (ssize_t) n;
+  }
+  
+  return rv;
+}
+
+static ssize_t
+mem_pwrite (MIO        *mio,
+            const void *ptr,
+            size_t      count,
+            off_t       offset)
+{
+  ssize_t rv = -1;
+  
+  mem_sync (mio);
+  count = MIN (count, ((size_t) -1) >> 1);
+  if (! mem_unshare (mio)) {
+    /* errno is already set */
+  } else if (offset != (off_t) (size_t) offset ||
+      (size_t) offset > ((size_t) -1) - count) {
+    #ifdef EFBIG
+    errno = EFBIG;
+    #endif
+  } else {
+    size_t  start = (size_t) offset;
+    size_t  size  = mio->impl.mem.size;
+    
+    line_index_invalidate (mio, (off_t) MIN (start, size));
+    if (start + count <= size || mem_try_resize (mio, start + count)) {
+      if (start > size) {
+        /* fill the gap like a file system would do */
+        memset (&mio->impl.mem.buf[size], 0, start - size);
+      }
+      memcpy (&mio->impl.mem.buf[start], ptr, count);
+      rv = (ssize_t) count;
+    } else {
+      errno = ENOMEM;
+    }
+  }
+  
+  return rv;
+}
+
+static size_t
+mem_readv (MIO                 *mio,
+           const struct iovec  *iov,
+           int                  iovcnt)
+{
+  size_t  n_read = 0;
+  int     i;
+  
+  for (i = 0; i < iovcnt; i++) {
+    size_t n = mem_read (mio, iov[i].iov_base, 1, iov[i].iov_len);
+    
+    n_read += n;
+    if (n < iov[i].iov_len) {
+      break;
+    }
+  }
+  
+  return n_read;
+}
+
+static size_t
+mem_writev (MIO                 *mio,
+            const struct iovec  *iov,
+            int                  iovcnt)
+{
+  size_t  n_written = 0;
+  size_t  total     = 0;
+  int     i;
+  
+  mem_sync (mio);
+  for (i = 0; i < iovcnt; i++) {
+    total += iov[i].iov_len;
+  }
+  /* make room for the whole batch at once */
+  if (total > 0 && mem_try_ensure_space (mio, total)) {
+    for (i = 0; i < iovcnt; i++) {
+      memcpy (&mio->impl.mem.buf[mio->impl.mem.pos], iov[i].iov_base,
+              iov[i].iov_len);
+      mio->impl.mem.pos += iov[i].iov_len;
+    }
+    n_written = total;
+  }
+  
+  return n_written;
+}
+
+static int
+mem_mark (MIO *mio)
+{
+  mem_sync (mio);
+  mio->mark.offset = (off_t) mio->impl.mem.pos;
+  mio->mark.ungetch = mio->impl.mem.ungetch;
+  
+  return 0;
+}
+
+static int
+mem_reset (MIO *mio)
+{
+  mem_sync (mio);
+  mio->impl.mem.pos = (size_t) mio->mark.offset;
+  mio->impl.mem.ungetch = mio->mark.ungetch;
+  mio->impl.mem.eof = FALSE;
+  
+  return 0;
+}
@@ -0,0 +1,764 @@
+/*
+ *  MIO, an I/O abstraction layer replicating C file I/O API.
+ *  Copyright (C) 2010  Colomban Wendling <ban@herbesfolles.org>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ * 
+ */
+
+/* memory-mapped file IO implementation */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_MMAP
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+#include "mio.h"
+
+#ifndef TRUE
+# define TRUE 1
+#endif
+#ifndef FALSE
+# define FALSE 0
+#endif
+
+
+#ifdef HAVE_MMAP
+
+#define MMAP_SET_VTABLE(mio)          \
+  do {                                \
+    mio->v_free     = mmap_free;      \
+    mio->v_read     = mmap_read;      \
+    mio->v_write    = mmap_write;     \
+    mio->v_getc     = mmap_getc;      \
+    mio->v_gets     = mmap_gets;      \
+    mio->v_ungetc   = mmap_ungetc;    \
+    mio->v_putc     = mmap_putc;      \
+    mio->v_puts     = mmap_puts;      \
+    mio->v_vprintf  = mmap_vprintf;   \
+    mio->v_clearerr = mmap_clearerr;  \
+    mio->v_eof      = mmap_eof;       \
+    mio->v_error    = mmap_error;     \
+    mio->v_seek     = mmap_seek;      \
+    mio->v_tell     = mmap_tell;      \
+    mio->v_rewind   = mmap_rewind;    \
+    mio->v_getpos   = mmap_getpos;    \
+    mio->v_setpos   = mmap_setpos;    \
+    mio->v_peek     = mmap_peek;      \
+    mio->v_consume  = mmap_consume;   \
+    mio->v_reserve  = mmap_reserve;   \
+    mio->v_commit   = mmap_commit;    \
+    mio->v_pread    = mmap_pread;     \
+    mio->v_pwrite   = mmap_pwrite;    \
+    mio->v_readv    = mmap_readv;     \
+    mio->v_writev   = mmap_writev;    \
+    mio->v_mark     = mmap_mark;      \
+    mio->v_reset    = mmap_reset;     \
+  } while (0)
+
+
+static size_t
+mmap_page_size (void)
+{
+  long size = sysconf (_SC_PAGESIZE);
+  
+  return (size > 0) ? (size_t) size : 4096;
+}
+
+/*
+ * mmap_sync:
+ * @mio: A #MIO object of the type %MIO_TYPE_MMAP
+ * 
+ * Folds the read window back into the stream's position, and closes it.  This
+ * must be called before looking at the stream's position.
+ */
+static void
+mmap_sync (MIO *mio)
+{
+  if (mio->read_ptr) {
+    mio->impl.mmap.pos = mio->impl.mmap.map_offset +
+                         (off_t) (mio->read_ptr - mio->impl.mmap.map);
+    mio->read_ptr = NULL;
+    mio->read_end = NULL;
+  }
+}
+
+/*
+ * mmap_map:
+ * @mio: A #MIO object of the type %MIO_TYPE_MMAP
+ * @offset: An offset in the file, smaller than its size
+ * 
+ * Makes sure @offset is part of the current mapping, sliding the window to it
+ * if needed.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static int
+mmap_map (MIO  *mio,
+          off_t offset)
+{
+  int success = TRUE;
+  
+  if (! mio->impl.mmap.map ||
+      offset < mio->impl.mmap.map_offset ||
+      offset - mio->impl.mmap.map_offset >= (off_t) mio->impl.mmap.map_size) {
+    off_t   start = offset - offset % (off_t) mmap_page_size ();
+    size_t  size  = mio->impl.mmap.window_size;
+    int     flags = MAP_PRIVATE;
+    void   *map;
+    
+    if ((off_t) size > mio->impl.mmap.size - start) {
+      size = (size_t) (mio->impl.mmap.size - start);
+    }
+    if (mio->impl.mmap.map) {
+      munmap (mio->impl.mmap.map, mio->impl.mmap.map_size);
+      mio->impl.mmap.map = NULL;
+      mio->impl.mmap.map_size = 0;
+    }
+    #ifdef MAP_POPULATE
+    if (mio->impl.mmap.flags & MIO_MMAP_POPULATE) {
+      flags |= MAP_POPULATE;
+    }
+    #endif
+    map = mmap (NULL, size, PROT_READ, flags, mio->impl.mmap.fd, start);
+    if (map == MAP_FAILED) {
+      mio->impl.mmap.error = TRUE;
+      success = FALSE;
+    } else {
+      mio->impl.mmap.map = map;
+      mio->impl.mmap.map_offset = start;
+      mio->impl.mmap.map_size = size;
+      #ifdef HAVE_MADVISE
+      #ifdef MADV_SEQUENTIAL
+      if (mio->impl.mmap.flags & MIO_MMAP_SEQUENTIAL) {
+        madvise (map, size, MADV_SEQUENTIAL);
+      }
+      #endif
+      #ifdef MADV_RANDOM
+      if (mio->impl.mmap.flags & MIO_MMAP_RANDOM) {
+        madvise (map, size, MADV_RANDOM);
+      }
+      #endif
+      #ifdef MADV_WILLNEED
+      if (mio->impl.mmap.flags & MIO_MMAP_WILLNEED) {
+        madvise (map, size, MADV_WILLNEED);
+      }
+      #endif
+      #endif /* HAVE_MADVISE */
+    }
+  }
+  
+  return success;
+}
+
+/*
+ * mmap_fill:
+ * @mio: A #MIO object of the type %MIO_TYPE_MMAP
+ * 
+ * Opens the read window at the current position, mapping it if needed.  The
+ * stream must be synchronized, and no character must be pushed back.
+ * 
+ * Returns: The number of bytes available in the read window.
+ */
+static size_t
+mmap_fill (MIO *mio)
+{
+  size_t n = 0;
+  
+  if (mio->impl.mmap.pos < mio->impl.mmap.size &&
+      mmap_map (mio, mio->impl.mmap.pos)) {
+    mio->read_ptr = mio->impl.mmap.map +
+                    (mio->impl.mmap.pos - mio->impl.mmap.map_offset);
+    mio->read_end = mio->impl.mmap.map + mio->impl.mmap.map_size;
+    n = (size_t) (mio->read_end - mio->read_ptr);
+  }
+  
+  return n;
+}
+
+/*
+ * mmap_open:
+ * @mio: A #MIO object
+ * @filename: The file to map
+ * @flags: Access hints
+ * @window_size: Size of the mapping window, or 0 to map the whole file
+ * 
+ * Initializes @mio to work on @filename.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static int
+mmap_open (MIO         *mio,
+           const char  *filename,
+           MIOMmapFlags flags,
+           size_t       window_size)
+{
+  int         success = FALSE;
+  int         fd;
+  struct stat st;
+  
+  fd = open (filename, O_RDONLY);
+  if (fd >= 0) {
+    if (fstat (fd, &st) != 0) {
+      /* errno is already set */
+    } else if (! S_ISREG (st.st_mode)) {
+      errno = ENODEV;
+    } else if (window_size == 0 &&
+               st.st_size != (off_t) (size_t) st.st_size) {
+      /* the file doesn't fit in the address space, use a window */
+      errno = EFBIG;
+    } else {
+      if (window_size == 0) {
+        window_size = (size_t) st.st_size;
+      } else {
+        size_t page_size = mmap_page_size ();
+        
+        window_size = (window_size + page_size - 1) / page_size * page_size;
+      }
+      mio->impl.mmap.fd = fd;
+      mio->impl.mmap.map = NULL;
+      mio->impl.mmap.map_offset = 0;
+      mio->impl.mmap.map_size = 0;
+      mio->impl.mmap.window_size = window_size;
+      mio->impl.mmap.size = st.st_size;
+      mio->impl.mmap.pos = 0;
+      mio->impl.mmap.ungetch = EOF;
+      mio->impl.mmap.flags = flags;
+      mio->impl.mmap.error = FALSE;
+      mio->impl.mmap.eof = FALSE;
+      success = (st.st_size == 0 || mmap_map (mio, 0));
+    }
+    if (! success) {
+      int errnum = errno;
+      
+      close (fd);
+      errno = errnum;
+    }
+  }
+  
+  return success;
+}
+
+static void
+mmap_free (MIO *mio)
+{
+  mmap_sync (mio);
+  if (mio->impl.mmap.map) {
+    munmap (mio->impl.mmap.map, mio->impl.mmap.map_size);
+  }
+  close (mio->impl.mmap.fd);
+  mio->impl.mmap.fd = -1;
+  mio->impl.mmap.map = NULL;
+  mio->impl.mmap.map_size = 0;
+  mio->impl.mmap.size = 0;
+  mio->impl.mmap.pos = 0;
+}
+
+static size_t
+mmap_read (MIO    *mio,
+           void   *ptr_,
+           size_t  size,
+           size_t  nmemb)
+{
+  size_t n_read = 0;
+  
+  mmap_sync (mio);
+  if (size != 0 && nmemb != 0) {
+    size_t          n     = size * nmemb;
+    size_t          got   = 0;
+    unsigned char  *ptr   = ptr_;
+    
+    if (mio->impl.mmap.ungetch != EOF) {
+      *ptr = (unsigned char) mio->impl.mmap.ungetch;
+      mio->impl.mmap.ungetch = EOF;
+      mio->impl.mmap.pos++;
+      got++;
+    }
+    while (got < n) {
+      size_t avail = mmap_fill (mio);
+      
+      if (avail == 0) {
+        break;
+      }
+      if (avail > n - got) {
+        avail = n - got;
+      }
+      memcpy (&ptr[got], mio->read_ptr, avail);
+      mio->read_ptr += avail;
+      mmap_sync (mio);
+      got += avail;
+    }
+    if (mio->impl.mmap.pos >= mio->impl.mmap.size) {
+      mio->impl.mmap.eof = TRUE;
+    }
+    n_read = got / size;
+  }
+  
+  return n_read;
+}
+
+static size_t
+mmap_write (MIO         *mio,
+            const void  *ptr,
+            size_t       size,
+            size_t       nmemb)
+{
+  mio->impl.mmap.error = TRUE;
+  errno = EBADF;
+  
+  return 0;
+}
+
+static int
+mmap_putc (MIO  *mio,
+           int   c)
+{
+  mio->impl.mmap.error = TRUE;
+  errno = EBADF;
+  
+  return EOF;
+}
+
+static int
+mmap_puts (MIO        *mio,
+           const char *s)
+{
+  mio->impl.mmap.error = TRUE;
+  errno = EBADF;
+  
+  return EOF;
+}
+
+__attribute__((__format__ (__printf__, 2, 0)))
+static int
+mmap_vprintf (MIO         *mio,
+              const char  *format,
+              va_list      ap)
+{
+  mio->impl.mmap.error = TRUE;
+  errno = EBADF;
+  
+  return -1;
+}
+
+static int
+mmap_getc (MIO *mio)
+{
+  int rv = EOF;
+  
+  mmap_sync (mio);
+  if (mio->impl.mmap.ungetch != EOF) {
+    rv = mio->impl.mmap.ungetch;
+    mio->impl.mmap.ungetch = EOF;
+    mio->impl.mmap.pos++;
+  } else if (mmap_fill (mio) > 0) {
+    rv = *mio->read_ptr++;
+  } else if (mio->impl.mmap.pos >= mio->impl.mmap.size) {
+    mio->impl.mmap.eof = TRUE;
+  }
+  
+  return rv;
+}
+
+static int
+mmap_ungetc (MIO  *mio,
+             int   ch)
+{
+  int rv = EOF;
+  
+  mmap_sync (mio);
+  if (ch != EOF && mio->impl.mmap.ungetch == EOF) {
+    rv = mio->impl.mmap.ungetch = ch;
+    mio->impl.mmap.pos--;
+    mio->impl.mmap.eof = FALSE;
+  }
+  
+  return rv;
+}
+
+static char *
+mmap_gets (MIO    *mio,
+           char   *s,
+           size_t  size)
+{
+  char *rv = NULL;
+  
+  mmap_sync (mio);
+  if (size > 0) {
+    size_t i = 0;
+    
+    if (mio->impl.mmap.ungetch != EOF && size > 1) {
+      s[i] = (char) mio->impl.mmap.ungetch;
+      mio->impl.mmap.ungetch = EOF;
+      mio->impl.mmap.pos++;
+      i++;
+    }
+    while (i < size - 1 && (i == 0 || s[i - 1] != '\n')) {
+      size_t          n = mmap_fill (mio);
+      unsigned char  *nl;
+      
+      if (n == 0) {
+        break;
+      }
+      if (n > size - 1 - i) {
+        n = size - 1 - i;
+      }
+      nl = memchr (mio->read_ptr, '\n', n);
+      if (nl) {
+        n = (size_t) (nl - mio->read_ptr) + 1;
+      }
+      memcpy (&s[i], mio->read_ptr, n);
+      mio->read_ptr += n;
+      mmap_sync (mio);
+      i += n;
+    }
+    if (i > 0) {
+      s[i] = 0;
+      rv = s;
+    }
+    if (mio->impl.mmap.pos >= mio->impl.mmap.size) {
+      mio->impl.mmap.eof = TRUE;
+    }
+  }
+  
+  return rv;
+}
+
+static void
+mmap_clearerr (MIO *mio)
+{
+  mio->impl.mmap.error = FALSE;
+  mio->impl.mmap.eof = FALSE;
+}
+
+static int
+mmap_eof (MIO *mio)
+{
+  return mio->impl.mmap.eof != FALSE;
+}
+
+static int
+mmap_error (MIO *mio)
+{
+  return mio->impl.mmap.error != FALSE;
+}
+
+static int
+mmap_seek (MIO  *mio,
+           long  offset,
+           int   whence)
+{
+  int   rv = -1;
+  off_t base;
+  
+  mmap_sync (mio);
+  switch (whence) {
+    case SEEK_SET:  base = 0;                     break;
+    case SEEK_CUR:  base = mio->impl.mmap.pos;    break;
+    case SEEK_END:  base = mio->impl.mmap.size;   break;
+    default:        base = -1;                    break;
+  }
+  if (base < 0 ||
+      (offset < 0 && (off_t) -offset > base) ||
+      (offset > 0 && (off_t) offset > mio->impl.mmap.size - base)) {
+    errno = EINVAL;
+  } else {
+    mio->impl.mmap.pos = base + offset;
+    mio->impl.mmap.eof = FALSE;
+    mio->impl.mmap.ungetch = EOF;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static long
+mmap_tell (MIO *mio)
+{
+  long rv = -1;
+  
+  mmap_sync (mio);
+  if (mio->impl.mmap.pos > LONG_MAX) {
+    #ifdef EOVERFLOW
+    errno = EOVERFLOW;
+    #endif
+  } else if (mio->impl.mmap.pos < 0) {
+    /* this happens if ungetc() was called at the start of the stream */
+    #ifdef EIO
+    errno = EIO;
+    #endif
+  } else {
+    rv = (long) mio->impl.mmap.pos;
+  }
+  
+  return rv;
+}
+
+static void
+mmap_rewind (MIO *mio)
+{
+  mmap_sync (mio);
+  mio->impl.mmap.pos = 0;
+  mio->impl.mmap.ungetch = EOF;
+  mio->impl.mmap.eof = FALSE;
+  mio->impl.mmap.error = FALSE;
+}
+
+static int
+mmap_getpos (MIO    *mio,
+             MIOPos *pos)
+{
+  int rv = -1;
+  
+  mmap_sync (mio);
+  if (mio->impl.mmap.pos < 0) {
+    /* this happens if ungetc() was called at the start of the stream */
+    #ifdef EIO
+    errno = EIO;
+    #endif
+  } else {
+    pos->impl.mmap = mio->impl.mmap.pos;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static int
+mmap_setpos (MIO    *mio,
+             MIOPos *pos)
+{
+  int rv = -1;
+  
+  mmap_sync (mio);
+  if (pos->impl.mmap > mio->impl.mmap.size) {
+    errno = EINVAL;
+  } else {
+    mio->impl.mmap.ungetch = EOF;
+    mio->impl.mmap.pos = pos->impl.mmap;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static const unsigned char *
+mmap_peek (MIO    *mio,
+           size_t *avail)
+{
+  const unsigned char *ptr = NULL;
+  
+  mmap_sync (mio);
+  *avail = 0;
+  if (mio->impl.mmap.ungetch != EOF &&
+      mio->impl.mmap.pos >= 0 && mmap_fill (mio) > 0 &&
+      *mio->read_ptr == mio->impl.mmap.ungetch) {
+    /* the pushed back character is the one in the file, forget it */
+    mio->impl.mmap.ungetch = EOF;
+  }
+  mmap_sync (mio);
+  if (mio->impl.mmap.ungetch != EOF) {
+    ptr = &mem_bytes[(unsigned char) mio->impl.mmap.ungetch];
+    *avail = 1;
+  } else if ((*avail = mmap_fill (mio)) > 0) {
+    ptr = mio->read_ptr;
+  } else if (mio->impl.mmap.pos >= mio->impl.mmap.size) {
+    mio->impl.mmap.eof = TRUE;
+  }
+  
+  return ptr;
+}
+
+static int
+mmap_consume (MIO   *mio,
+              size_t n)
+{
+  int rv = -1;
+  
+  mmap_sync (mio);
+  if (mio->impl.mmap.ungetch != EOF) {
+    /* mmap_peek() only gave the pushed back character */
+    if (n > 1) {
+      errno = EINVAL;
+    } else {
+      if (n == 1) {
+        mio->impl.mmap.ungetch = EOF;
+        mio->impl.mmap.pos++;
+      }
+      rv = 0;
+    }
+  } else if ((off_t) n > mio->impl.mmap.size - mio->impl.mmap.pos) {
+    errno = EINVAL;
+  } else {
+    mio->impl.mmap.pos += (off_t) n;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static void *
+mmap_reserve (MIO   *mio,
+              size_t n)
+{
+  mio->impl.mmap.error = TRUE;
+  errno = EBADF;
+  
+  return NULL;
+}
+
+static int
+mmap_commit (MIO   *mio,
+             size_t n)
+{
+  int rv = -1;
+  
+  if (n == 0) {
+    rv = 0;
+  } else {
+    errno = EBADF;
+  }
+  
+  return rv;
+}
+
+static ssize_t
+mmap_pread (MIO   *mio,
+            void  *ptr,
+            size_t count,
+            off_t  offset)
+{
+  ssize_t rv = 0;
+  
+  if (offset < mio->impl.mmap.size) {
+    if (mio->impl.mmap.map && mio->impl.mmap.map_offset == 0 &&
+        (off_t) mio->impl.mmap.map_size == mio->impl.mmap.size) {
+      /* the whole file is mapped, which never changes */
+      size_t n = (size_t) (mio->impl.mmap.size - offset);
+      
+      n = MIN (n, MIN (count, ((size_t) -1) >> 1));
+      memcpy (ptr, &mio->impl.mmap.map[offset], n);
+      rv = (ssize_t) n;
+    } else {
+      /* the window would have to move, which isn't thread-safe */
+#ifdef HAVE_PREAD
+      do {
+        rv = pread (mio->impl.mmap.fd, ptr, count, offset);
+      } while (rv < 0 && errno == EINTR);
+#else
+      #ifdef ENOSYS
+      errno = ENOSYS;
+      #endif
+      rv = -1;
+#endif
+    }
+  }
+  
+  return rv;
+}
+
+static ssize_t
+mmap_pwrite (MIO        *mio,
+             const void *ptr,
+             size_t      count,
+             off_t       offset)
+{
+  errno = EBADF;
+  
+  return -1;
+}
+
+static size_t
+mmap_readv (MIO                 *mio,
+            const struct iovec  *iov,
+            int                  iovcnt)
+{
+  size_t  n_read = 0;
+  int     i;
+  
+  for (i = 0; i < iovcnt; i++) {
+    size_t n = mmap_read (mio, iov[i].iov_base, 1, iov[i].iov_len);
+    
+    n_read += n;
+    if (n < iov[i].iov_len) {
+      break;
+    }
+  }
+  
+  return n_read;
+}
+
+static size_t
+mmap_writev (MIO                 *mio,
+             const struct iovec  *iov,
+             int                  iovcnt)
+{
+  mio->impl.mmap.error = TRUE;
+  errno = EBADF;
+  
+  return 0;
+}
+
+static int
+mmap_mark (MIO *mio)
+{
+  mmap_sync (mio);
+  mio->mark.offset = mio->impl.mmap.pos;
+  mio->mark.ungetch = mio->impl.mmap.ungetch;
+  
+  return 0;
+}
+
+static int
+mmap_reset (MIO *mio)
+{
+  mmap_sync (mio);
+  mio->impl.mmap.pos = mio->mark.offset;
+  mio->impl.mmap.ungetch = mio->mark.ungetch;
+  mio->impl.mmap.eof = FALSE;
+  
+  return 0;
+}
+
+#else /* ! HAVE_MMAP */
+
+#define MMAP_SET_VTABLE(mio) do { } while (0)
+
+static int
+mmap_open (MIO         *mio,
+           const char  *filename,
+           MIOMmapFlags flags,
+           size_t       window_size)
+{
+  #ifdef ENOSYS
+  errno = ENOSYS;
+  #endif
+  
+  return FALSE;
+}
+
+#endif /* HAVE_MMAP */
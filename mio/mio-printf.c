@@ -0,0 +1,1386 @@
+/*
+ *  MIO, an I/O abstraction layer replicating C file I/O API.
+ *  Copyright (C) 2010  Colomban Wendling <ban@herbesfolles.org>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ * 
+ */
+
+/* locale-independent printf implementation shared by the writable backends.
+ * format_float() and FORMAT_BIG_SIZE are derived from musl's fmt_fp(), under
+ * the MIT license reproduced above format_float() */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_GLIB
+# include <glib.h>
+#endif
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <float.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mio.h"
+
+#ifndef TRUE
+# define TRUE 1
+#endif
+#ifndef FALSE
+# define FALSE 0
+#endif
+
+
+/* flags of a conversion specification */
+#define FORMAT_LEFT   (1u << 0) /* - */
+#define FORMAT_PLUS   (1u << 1) /* + */
+#define FORMAT_SPACE  (1u << 2) /* space */
+#define FORMAT_ALT    (1u << 3) /* # */
+#define FORMAT_ZERO   (1u << 4) /* 0 */
+
+/* width or precision given as an argument (*) */
+#define FORMAT_ARG    (-2)
+
+/* largest output piece written through the backend's reserve() rather than
+ * its write() when the write window is full */
+#define FORMAT_RESERVE_MAX 4096
+
+/* number of base 10^9 words needed to hold any double in format_float(): the
+ * mantissa, plus room for the biggest positive or negative exponent */
+#define FORMAT_BIG_SIZE ((DBL_MANT_DIG + 28) / 29 + 1 + \
+                         (DBL_MAX_EXP + DBL_MANT_DIG + 28 + 8) / 9)
+
+/* size of the buffer for format_float_buffer(): a sign, 17 digits, a point
+ * and an exponent of at most 3 digits or 4 leading zeros */
+#define FORMAT_FLOAT_BUFFER_SIZE 32
+
+enum {
+  FORMAT_LENGTH_NONE,
+  FORMAT_LENGTH_HH,
+  FORMAT_LENGTH_H,
+  FORMAT_LENGTH_L,
+  FORMAT_LENGTH_LL,
+  FORMAT_LENGTH_J,
+  FORMAT_LENGTH_Z,
+  FORMAT_LENGTH_T,
+  FORMAT_LENGTH_LONG_DOUBLE
+};
+
+struct _MIOFormatSpec {
+  unsigned int  flags;
+  int           width;      /* FORMAT_ARG if given as an argument */
+  int           precision;  /* -1 if none, FORMAT_ARG if given as an argument */
+  int           length;
+  char          conversion;
+};
+
+/* a piece of a compiled format: some literal text followed by a conversion */
+struct _MIOFormatOp {
+  const char             *literal;
+  size_t                  literal_len;
+  struct _MIOFormatSpec   spec;   /* conversion is 0 for the trailing text */
+};
+
+struct _MIOFormat {
+  size_t                n_ops;
+  struct _MIOFormatOp  *ops;
+};
+
+struct _MIOFormatOut {
+  MIO    *mio;
+  size_t  len;    /* number of bytes output so far */
+  int     error;
+};
+
+
+/*
+ * format_out:
+ * @out: The output state
+ * @ptr: The bytes to output
+ * @n: Number of bytes to output
+ * 
+ * Outputs @n bytes to the stream, copying them right into its write window
+ * when there is room.  Otherwise, the window is re-opened through the
+ * backend's reserve() so that the next pieces go there, unless the piece is
+ * too large in which case it is written directly.
+ */
+static void
+format_out (struct _MIOFormatOut *out,
+            const void           *ptr,
+            size_t                n)
+{
+  MIO *mio = out->mio;
+  
+  if (n == 0 || out->error) {
+    return;
+  }
+  
+  out->len += n;
+  if (mio->write_ptr && n <= (size_t) (mio->write_end - mio->write_ptr)) {
+    if (n <= 8) {
+      /* most pieces are tiny, don't bother calling memcpy() for them */
+      const unsigned char *src = ptr;
+      
+      do {
+        *mio->write_ptr++ = *src++;
+      } while (--n > 0);
+    } else {
+      memcpy (mio->write_ptr, ptr, n);
+      mio->write_ptr += n;
+    }
+  } else if (n <= FORMAT_RESERVE_MAX) {
+    unsigned char *dest = mio->v_reserve (mio, n);
+    
+    if (! dest) {
+      out->error = TRUE;
+    } else {
+      memcpy (dest, ptr, n);
+      if (dest == mio->write_ptr &&
+          n <= (size_t) (mio->write_end - mio->write_ptr)) {
+        mio->write_ptr += n;
+      } else if (mio->v_commit (mio, n) != 0) {
+        out->error = TRUE;
+      }
+    }
+  } else if (mio->v_write (mio, ptr, n, 1) != 1) {
+    out->error = TRUE;
+  }
+}
+
+/* outputs @n times the byte @c */
+static void
+format_fill (struct _MIOFormatOut *out,
+             char                  c,
+             size_t                n)
+{
+  MIO *mio = out->mio;
+  
+  while (n > 0 && ! out->error) {
+    size_t chunk;
+    
+    if (mio->write_ptr && mio->write_ptr < mio->write_end) {
+      chunk = (size_t) (mio->write_end - mio->write_ptr);
+      chunk = (n < chunk) ? n : chunk;
+      memset (mio->write_ptr, c, chunk);
+      mio->write_ptr += chunk;
+      out->len += chunk;
+    } else {
+      char buf[64];
+      
+      chunk = (n < sizeof buf) ? n : sizeof buf;
+      memset (buf, c, chunk);
+      format_out (out, buf, chunk);
+    }
+    n -= chunk;
+  }
+}
+
+/*
+ * format_pad_begin:
+ * @out: The output state
+ * @flags: The conversion flags
+ * @width: The minimum field width
+ * @len: Length of the field's content, including @prefix
+ * @prefix: Sign or base prefix, that goes before any zero padding
+ * @prefix_len: Length of @prefix
+ * 
+ * Outputs the padding that goes before the content of a field, and its prefix.
+ * Call format_pad_end() with the same arguments once the rest of the content
+ * is output.
+ */
+static void
+format_pad_begin (struct _MIOFormatOut *out,
+                  unsigned int          flags,
+                  int                   width,
+                  size_t                len,
+                  const char           *prefix,
+                  size_t                prefix_len)
+{
+  size_t pad = ((size_t) width > len) ? (size_t) width - len : 0;
+  
+  if (! (flags & (FORMAT_LEFT | FORMAT_ZERO))) {
+    format_fill (out, ' ', pad);
+  }
+  format_out (out, prefix, prefix_len);
+  if (flags & FORMAT_ZERO) {
+    format_fill (out, '0', pad);
+  }
+}
+
+static void
+format_pad_end (struct _MIOFormatOut *out,
+                unsigned int          flags,
+                int                   width,
+                size_t                len)
+{
+  if ((flags & FORMAT_LEFT) && (size_t) width > len) {
+    format_fill (out, ' ', (size_t) width - len);
+  }
+}
+
+/*
+ * format_decimal:
+ * @end: End of the buffer to fill
+ * @value: The value to format
+ * 
+ * Formats @value in decimal backwards from @end, two digits at a time.
+ * 
+ * Returns: The first character of the formatted value.
+ */
+static char *
+format_decimal (char     *end,
+                uintmax_t value)
+{
+  static const char digits[] = "0001020304050607080910111213141516171819"
+                               "2021222324252627282930313233343536373839"
+                               "4041424344454647484950515253545556575859"
+                               "6061626364656667686970717273747576777879"
+                               "8081828384858687888990919293949596979899";
+  char *p = end;
+  
+  while (value >= 100) {
+    unsigned int i = (unsigned int) (value % 100) * 2;
+    
+    value /= 100;
+    *--p = digits[i + 1];
+    *--p = digits[i];
+  }
+  if (value >= 10) {
+    unsigned int i = (unsigned int) value * 2;
+    
+    *--p = digits[i + 1];
+    *--p = digits[i];
+  } else {
+    *--p = (char) ('0' + value);
+  }
+  
+  return p;
+}
+
+/* outputs a string or character field */
+static void
+format_string (struct _MIOFormatOut *out,
+               unsigned int          flags,
+               int                   width,
+               const char           *s,
+               size_t                n)
+{
+  /* the 0 flag only applies to numbers */
+  flags &= ~FORMAT_ZERO;
+  format_pad_begin (out, flags, width, n, NULL, 0);
+  format_out (out, s, n);
+  format_pad_end (out, flags, width, n);
+}
+
+/*
+ * format_integer:
+ * @out: The output state
+ * @flags: The conversion flags
+ * @width: The minimum field width
+ * @precision: The minimum number of digits, or -1
+ * @conversion: The conversion, one of d, o, u, x, X or p
+ * @value: The absolute value to output
+ * @negative: Whether the value is negative
+ * 
+ * Outputs an integer field.
+ */
+static void
+format_integer (struct _MIOFormatOut *out,
+                unsigned int          flags,
+                int                   width,
+                int                   precision,
+                char                  conversion,
+                uintmax_t             value,
+                int                   negative)
+{
+  char        buf[(sizeof (uintmax_t) * CHAR_BIT + 2) / 3];
+  char       *end     = &buf[sizeof buf];
+  char       *digits  = end;
+  char        prefix[3];
+  size_t      prefix_len = 0;
+  size_t      n_digits;
+  size_t      n_zeros = 0;
+  size_t      len;
+  
+  if (precision != 0 || value != 0) {
+    if (conversion == 'o') {
+      uintmax_t v = value;
+      
+      do {
+        *--digits = (char) ('0' + (v & 7));
+        v >>= 3;
+      } while (v);
+    } else if (conversion == 'x' || conversion == 'X' || conversion == 'p') {
+      const char *hex = (conversion == 'X') ? "0123456789ABCDEF"
+                                            : "0123456789abcdef";
+      uintmax_t   v   = value;
+      
+      do {
+        *--digits = hex[v & 0xf];
+        v >>= 4;
+      } while (v);
+    } else {
+      digits = format_decimal (end, value);
+    }
+  }
+  n_digits = (size_t) (end - digits);
+  
+  if (conversion == 'd' || conversion == 'p') {
+    if (negative) {
+      prefix[prefix_len++] = '-';
+    } else if (flags & FORMAT_PLUS) {
+      prefix[prefix_len++] = '+';
+    } else if (flags & FORMAT_SPACE) {
+      prefix[prefix_len++] = ' ';
+    }
+  }
+  if ((flags & FORMAT_ALT) && value != 0 &&
+      (conversion == 'x' || conversion == 'X' || conversion == 'p')) {
+    prefix[prefix_len++] = '0';
+    prefix[prefix_len++] = (conversion == 'X') ? 'X' : 'x';
+  }
+  if (precision >= 0) {
+    flags &= ~FORMAT_ZERO;
+    if ((size_t) precision > n_digits) {
+      n_zeros = (size_t) precision - n_digits;
+    }
+  }
+  /* the alternate octal form has to start with a 0 */
+  if ((flags & FORMAT_ALT) && conversion == 'o' && n_zeros == 0 &&
+      (n_digits == 0 || *digits != '0')) {
+    n_zeros = 1;
+  }
+  
+  len = prefix_len + n_zeros + n_digits;
+  format_pad_begin (out, flags, width, len, prefix, prefix_len);
+  format_fill (out, '0', n_zeros);
+  format_out (out, digits, n_digits);
+  format_pad_end (out, flags, width, len);
+}
+
+/* formats the 9 digits of the base 10^9 word @x into @buf */
+static void
+format_word (char     buf[9],
+             uint32_t x)
+{
+  int i;
+  
+  for (i = 8; i >= 0; i--) {
+    buf[i] = (char) ('0' + x % 10);
+    x /= 10;
+  }
+}
+
+/* splits a positive finite @value into a fraction in [0.5, 1) and a power of
+ * two like frexp(), without needing the math library */
+static double
+format_frexp (double  value,
+              int    *exponent)
+{
+  uint64_t  bits;
+  int       e;
+  
+  memcpy (&bits, &value, sizeof bits);
+  e = (int) ((bits >> 52) & 0x7ff);
+  if (e == 0) {
+    /* subnormal, scale it up by 2^64 first */
+    value *= 18446744073709551616.0;
+    memcpy (&bits, &value, sizeof bits);
+    e = (int) ((bits >> 52) & 0x7ff) - 64;
+  }
+  *exponent = e - 1022;
+  bits = (bits & ~((uint64_t) 0x7ff << 52)) | ((uint64_t) 1022 << 52);
+  memcpy (&value, &bits, sizeof bits);
+  
+  return value;
+}
+
+/*
+ * format_hex_float:
+ * @out: The output state
+ * @flags: The conversion flags
+ * @width: The minimum field width
+ * @precision: The number of hexadecimal digits after the point, or -1 for
+ *             as many as needed to represent the value exactly
+ * @upper: Whether to use upper case
+ * @sign: Sign prefix, or %NULL
+ * @bits: The bits of the finite value to output
+ * 
+ * Outputs a finite double in hexadecimal (the a and A conversions).  Like the
+ * GNU C library, the leading digit is the implicit bit of the value, so
+ * subnormals are written as 0x0.XXXp-1022 and rounding can make it a 2.
+ */
+static void
+format_hex_float (struct _MIOFormatOut *out,
+                  unsigned int          flags,
+                  int                   width,
+                  int                   precision,
+                  int                   upper,
+                  const char           *sign,
+                  uint64_t              bits)
+{
+  const char *hex       = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+  int         biased    = (int) ((bits >> 52) & 0x7ff);
+  uint64_t    mantissa  = bits & (((uint64_t) 1 << 52) - 1);
+  unsigned    lead      = (biased != 0);
+  int         exponent  = 0;
+  int         n_digits  = 13;
+  char        prefix[3];
+  size_t      prefix_len = 0;
+  char        digits[13];
+  char        ebuf[8];
+  char       *estr;
+  size_t      elen;
+  size_t      len;
+  int         i;
+  
+  if (biased != 0) {
+    exponent = biased - 1023;
+  } else if (mantissa != 0) {
+    exponent = -1022;
+  }
+  
+  if (precision >= 0 && precision < 13) {
+    int       shift = (13 - precision) * 4;
+    uint64_t  rest  = mantissa & (((uint64_t) 1 << shift) - 1);
+    uint64_t  half  = (uint64_t) 1 << (shift - 1);
+    
+    /* round half to even on the last digit kept */
+    mantissa >>= shift;
+    if (rest > half ||
+        (rest == half && ((precision > 0) ? (mantissa & 1) : (lead & 1)))) {
+      mantissa++;
+      if (mantissa >> (precision * 4)) {
+        mantissa = 0;
+        lead++;
+      }
+    }
+    mantissa <<= shift;
+    n_digits = precision;
+  } else if (precision < 0) {
+    /* as many digits as needed */
+    while (n_digits > 0 && ((mantissa >> ((13 - n_digits) * 4)) & 0xf) == 0) {
+      n_digits--;
+    }
+  }
+  for (i = 0; i < 13; i++) {
+    digits[i] = hex[(mantissa >> ((12 - i) * 4)) & 0xf];
+  }
+  
+  estr = format_decimal (&ebuf[sizeof ebuf],
+                         (uintmax_t) (exponent < 0 ? -exponent : exponent));
+  *--estr = (exponent < 0) ? '-' : '+';
+  *--estr = upper ? 'P' : 'p';
+  elen = (size_t) (&ebuf[sizeof ebuf] - estr);
+  
+  if (sign) {
+    prefix[prefix_len++] = *sign;
+  }
+  prefix[prefix_len++] = '0';
+  prefix[prefix_len++] = upper ? 'X' : 'x';
+  
+  len = prefix_len + 1 + elen;
+  if (precision > 0 || (precision < 0 && n_digits > 0) ||
+      (flags & FORMAT_ALT)) {
+    len += 1 + (size_t) ((precision > n_digits) ? precision : n_digits);
+  }
+  format_pad_begin (out, flags, width, len, prefix, prefix_len);
+  format_out (out, &hex[lead], 1);
+  if (precision > 0 || (precision < 0 && n_digits > 0) ||
+      (flags & FORMAT_ALT)) {
+    format_out (out, ".", 1);
+    format_out (out, digits, (size_t) (n_digits < 13 ? n_digits : 13));
+    if (precision > 13) {
+      format_fill (out, '0', (size_t) (precision - 13));
+    }
+  }
+  format_out (out, estr, elen);
+  format_pad_end (out, flags, width, len);
+}
+
+/*
+ * The decimal conversions of format_float() are derived from fmt_fp() of the
+ * musl C library (src/stdio/vfprintf.c), distributed under the following
+ * terms:
+ * 
+ * Copyright (C) 2005-2020 Rich Felker, et al.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * format_float:
+ * @out: The output state
+ * @flags: The conversion flags
+ * @width: The minimum field width
+ * @precision: The precision, or -1 for the default
+ * @conversion: The conversion, one of f, F, e, E, g, G, a or A
+ * @value: The value to output
+ * 
+ * Outputs a floating point field.  The decimal conversions expand the value
+ * exactly in base 10^9 words and round it half to even, so the output is
+ * correctly rounded and doesn't depend on the floating point environment nor
+ * on the locale: the decimal point is always a dot.
+ */
+static void
+format_float (struct _MIOFormatOut *out,
+              unsigned int          flags,
+              int                   width,
+              int                   precision,
+              char                  conversion,
+              double                value)
+{
+  uint32_t    big[FORMAT_BIG_SIZE];
+  uint32_t   *a, *d, *r, *z;
+  uint64_t    bits;
+  const char *sign  = NULL;
+  int         upper = ! (conversion & 32);
+  char        style = (char) (conversion | 32);
+  char        buf[9];
+  char        ebuf[16];
+  char       *estr  = &ebuf[sizeof ebuf];
+  int         e2    = 0;
+  int         e;
+  int         i;
+  int         j;
+  int         p     = precision;
+  size_t      len;
+  double      y;
+  
+  memcpy (&bits, &value, sizeof bits);
+  if (bits >> 63) {
+    sign = "-";
+    value = -value;
+  } else if (flags & FORMAT_PLUS) {
+    sign = "+";
+  } else if (flags & FORMAT_SPACE) {
+    sign = " ";
+  }
+  
+  if (value != value || value - value != 0) {
+    const char *s;
+    
+    if (value != value) {
+      s = upper ? "NAN" : "nan";
+    } else {
+      s = upper ? "INF" : "inf";
+    }
+    flags &= ~FORMAT_ZERO;
+    len = (sign ? 1 : 0) + 3;
+    format_pad_begin (out, flags, width, len, sign, sign ? 1 : 0);
+    format_out (out, s, 3);
+    format_pad_end (out, flags, width, len);
+    return;
+  }
+  
+  if (style == 'a') {
+    memcpy (&bits, &value, sizeof bits);
+    format_hex_float (out, flags, width, precision, upper, sign, bits);
+    return;
+  }
+  
+  if (p < 0) {
+    p = 6;
+  }
+  
+  y = value;
+  if (y != 0) {
+    /* get a value in [2^28, 2^29) and its binary exponent */
+    y = format_frexp (y, &e2) * 536870912.0;
+    e2 -= 29;
+  }
+  
+  /* the digits go in [a, z), with r being the word holding the units, and are
+   * converted exactly: each step of the first loop only has a few fractional
+   * bits left to multiply by 10^9 */
+  if (e2 < 0) {
+    a = r = z = big;
+  } else {
+    a = r = z = big + FORMAT_BIG_SIZE - DBL_MANT_DIG - 1;
+  }
+  do {
+    *z = (uint32_t) y;
+    y = 1000000000 * (y - *z++);
+  } while (y != 0);
+  
+  /* apply the binary exponent, multiplying... */
+  while (e2 > 0) {
+    uint32_t  carry = 0;
+    int       sh    = (e2 < 29) ? e2 : 29;
+    
+    for (d = z - 1; d >= a; d--) {
+      uint64_t x = ((uint64_t) *d << sh) + carry;
+      
+      *d = (uint32_t) (x % 1000000000);
+      carry = (uint32_t) (x / 1000000000);
+    }
+    if (carry) {
+      *--a = carry;
+    }
+    while (z > a && ! z[-1]) {
+      z--;
+    }
+    e2 -= sh;
+  }
+  /* ...or dividing, stopping past the requested precision */
+  while (e2 < 0) {
+    uint32_t  carry = 0;
+    uint32_t *b;
+    int       sh    = (-e2 < 9) ? -e2 : 9;
+    int       need  = 1 + (p + DBL_MANT_DIG / 3 + 8) / 9;
+    
+    for (d = a; d < z; d++) {
+      uint32_t rm = *d & ((1u << sh) - 1);
+      
+      *d = (*d >> sh) + carry;
+      carry = (1000000000u >> sh) * rm;
+    }
+    if (! *a) {
+      a++;
+    }
+    if (carry) {
+      *z++ = carry;
+    }
+    b = (style == 'f') ? r : a;
+    if (z - b > need) {
+      z = b + need;
+    }
+    e2 += sh;
+  }
+  
+  /* decimal exponent */
+  e = 0;
+  if (a < z) {
+    for (i = 10, e = (int) (9 * (r - a)); *a >= (uint32_t) i; i *= 10, e++);
+  }
+  
+  /* round to the requested precision, j being the number of digits to keep
+   * after the point (possibly negative) */
+  j = p - ((style != 'f') ? e : 0) - ((style == 'g' && p) ? 1 : 0);
+  if (j < 9 * (z - r - 1)) {
+    uint32_t x;
+    
+    d = r + 1 + ((j + 9 * DBL_MAX_EXP) / 9 - DBL_MAX_EXP);
+    j += 9 * DBL_MAX_EXP;
+    j %= 9;
+    for (i = 10, j++; j < 9; i *= 10, j++);
+    x = *d % (uint32_t) i;
+    if (x || d + 1 != z) {
+      int odd = ((*d / (uint32_t) i) & 1) ||
+                (i == 1000000000 && d > a && (d[-1] & 1));
+      
+      *d -= x;
+      if (x > (uint32_t) i / 2 ||
+          (x == (uint32_t) i / 2 && (d + 1 != z || odd))) {
+        *d += (uint32_t) i;
+        while (*d > 999999999) {
+          *d-- = 0;
+          if (d < a) {
+            *--a = 0;
+          }
+          (*d)++;
+        }
+        for (i = 10, e = (int) (9 * (r - a)); *a >= (uint32_t) i;
+             i *= 10, e++);
+      }
+    }
+    if (z > d + 1) {
+      z = d + 1;
+    }
+  }
+  while (z > a && ! z[-1]) {
+    z--;
+  }
+  
+  if (style == 'g') {
+    if (! p) {
+      p++;
+    }
+    if (p > e && e >= -4) {
+      style = 'f';
+      p -= e + 1;
+    } else {
+      style = 'e';
+      p--;
+    }
+    if (! (flags & FORMAT_ALT)) {
+      /* drop the trailing zeros */
+      if (z > a && z[-1]) {
+        for (i = 10, j = 0; z[-1] % (uint32_t) i == 0; i *= 10, j++);
+      } else {
+        j = 9;
+      }
+      if (style == 'f') {
+        i = (int) (9 * (z - r - 1)) - j;
+      } else {
+        i = (int) (9 * (z - r - 1)) + e - j;
+      }
+      if (p > i) {
+        p = (i > 0) ? i : 0;
+      }
+    }
+  }
+  
+  len = 1 + (size_t) p + ((p || (flags & FORMAT_ALT)) ? 1 : 0);
+  if (style == 'f') {
+    if (e > 0) {
+      len += (size_t) e;
+    }
+  } else {
+    estr = format_decimal (estr, (uintmax_t) (e < 0 ? -e : e));
+    if (&ebuf[sizeof ebuf] - estr < 2) {
+      *--estr = '0';
+    }
+    *--estr = (e < 0) ? '-' : '+';
+    *--estr = upper ? 'E' : 'e';
+    len += (size_t) (&ebuf[sizeof ebuf] - estr);
+  }
+  len += sign ? 1 : 0;
+  
+  format_pad_begin (out, flags, width, len, sign, sign ? 1 : 0);
+  if (style == 'f') {
+    if (a > r) {
+      a = r;
+    }
+    for (d = a; d <= r; d++) {
+      char *s = buf;
+      
+      format_word (buf, *d);
+      if (d == a) {
+        while (s < &buf[8] && *s == '0') {
+          s++;
+        }
+      }
+      format_out (out, s, (size_t) (&buf[9] - s));
+    }
+    if (p || (flags & FORMAT_ALT)) {
+      format_out (out, ".", 1);
+    }
+    for (; d < z && p > 0; d++, p -= 9) {
+      format_word (buf, *d);
+      format_out (out, buf, (size_t) ((p < 9) ? p : 9));
+    }
+    if (p > 0) {
+      format_fill (out, '0', (size_t) p);
+    }
+  } else {
+    if (z <= a) {
+      z = a + 1;
+    }
+    for (d = a; d < z && p >= 0; d++) {
+      char *s = buf;
+      int   n;
+      
+      format_word (buf, *d);
+      if (d == a) {
+        while (s < &buf[8] && *s == '0') {
+          s++;
+        }
+        format_out (out, s++, 1);
+        if (p > 0 || (flags & FORMAT_ALT)) {
+          format_out (out, ".", 1);
+        }
+      }
+      n = (int) (&buf[9] - s);
+      format_out (out, s, (size_t) ((n < p) ? n : p));
+      p -= n;
+    }
+    if (p > 0) {
+      format_fill (out, '0', (size_t) p);
+    }
+    format_out (out, estr, (size_t) (&ebuf[sizeof ebuf] - estr));
+  }
+  format_pad_end (out, flags, width, len);
+}
+
+/*
+ * format_float_buffer:
+ * @buf: The buffer to fill
+ * @precision: The precision, at most 17
+ * @conversion: The conversion, one of e, E, g or G
+ * @value: The value to format
+ * 
+ * Formats a floating point value into @buf instead of a stream, without flags
+ * nor width, e.g. to check the output before writing it.
+ * 
+ * Returns: The length of the output, which is not nul-terminated.
+ */
+static size_t
+format_float_buffer (char   buf[FORMAT_FLOAT_BUFFER_SIZE],
+                     int    precision,
+                     char   conversion,
+                     double value)
+{
+  MIO                   mio;
+  struct _MIOFormatOut  out;
+  
+  /* a write window over the buffer is all format_out() needs, and the output
+   * always fits in it */
+  memset (&mio, 0, sizeof mio);
+  mio.write_ptr = (unsigned char *) buf;
+  mio.write_end = (unsigned char *) buf + FORMAT_FLOAT_BUFFER_SIZE;
+  out.mio = &mio;
+  out.len = 0;
+  out.error = FALSE;
+  format_float (&out, 0, 0, precision, conversion, value);
+  
+  return out.len;
+}
+
+/*
+ * format_parse_spec:
+ * @format: The format, just after the %
+ * @spec: Return location for the parsed specification
+ * 
+ * Parses a conversion specification.  Positional arguments, wide characters
+ * and strings are not supported.
+ * 
+ * Returns: The end of the specification, or %NULL if it is invalid, in which
+ *          case errno is set to indicate the error.
+ */
+static const char *
+format_parse_spec (const char            *format,
+                   struct _MIOFormatSpec *spec)
+{
+  const char *p     = format;
+  int         valid = TRUE;
+  
+  spec->flags = 0;
+  spec->width = 0;
+  spec->precision = -1;
+  spec->length = FORMAT_LENGTH_NONE;
+  spec->conversion = 0;
+  
+  /* the ' flag (digit grouping) is accepted but never does anything in the
+   * C locale */
+  for (;; p++) {
+    switch (*p) {
+      case '-':   spec->flags |= FORMAT_LEFT;   continue;
+      case '+':   spec->flags |= FORMAT_PLUS;   continue;
+      case ' ':   spec->flags |= FORMAT_SPACE;  continue;
+      case '#':   spec->flags |= FORMAT_ALT;    continue;
+      case '0':   spec->flags |= FORMAT_ZERO;   continue;
+      case '\'':                                continue;
+    }
+    break;
+  }
+  
+  if (*p == '*') {
+    spec->width = FORMAT_ARG;
+    p++;
+  } else {
+    for (; *p >= '0' && *p <= '9'; p++) {
+      if (spec->width > (INT_MAX - (*p - '0')) / 10) {
+        valid = FALSE;
+      } else {
+        spec->width = spec->width * 10 + (*p - '0');
+      }
+    }
+  }
+  if (*p == '.') {
+    p++;
+    spec->precision = 0;
+    if (*p == '*') {
+      spec->precision = FORMAT_ARG;
+      p++;
+    } else {
+      for (; *p >= '0' && *p <= '9'; p++) {
+        if (spec->precision > (INT_MAX - (*p - '0')) / 10) {
+          valid = FALSE;
+        } else {
+          spec->precision = spec->precision * 10 + (*p - '0');
+        }
+      }
+    }
+  }
+  
+  switch (*p) {
+    case 'h':
+      p++;
+      spec->length = FORMAT_LENGTH_H;
+      if (*p == 'h') {
+        p++;
+        spec->length = FORMAT_LENGTH_HH;
+      }
+      break;
+    case 'l':
+      p++;
+      spec->length = FORMAT_LENGTH_L;
+      if (*p == 'l') {
+        p++;
+        spec->length = FORMAT_LENGTH_LL;
+      }
+      break;
+    case 'j': p++; spec->length = FORMAT_LENGTH_J; break;
+    case 'z': p++; spec->length = FORMAT_LENGTH_Z; break;
+    case 't': p++; spec->length = FORMAT_LENGTH_T; break;
+    case 'L': p++; spec->length = FORMAT_LENGTH_LONG_DOUBLE; break;
+  }
+  
+  spec->conversion = *p;
+  if (! valid) {
+    #ifdef EOVERFLOW
+    errno = EOVERFLOW;
+    #endif
+    p = NULL;
+  } else {
+    switch (*p) {
+      case 'c': case 's':
+        /* no wide characters nor strings */
+        valid = (spec->length == FORMAT_LENGTH_NONE);
+        break;
+      
+      case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'p':
+      case 'n': case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+      case 'a': case 'A': case '%':
+        break;
+      
+      default:
+        valid = FALSE;
+        break;
+    }
+    if (! valid) {
+      errno = EINVAL;
+      p = NULL;
+    } else {
+      p++;
+    }
+  }
+  
+  return p;
+}
+
+/*
+ * format_spec:
+ * @out: The output state
+ * @spec: The conversion specification
+ * @ap: The arguments
+ * 
+ * Outputs a conversion, fetching its arguments from @ap.
+ */
+static void
+format_spec (struct _MIOFormatOut        *out,
+             const struct _MIOFormatSpec *spec,
+             va_list                     *ap)
+{
+  unsigned int  flags     = spec->flags;
+  int           width     = spec->width;
+  int           precision = spec->precision;
+  
+  if (width == FORMAT_ARG) {
+    width = va_arg (*ap, int);
+    if (width < 0) {
+      flags |= FORMAT_LEFT;
+      width = (width == INT_MIN) ? INT_MAX : -width;
+    }
+  }
+  if (precision == FORMAT_ARG) {
+    precision = va_arg (*ap, int);
+    if (precision < 0) {
+      precision = -1;
+    }
+  }
+  if (flags & FORMAT_LEFT) {
+    flags &= ~FORMAT_ZERO;
+  }
+  
+  switch (spec->conversion) {
+    case 'd':
+    case 'i': {
+      intmax_t v;
+      
+      switch (spec->length) {
+        case FORMAT_LENGTH_HH:  v = (signed char) va_arg (*ap, int);  break;
+        case FORMAT_LENGTH_H:   v = (short) va_arg (*ap, int);        break;
+        case FORMAT_LENGTH_L:   v = va_arg (*ap, long);               break;
+        case FORMAT_LENGTH_LL:  v = va_arg (*ap, long long);          break;
+        case FORMAT_LENGTH_J:   v = va_arg (*ap, intmax_t);           break;
+        case FORMAT_LENGTH_Z:   v = va_arg (*ap, ssize_t);            break;
+        case FORMAT_LENGTH_T:   v = va_arg (*ap, ptrdiff_t);          break;
+        default:                v = va_arg (*ap, int);                break;
+      }
+      /* negate as unsigned so that the most negative value doesn't overflow */
+      format_integer (out, flags, width, precision, 'd',
+                      (v < 0) ? 0 - (uintmax_t) v : (uintmax_t) v, v < 0);
+      break;
+    }
+    
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X': {
+      uintmax_t v;
+      
+      switch (spec->length) {
+        case FORMAT_LENGTH_HH:
+          v = (unsigned char) va_arg (*ap, unsigned int);
+          break;
+        case FORMAT_LENGTH_H:
+          v = (unsigned short) va_arg (*ap, unsigned int);
+          break;
+        case FORMAT_LENGTH_L:
+          v = va_arg (*ap, unsigned long);
+          break;
+        case FORMAT_LENGTH_LL:
+          v = va_arg (*ap, unsigned long long);
+          break;
+        case FORMAT_LENGTH_J:
+          v = va_arg (*ap, uintmax_t);
+          break;
+        case FORMAT_LENGTH_Z:
+          v = va_arg (*ap, size_t);
+          break;
+        case FORMAT_LENGTH_T:
+          v = (size_t) va_arg (*ap, ptrdiff_t);
+          break;
+        default:
+          v = va_arg (*ap, unsigned int);
+          break;
+      }
+      format_integer (out, flags, width, precision, spec->conversion, v, FALSE);
+      break;
+    }
+    
+    case 'p': {
+      void *ptr = va_arg (*ap, void *);
+      
+      if (ptr) {
+        format_integer (out, flags | FORMAT_ALT, width, precision, 'p',
+                        (uintmax_t) (uintptr_t) ptr, FALSE);
+      } else {
+        format_string (out, flags, width, "(nil)", 5);
+      }
+      break;
+    }
+    
+    case 'c': {
+      char c = (char) va_arg (*ap, int);
+      
+      format_string (out, flags, width, &c, 1);
+      break;
+    }
+    
+    case 's': {
+      const char *s = va_arg (*ap, const char *);
+      size_t      n;
+      
+      if (! s) {
+        s = (precision < 0 || precision >= 6) ? "(null)" : "";
+      }
+      if (precision < 0) {
+        n = strlen (s);
+      } else {
+        const char *nul = memchr (s, 0, (size_t) precision);
+        
+        n = nul ? (size_t) (nul - s) : (size_t) precision;
+      }
+      format_string (out, flags, width, s, n);
+      break;
+    }
+    
+    case 'n':
+      switch (spec->length) {
+        case FORMAT_LENGTH_HH:
+          *va_arg (*ap, signed char *) = (signed char) out->len;
+          break;
+        case FORMAT_LENGTH_H:
+          *va_arg (*ap, short *) = (short) out->len;
+          break;
+        case FORMAT_LENGTH_L:
+          *va_arg (*ap, long *) = (long) out->len;
+          break;
+        case FORMAT_LENGTH_LL:
+          *va_arg (*ap, long long *) = (long long) out->len;
+          break;
+        case FORMAT_LENGTH_J:
+          *va_arg (*ap, intmax_t *) = (intmax_t) out->len;
+          break;
+        case FORMAT_LENGTH_Z:
+          *va_arg (*ap, ssize_t *) = (ssize_t) out->len;
+          break;
+        case FORMAT_LENGTH_T:
+          *va_arg (*ap, ptrdiff_t *) = (ptrdiff_t) out->len;
+          break;
+        default:
+          *va_arg (*ap, int *) = (int) out->len;
+          break;
+      }
+      break;
+    
+    case '%':
+      format_out (out, "%", 1);
+      break;
+    
+    default: {
+      double v;
+      
+      /* long doubles are only printed with the precision of a double */
+      if (spec->length == FORMAT_LENGTH_LONG_DOUBLE) {
+        v = (double) va_arg (*ap, long double);
+      } else {
+        v = va_arg (*ap, double);
+      }
+      format_float (out, flags, width, precision, spec->conversion, v);
+      break;
+    }
+  }
+}
+
+/* gives the return value of a printf function */
+static int
+format_finish (struct _MIOFormatOut *out)
+{
+  if (! out->error && out->len > INT_MAX) {
+    #ifdef EOVERFLOW
+    errno = EOVERFLOW;
+    #endif
+    out->error = TRUE;
+  }
+  
+  return out->error ? -1 : (int) out->len;
+}
+
+/*
+ * format_vprintf:
+ * @mio: A #MIO object
+ * @format: A printf format string
+ * @ap: The arguments of the format
+ * 
+ * Writes a formatted string at the current position of @mio, without going
+ * through the C library's printf.  The output is written right into the
+ * stream's write window, re-opened with the backend's reserve() whenever it
+ * is full, so the backends using this must implement reserve() and commit().
+ * 
+ * The output doesn't depend on the current locale, and is the one C99 gives
+ * in the C locale for all its conversions but wide characters and strings.
+ * Positional arguments are not supported either.
+ * 
+ * Returns: The number of bytes written, or -1 on failure, in which case errno
+ *          is set to indicate the error.
+ */
+__attribute__((__format__ (__printf__, 2, 0)))
+static int
+format_vprintf (MIO        *mio,
+                const char *format,
+                va_list     ap)
+{
+  struct _MIOFormatOut  out;
+  const char           *p = format;
+  va_list               args;
+  
+  out.mio = mio;
+  out.len = 0;
+  out.error = FALSE;
+
+#ifndef HAVE_GLIB
+  va_copy (args, ap);
+#else
+  G_VA_COPY (args, ap);
+#endif
+  while (*p && ! out.error) {
+    const char *percent = strchr (p, '%');
+    
+    if (! percent) {
+      format_out (&out, p, strlen (p));
+      break;
+    } else {
+      struct _MIOFormatSpec spec;
+      
+      format_out (&out, p, (size_t) (percent - p));
+      p = format_parse_spec (percent + 1, &spec);
+      if (! p) {
+        out.error = TRUE;
+      } else {
+        format_spec (&out, &spec, &args);
+      }
+    }
+  }
+  va_end (args);
+  
+  return format_finish (&out);
+}
+
+/*
+ * format_compile_pass:
+ * @format: A printf format string
+ * @ops: Operations to fill, or %NULL to only count them
+ * @literals: Buffer to fill with the literal text, if @ops is not %NULL
+ * @n_ops: Return location for the number of operations
+ * @literals_len: Return location for the length of the literal text
+ * 
+ * Splits @format into operations, each of them being some literal text
+ * followed by a conversion.  The last operation holds the trailing text and no
+ * conversion.  %% is merged into the literal text.
+ * 
+ * Returns: %TRUE on success, %FALSE if the format is invalid, in which case
+ *          errno is set to indicate the error.
+ */
+static int
+format_compile_pass (const char          *format,
+                     struct _MIOFormatOp *ops,
+                     char                *literals,
+                     size_t              *n_ops,
+                     size_t              *literals_len)
+{
+  const char  *p        = format;
+  size_t       n        = 0;
+  size_t       len      = 0;
+  size_t       op_start = 0;
+  int          success  = TRUE;
+  
+  while (success && *p) {
+    const char            *percent = strchr (p, '%');
+    size_t                 text;
+    struct _MIOFormatSpec  spec;
+    
+    text = percent ? (size_t) (percent - p) : strlen (p);
+    if (ops) {
+      memcpy (&literals[len], p, text);
+    }
+    len += text;
+    if (! percent) {
+      break;
+    }
+    p = format_parse_spec (percent + 1, &spec);
+    if (! p) {
+      success = FALSE;
+    } else if (spec.conversion == '%') {
+      if (ops) {
+        literals[len] = '%';
+      }
+      len++;
+    } else {
+      if (ops) {
+        ops[n].literal = &literals[op_start];
+        ops[n].literal_len = len - op_start;
+        ops[n].spec = spec;
+      }
+      n++;
+      op_start = len;
+    }
+  }
+  if (ops && success) {
+    ops[n].literal = &literals[op_start];
+    ops[n].literal_len = len - op_start;
+    ops[n].spec.conversion = 0;
+  }
+  *n_ops = n + 1;
+  *literals_len = len;
+  
+  return success;
+}
+
+/*
+ * format_compile:
+ * @format: A printf format string
+ * 
+ * Compiles @format for format_vprintf_compiled().  The result is a single
+ * allocation holding the operations and a copy of the literal text, to be
+ * freed with free().
+ * 
+ * Returns: The compiled format, or %NULL on failure, in which case errno is set
+ *          to indicate the error.
+ */
+static MIOFormat *
+format_compile (const char *format)
+{
+  MIOFormat  *compiled  = NULL;
+  size_t      n_ops;
+  size_t      len;
+  
+  if (format_compile_pass (format, NULL, NULL, &n_ops, &len)) {
+    if (n_ops > (((size_t) -1) - sizeof *compiled - len) /
+                sizeof *compiled->ops) {
+      errno = ENOMEM;
+    } else {
+      compiled = malloc (sizeof *compiled + n_ops * sizeof *compiled->ops +
+                         len);
+      if (! compiled) {
+        errno = ENOMEM;
+      } else {
+        compiled->ops = (struct _MIOFormatOp *) (compiled + 1);
+        compiled->n_ops = n_ops;
+        format_compile_pass (format, compiled->ops,
+                             (char *) &compiled->ops[n_ops], &n_ops, &len);
+      }
+    }
+  }
+  
+  return compiled;
+}
+
+/*
+ * format_vprintf_compiled:
+ * @mio: A #MIO object
+ * @format: A format compiled with format_compile()
+ * @ap: The arguments of the format
+ * 
+ * Same as format_vprintf(), but without having to parse the format.
+ * 
+ * Returns: The number of bytes written, or -1 on failure, in which case errno
+ *          is set to indicate the error.
+ */
+static int
+format_vprintf_compiled (MIO             *mio,
+                         const MIOFormat *format,
+                         va_list          ap)
+{
+  struct _MIOFormatOut  out;
+  size_t                i;
+  va_list               args;
+  
+  out.mio = mio;
+  out.len = 0;
+  out.error = FALSE;
+
+#ifndef HAVE_GLIB
+  va_copy (args, ap);
+#else
+  G_VA_COPY (args, ap);
+#endif
+  for (i = 0; i < format->n_ops && ! out.error; i++) {
+    const struct _MIOFormatOp *op = &format->ops[i];
+    
+    format_out (&out, op->literal, op->literal_len);
+    if (op->spec.conversion) {
+      format_spec (&out, &op->spec, &args);
+    }
+  }
+  va_end (args);
+  
+  return format_finish (&out);
+}
@@ -0,0 +1,692 @@
+/*
+ *  MIO, an I/O abstraction layer replicating C file I/O API.
+ *  Copyright (C) 2010  Colomban Wendling <ban@herbesfolles.org>
+ * 
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ * 
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ * 
+ */
+
+/* slice IO implementation, reading a range of another stream */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mio.h"
+
+#ifndef TRUE
+# define TRUE 1
+#endif
+#ifndef FALSE
+# define FALSE 0
+#endif
+
+
+#define SLICE_SET_VTABLE(mio)         \
+  do {                                \
+    mio->v_free     = slice_free;     \
+    mio->v_read     = slice_read;     \
+    mio->v_write    = slice_write;    \
+    mio->v_getc     = slice_getc;     \
+    mio->v_gets     = slice_gets;     \
+    mio->v_ungetc   = slice_ungetc;   \
+    mio->v_putc     = slice_putc;     \
+    mio->v_puts     = slice_puts;     \
+    mio->v_vprintf  = slice_vprintf;  \
+    mio->v_clearerr = slice_clearerr; \
+    mio->v_eof      = slice_eof;      \
+    mio->v_error    = slice_error;    \
+    mio->v_seek     = slice_seek;     \
+    mio->v_tell     = slice_tell;     \
+    mio->v_rewind   = slice_rewind;   \
+    mio->v_getpos   = slice_getpos;   \
+    mio->v_setpos   = slice_setpos;   \
+    mio->v_peek     = slice_peek;     \
+    mio->v_consume  = slice_consume;  \
+    mio->v_reserve  = slice_reserve;  \
+    mio->v_commit   = slice_commit;   \
+    mio->v_pread    = slice_pread;    \
+    mio->v_pwrite   = slice_pwrite;   \
+    mio->v_readv    = slice_readv;    \
+    mio->v_writev   = slice_writev;   \
+    mio->v_mark     = slice_mark;     \
+    mio->v_reset    = slice_reset;    \
+  } while (0)
+
+/* size of the internal buffer */
+#define MIO_SLICE_BUFFER_SIZE BUFSIZ
+
+/*
+ * The buffer holds @len bytes of the slice starting at @buf_offset, both
+ * relative to the start of the slice.  Data is only ever read from the parent
+ * with mio_pread(), so the parent's cursor is never moved.
+ */
+
+
+/*
+ * slice_sync:
+ * @mio: A #MIO object of the type %MIO_TYPE_SLICE
+ * 
+ * Folds the read window back into the stream's position, and closes it.  This
+ * must be called before looking at the stream's position.
+ */
+static void
+slice_sync (MIO *mio)
+{
+  if (mio->read_ptr) {
+    mio->impl.slice.pos = mio->impl.slice.buf_offset +
+                          (off_t) (mio->read_ptr - mio->impl.slice.buf);
+    mio->read_ptr = NULL;
+    mio->read_end = NULL;
+  }
+}
+
+/*
+ * slice_fill:
+ * @mio: A #MIO object of the type %MIO_TYPE_SLICE
+ * 
+ * Opens the read window at the current position, reading from the parent if
+ * the buffer doesn't already hold it.  The stream must be synchronized, and no
+ * character must be pushed back.  If the parent turns out to end before the
+ * slice, the slice is shortened accordingly.
+ * 
+ * Returns: The number of bytes available in the read window.
+ */
+static size_t
+slice_fill (MIO *mio)
+{
+  size_t  n   = 0;
+  off_t   pos = mio->impl.slice.pos;
+  
+  if (pos >= 0 && pos < mio->impl.slice.size) {
+    if (pos < mio->impl.slice.buf_offset ||
+        pos - mio->impl.slice.buf_offset >= (off_t) mio->impl.slice.len) {
+      size_t  count = mio->impl.slice.buf_size;
+      ssize_t rv;
+      
+      if ((off_t) count > mio->impl.slice.size - pos) {
+        count = (size_t) (mio->impl.slice.size - pos);
+      }
+      mio->impl.slice.buf_offset = pos;
+      mio->impl.slice.len = 0;
+      rv = mio_pread (mio->impl.slice.parent, mio->impl.slice.buf, count,
+                      mio->impl.slice.base + pos);
+      if (rv < 0) {
+        mio->impl.slice.error = TRUE;
+      } else if (rv == 0) {
+        /* the parent is shorter than expected */
+        mio->impl.slice.size = pos;
+      } else {
+        mio->impl.slice.len = (size_t) rv;
+      }
+    }
+    if (pos - mio->impl.slice.buf_offset < (off_t) mio->impl.slice.len) {
+      mio->read_ptr = mio->impl.slice.buf +
+                      (pos - mio->impl.slice.buf_offset);
+      mio->read_end = mio->impl.slice.buf + mio->impl.slice.len;
+      n = (size_t) (mio->read_end - mio->read_ptr);
+    }
+  }
+  
+  return n;
+}
+
+/*
+ * slice_open:
+ * @mio: A #MIO object
+ * @parent: The stream to read from
+ * @offset: Position of the slice in @parent
+ * @length: Length of the slice
+ * 
+ * Initializes @mio to work on a range of @parent.  The first chunk is read
+ * right away, so that a parent not supporting positional reads is reported
+ * early.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static int
+slice_open (MIO  *mio,
+            MIO  *parent,
+            off_t offset,
+            off_t length)
+{
+  int     success = FALSE;
+  size_t  size    = MIO_SLICE_BUFFER_SIZE;
+  
+  if ((off_t) size > length) {
+    size = (length > 0) ? (size_t) length : 1;
+  }
+  mio->impl.slice.buf = malloc (size);
+  if (! mio->impl.slice.buf) {
+    errno = ENOMEM;
+  } else {
+    mio->impl.slice.parent = parent;
+    mio->impl.slice.base = offset;
+    mio->impl.slice.size = length;
+    mio->impl.slice.pos = 0;
+    mio->impl.slice.buf_size = size;
+    mio->impl.slice.buf_offset = 0;
+    mio->impl.slice.len = 0;
+    mio->impl.slice.ungetch = EOF;
+    mio->impl.slice.error = FALSE;
+    mio->impl.slice.eof = FALSE;
+    slice_fill (mio);
+    slice_sync (mio);
+    if (mio->impl.slice.error) {
+      int errnum = errno;
+      
+      free (mio->impl.slice.buf);
+      mio->impl.slice.buf = NULL;
+      errno = errnum;
+    } else {
+      success = TRUE;
+    }
+  }
+  
+  return success;
+}
+
+static void
+slice_free (MIO *mio)
+{
+  slice_sync (mio);
+  free (mio->impl.slice.buf);
+  mio->impl.slice.buf = NULL;
+  mio->impl.slice.parent = NULL;
+  mio->impl.slice.size = 0;
+  mio->impl.slice.pos = 0;
+}
+
+static size_t
+slice_read (MIO    *mio,
+            void   *ptr_,
+            size_t  size,
+            size_t  nmemb)
+{
+  size_t n_read = 0;
+  
+  slice_sync (mio);
+  if (size != 0 && nmemb != 0) {
+    size_t          n     = size * nmemb;
+    size_t          got   = 0;
+    unsigned char  *ptr   = ptr_;
+    
+    if (mio->impl.slice.ungetch != EOF) {
+      *ptr = (unsigned char) mio->impl.slice.ungetch;
+      mio->impl.slice.ungetch = EOF;
+      mio->impl.slice.pos++;
+      got++;
+    }
+    if (n - got >= mio->impl.slice.buf_size && mio->impl.slice.pos >= 0 &&
+        (mio->impl.slice.pos < mio->impl.slice.buf_offset ||
+         mio->impl.slice.pos - mio->impl.slice.buf_offset >=
+         (off_t) mio->impl.slice.len)) {
+      /* big read outside of the buffer, read straight into the caller's */
+      while (got < n && mio->impl.slice.pos < mio->impl.slice.size) {
+        size_t  count = n - got;
+        ssize_t rv;
+        
+        if ((off_t) count > mio->impl.slice.size - mio->impl.slice.pos) {
+          count = (size_t) (mio->impl.slice.size - mio->impl.slice.pos);
+        }
+        rv = mio_pread (mio->impl.slice.parent, &ptr[got], count,
+                        mio->impl.slice.base + mio->impl.slice.pos);
+        if (rv < 0) {
+          mio->impl.slice.error = TRUE;
+          break;
+        } else if (rv == 0) {
+          mio->impl.slice.size = mio->impl.slice.pos;
+        } else {
+          mio->impl.slice.pos += (off_t) rv;
+          got += (size_t) rv;
+        }
+      }
+    }
+    while (got < n) {
+      size_t avail = slice_fill (mio);
+      
+      if (avail == 0) {
+        break;
+      }
+      if (avail > n - got) {
+        avail = n - got;
+      }
+      memcpy (&ptr[got], mio->read_ptr, avail);
+      mio->read_ptr += avail;
+      slice_sync (mio);
+      got += avail;
+    }
+    if (mio->impl.slice.pos >= mio->impl.slice.size) {
+      mio->impl.slice.eof = TRUE;
+    }
+    n_read = got / size;
+  }
+  
+  return n_read;
+}
+
+static size_t
+slice_write (MIO         *mio,
+             const void  *ptr,
+             size_t       size,
+             size_t       nmemb)
+{
+  mio->impl.slice.error = TRUE;
+  errno = EBADF;
+  
+  return 0;
+}
+
+static int
+slice_putc (MIO  *mio,
+            int   c)
+{
+  mio->impl.slice.error = TRUE;
+  errno = EBADF;
+  
+  return EOF;
+}
+
+static int
+slice_puts (MIO        *mio,
+            const char *s)
+{
+  mio->impl.slice.error = TRUE;
+  errno = EBADF;
+  
+  return EOF;
+}
+
+__attribute__((__format__ (__printf__, 2, 0)))
+static int
+slice_vprintf (MIO         *mio,
+               const char  *format,
+               va_list      ap)
+{
+  mio->impl.slice.error = TRUE;
+  errno = EBADF;
+  
+  return -1;
+}
+
+static int
+slice_getc (MIO *mio)
+{
+  int rv = EOF;
+  
+  slice_sync (mio);
+  if (mio->impl.slice.ungetch != EOF) {
+    rv = mio->impl.slice.ungetch;
+    mio->impl.slice.ungetch = EOF;
+    mio->impl.slice.pos++;
+  } else if (slice_fill (mio) > 0) {
+    rv = *mio->read_ptr++;
+  } else if (mio->impl.slice.pos >= mio->impl.slice.size) {
+    mio->impl.slice.eof = TRUE;
+  }
+  
+  return rv;
+}
+
+static int
+slice_ungetc (MIO  *mio,
+              int   ch)
+{
+  int rv = EOF;
+  
+  slice_sync (mio);
+  if (ch != EOF && mio->impl.slice.ungetch == EOF) {
+    rv = mio->impl.slice.ungetch = ch;
+    mio->impl.slice.pos--;
+    mio->impl.slice.eof = FALSE;
+  }
+  
+  return rv;
+}
+
+static char *
+slice_gets (MIO    *mio,
+            char   *s,
+            size_t  size)
+{
+  char *rv = NULL;
+  
+  slice_sync (mio);
+  if (size > 0) {
+    size_t i = 0;
+    
+    if (mio->impl.slice.ungetch != EOF && size > 1) {
+      s[i] = (char) mio->impl.slice.ungetch;
+      mio->impl.slice.ungetch = EOF;
+      mio->impl.slice.pos++;
+      i++;
+    }
+    while (i < size - 1 && (i == 0 || s[i - 1] != '\n')) {
+      size_t          n = slice_fill (mio);
+      unsigned char  *nl;
+      
+      if (n == 0) {
+        break;
+      }
+      if (n > size - 1 - i) {
+        n = size - 1 - i;
+      }
+      nl = memchr (mio->read_ptr, '\n', n);
+      if (nl) {
+        n = (size_t) (nl - mio->read_ptr) + 1;
+      }
+      memcpy (&s[i], mio->read_ptr, n);
+      mio->read_ptr += n;
+      slice_sync (mio);
+      i += n;
+    }
+    if (i > 0) {
+      s[i] = 0;
+      rv = s;
+    }
+    if (mio->impl.slice.pos >= mio->impl.slice.size) {
+      mio->impl.slice.eof = TRUE;
+    }
+  }
+  
+  return rv;
+}
+
+static void
+slice_clearerr (MIO *mio)
+{
+  mio->impl.slice.error = FALSE;
+  mio->impl.slice.eof = FALSE;
+}
+
+static int
+slice_eof (MIO *mio)
+{
+  return mio->impl.slice.eof != FALSE;
+}
+
+static int
+slice_error (MIO *mio)
+{
+  return mio->impl.slice.error != FALSE;
+}
+
+static int
+slice_seek (MIO  *mio,
+            long  offset,
+            int   whence)
+{
+  int   rv = -1;
+  off_t base;
+  
+  slice_sync (mio);
+  switch (whence) {
+    case SEEK_SET:  base = 0;                       break;
+    case SEEK_CUR:  base = mio->impl.slice.pos;     break;
+    case SEEK_END:  base = mio->impl.slice.size;    break;
+    default:        base = -1;                      break;
+  }
+  if (base < 0 ||
+      (offset < 0 && (off_t) -offset > base) ||
+      (offset > 0 && (off_t) offset > mio->impl.slice.size - base)) {
+    errno = EINVAL;
+  } else {
+    mio->impl.slice.pos = base + offset;
+    mio->impl.slice.eof = FALSE;
+    mio->impl.slice.ungetch = EOF;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static long
+slice_tell (MIO *mio)
+{
+  long rv = -1;
+  
+  slice_sync (mio);
+  if (mio->impl.slice.pos > LONG_MAX) {
+    #ifdef EOVERFLOW
+    errno = EOVERFLOW;
+    #endif
+  } else if (mio->impl.slice.pos < 0) {
+    /* this happens if ungetc() was called at the start of the stream */
+    #ifdef EIO
+    errno = EIO;
+    #endif
+  } else {
+    rv = (long) mio->impl.slice.pos;
+  }
+  
+  return rv;
+}
+
+static void
+slice_rewind (MIO *mio)
+{
+  slice_sync (mio);
+  mio->impl.slice.pos = 0;
+  mio->impl.slice.ungetch = EOF;
+  mio->impl.slice.eof = FALSE;
+  mio->impl.slice.error = FALSE;
+}
+
+static int
+slice_getpos (MIO    *mio,
+              MIOPos *pos)
+{
+  int rv = -1;
+  
+  slice_sync (mio);
+  if (mio->impl.slice.pos < 0) {
+    /* this happens if ungetc() was called at the start of the stream */
+    #ifdef EIO
+    errno = EIO;
+    #endif
+  } else {
+    pos->impl.slice = mio->impl.slice.pos;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static int
+slice_setpos (MIO    *mio,
+              MIOPos *pos)
+{
+  int rv = -1;
+  
+  slice_sync (mio);
+  if (pos->impl.slice > mio->impl.slice.size) {
+    errno = EINVAL;
+  } else {
+    mio->impl.slice.ungetch = EOF;
+    mio->impl.slice.pos = pos->impl.slice;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static const unsigned char *
+slice_peek (MIO    *mio,
+            size_t *avail)
+{
+  const unsigned char *ptr = NULL;
+  
+  slice_sync (mio);
+  *avail = 0;
+  if (mio->impl.slice.ungetch != EOF &&
+      mio->impl.slice.pos >= 0 && slice_fill (mio) > 0 &&
+      *mio->read_ptr == mio->impl.slice.ungetch) {
+    /* the pushed back character is the one in the parent, forget it */
+    mio->impl.slice.ungetch = EOF;
+  }
+  slice_sync (mio);
+  if (mio->impl.slice.ungetch != EOF) {
+    ptr = &mem_bytes[(unsigned char) mio->impl.slice.ungetch];
+    *avail = 1;
+  } else if ((*avail = slice_fill (mio)) > 0) {
+    ptr = mio->read_ptr;
+  } else if (mio->impl.slice.pos >= mio->impl.slice.size) {
+    mio->impl.slice.eof = TRUE;
+  }
+  
+  return ptr;
+}
+
+static int
+slice_consume (MIO   *mio,
+               size_t n)
+{
+  int rv = -1;
+  
+  slice_sync (mio);
+  if (mio->impl.slice.ungetch != EOF) {
+    /* slice_peek() only gave the pushed back character */
+    if (n > 1) {
+      errno = EINVAL;
+    } else {
+      if (n == 1) {
+        mio->impl.slice.ungetch = EOF;
+        mio->impl.slice.pos++;
+      }
+      rv = 0;
+    }
+  } else if ((off_t) n > mio->impl.slice.size - mio->impl.slice.pos) {
+    errno = EINVAL;
+  } else {
+    mio->impl.slice.pos += (off_t) n;
+    rv = 0;
+  }
+  
+  return rv;
+}
+
+static void *
+slice_reserve (MIO   *mio,
+               size_t n)
+{
+  mio->impl.slice.error = TRUE;
+  errno = EBADF;
+  
+  return NULL;
+}
+
+static int
+slice_commit (MIO   *mio,
+              size_t n)
+{
+  int rv = -1;
+  
+  if (n == 0) {
+    rv = 0;
+  } else {
+    errno = EBADF;
+  }
+  
+  return rv;
+}
+
+static ssize_t
+slice_pread (MIO   *mio,
+             void  *ptr,
+             size_t count,
+             off_t  offset)
+{
+  ssize_t rv = 0;
+  
+  if (offset < mio->impl.slice.size) {
+    if ((off_t) count > mio->impl.slice.size - offset) {
+      count = (size_t) (mio->impl.slice.size - offset);
+    }
+    rv = mio_pread (mio->impl.slice.parent, ptr, count,
+                    mio->impl.slice.base + offset);
+  }
+  
+  return rv;
+}
+
+static ssize_t
+slice_pwrite (MIO        *mio,
+              const void *ptr,
+              size_t      count,
+              off_t       offset)
+{
+  errno = EBADF;
+  
+  return -1;
+}
+
+static size_t
+slice_readv (MIO                 *mio,
+             const struct iovec  *iov,
+             int                  iovcnt)
+{
+  size_t  n_read = 0;
+  int     i;
+  
+  for (i = 0; i < iovcnt; i++) {
+    size_t n = slice_read (mio, iov[i].iov_base, 1, iov[i].iov_len);
+    
+    n_read += n;
+    if (n < iov[i].iov_len) {
+      break;
+    }
+  }
+  
+  return n_read;
+}
+
+static size_t
+slice_writev (MIO                 *mio,
+              const struct iovec  *iov,
+              int                  iovcnt)
+{
+  mio->impl.slice.error = TRUE;
+  errno = EBADF;
+  
+  return 0;
+}
+
+static int
+slice_mark (MIO *mio)
+{
+  slice_sync (mio);
+  mio->mark.offset = mio->impl.slice.pos;
+  mio->mark.ungetch = mio->impl.slice.ungetch;
+  
+  return 0;
+}
+
+static int
+slice_reset (MIO *mio)
+{
+  slice_sync (mio);
+  mio->impl.slice.pos = mio->mark.offset;
+  mio->impl.slice.ungetch = mio->mark.ungetch;
+  mio->impl.slice.eof = FALSE;
+  
+  return 0;
+}
@@ -33,8 +33,14 @@
 #endif
 
 #include "mio.h"
+#include "mio-printf.c"
 #include "mio-file.c"
 #include "mio-memory.c"
+#include "mio-mmap.c"
+#include "mio-fd.c"
+#include "mio-slice.c"
+#include "mio-concat.c"
+#include "mio-chunked.c"
 
 #ifdef HAVE_GLIB
 # include <glib.h>
@@ -54,6 +60,271 @@
 # define MIO_FREE(m)  (free (m))
 #endif
 
+/* largest write mio_put_*() copies through mio_write_reserve() */
+#define MIO_PUT_RESERVE_MAX 256
+
+
+/*
+ * mio_alloc:
+ * 
+ * Allocates a new #MIO object and initializes the parts that are common to all
+ * implementations.
+ * 
+ * Returns: A new #MIO object, or %NULL on failure.
+ */
+static MIO *
+mio_alloc (void)
+{
+  MIO *mio;
+  
+  mio = MIO_ALLOC ();
+  if (mio) {
+    mio->read_ptr = NULL;
+    mio->read_end = NULL;
+    mio->write_ptr = NULL;
+    mio->write_end = NULL;
+    mio->write_data_end = NULL;
+    mio->line_buf = NULL;
+    mio->line_buf_size = 0;
+    mio->line_index = NULL;
+    mio->track.ptr = NULL;
+    mio->track.enabled = FALSE;
+    mio->track.line = 0;
+    mio->track.column = -1;
+    mio->track.prev_column = -1;
+    mio->unget.ptr = NULL;
+    mio->unget.end = NULL;
+    mio->unget.active = FALSE;
+    mio->mark.active = FALSE;
+  }
+  
+  return mio;
+}
+
+/*
+ * track_count:
+ * @mio: A #MIO object
+ * @p: Data read from the stream
+ * @n: Size of @p
+ * 
+ * Updates the line tracking state of @mio after reading @n bytes.
+ */
+static void
+track_count (MIO                 *mio,
+             const unsigned char *p,
+             size_t               n)
+{
+  const unsigned char  *end = p + n;
+  const unsigned char  *nl;
+  
+  while ((nl = memchr (p, '\n', (size_t) (end - p))) != NULL) {
+    if (mio->track.column >= 0) {
+      mio->track.prev_column = mio->track.column + (long) (nl - p);
+    } else {
+      mio->track.prev_column = -1;
+    }
+    if (mio->track.line > 0) {
+      mio->track.line++;
+    }
+    mio->track.column = 0;
+    p = nl + 1;
+  }
+  if (mio->track.column >= 0) {
+    mio->track.column += (long) (end - p);
+  }
+}
+
+/*
+ * track_sync:
+ * @mio: A #MIO object
+ * 
+ * Accounts for the data read through the fast path window since the last call
+ * to track_resume().  This has to be done before any operation that could
+ * change the window.
+ */
+static void
+track_sync (MIO *mio)
+{
+  if (mio->track.ptr) {
+    if (mio->read_ptr > mio->track.ptr) {
+      track_count (mio, mio->track.ptr,
+                   (size_t) (mio->read_ptr - mio->track.ptr));
+    }
+    mio->track.ptr = NULL;
+  }
+}
+
+/*
+ * track_resume:
+ * @mio: A #MIO object
+ * 
+ * Starts following the fast path window again after an operation on @mio.
+ */
+static void
+track_resume (MIO *mio)
+{
+  if (mio->track.enabled) {
+    mio->track.ptr = mio->read_ptr;
+  }
+}
+
+/*
+ * track_set:
+ * @mio: A #MIO object
+ * @line: The new line, or 0 if unknown
+ * @column: The new column, or -1 if unknown
+ * 
+ * Sets the line tracking state of @mio after its cursor moved.
+ */
+static void
+track_set (MIO  *mio,
+           long  line,
+           long  column)
+{
+  mio->track.line = line;
+  mio->track.column = column;
+  mio->track.prev_column = -1;
+}
+
+/*
+ * track_unget:
+ * @mio: A #MIO object
+ * @ch: The character pushed back
+ * 
+ * Updates the line tracking state of @mio after pushing back @ch.
+ */
+static void
+track_unget (MIO           *mio,
+             unsigned char  ch)
+{
+  if (ch == '\n') {
+    if (mio->track.line > 0) {
+      mio->track.line--;
+    }
+    track_set (mio, mio->track.line, mio->track.prev_column);
+  } else if (mio->track.column > 0) {
+    mio->track.column--;
+  } else {
+    mio->track.column = -1;
+  }
+}
+
+/*
+ * unget_swap:
+ * @mio: A #MIO object with pushed back characters
+ * 
+ * Exchanges the read window of @mio with the one saved in mio->unget.
+ */
+static void
+unget_swap (MIO *mio)
+{
+  unsigned char *ptr = mio->read_ptr;
+  unsigned char *end = mio->read_end;
+  
+  mio->read_ptr = mio->unget.ptr;
+  mio->read_end = mio->unget.end;
+  mio->unget.ptr = ptr;
+  mio->unget.end = end;
+}
+
+/*
+ * slow_path_begin:
+ * @mio: A #MIO object
+ * 
+ * Prepares @mio for an operation done by the implementation, outside of the
+ * fast path windows: accounts for the data read through the read window, and
+ * gives the implementation its own read window back if characters pushed back
+ * in mio->unget are being read.  Until slow_path_end() is called,
+ * mio->unget.ptr points to the pushed back characters that were not read
+ * again yet, if mio->unget.active is set.
+ */
+static void
+slow_path_begin (MIO *mio)
+{
+  track_sync (mio);
+  if (mio->unget.active) {
+    if (mio->read_ptr < mio->read_end) {
+      unget_swap (mio);
+    } else {
+      /* everything was read again */
+      mio->read_ptr = mio->unget.ptr;
+      mio->read_end = mio->unget.end;
+      mio->unget.active = FALSE;
+    }
+  }
+}
+
+/*
+ * slow_path_end:
+ * @mio: A #MIO object
+ * 
+ * Restores the fast path windows of @mio after slow_path_begin().
+ */
+static void
+slow_path_end (MIO *mio)
+{
+  if (mio->unget.active) {
+    unget_swap (mio);
+  }
+  track_resume (mio);
+}
+
+/*
+ * unget_pending:
+ * @mio: A #MIO object, between slow_path_begin() and slow_path_end()
+ * 
+ * Returns: The number of characters in mio->unget that were not read again.
+ */
+static size_t
+unget_pending (MIO *mio)
+{
+  size_t n = 0;
+  
+  if (mio->unget.active) {
+    n = (size_t) (mio->unget.end - mio->unget.ptr);
+  }
+  
+  return n;
+}
+
+/*
+ * unget_push:
+ * @mio: A #MIO object, between slow_path_begin() and slow_path_end()
+ * @ch: The character to push back
+ * 
+ * Pushes back a character in mio->unget, which must have room for it.
+ */
+static void
+unget_push (MIO           *mio,
+            unsigned char  ch)
+{
+  if (! mio->unget.active) {
+    mio->unget.ptr = &mio->unget.buf[MIO_UNGET_MAX];
+    mio->unget.end = mio->unget.ptr;
+    mio->unget.active = TRUE;
+  }
+  *--mio->unget.ptr = ch;
+}
+
+/*
+ * unget_discard:
+ * @mio: A #MIO object, between slow_path_begin() and slow_path_end()
+ * 
+ * Drops the characters pushed back in mio->unget, moving the implementation's
+ * cursor back to the logical position of the stream.  This is needed before
+ * writing, as the implementation's cursor is after the pushed back
+ * characters.
+ */
+static void
+unget_discard (MIO *mio)
+{
+  size_t n = unget_pending (mio);
+  
+  mio->unget.active = FALSE;
+  if (n > 0) {
+    mio->v_seek (mio, - (long) n, SEEK_CUR);
+  }
+}
 
 
 /**
@@ -69,7 +340,8 @@
  * on whether you want file or in-memory operations, and destroyed using
  * mio_free(). There is also some other convenient API to create file-based
  * #MIO objects for more complex cases, such as mio_new_file_full() and
- * mio_new_fp().
+ * mio_new_fp(), read-only memory-mapped files can be used with
+ * mio_new_mmap(), and file descriptors can be used directly with mio_new_fd().
  * 
  * Once the #MIO object is created, you can perform standard I/O operations on
  * it transparently without the need to care about the effective underlying
@@ -117,7 +389,7 @@ mio_new_file_full (const char   *filename,
   /* we need to create the MIO object first, because we may not be able to close
    * the opened file if the user passed NULL as the close function, which means
    * that everything must succeed if we've opened the file successfully */
-  mio = MIO_ALLOC ();
+  mio = mio_alloc ();
   if (mio) {
     FILE *fp = open_func (filename, mode);
     
@@ -128,6 +400,11 @@ mio_new_file_full (const char   *filename,
       mio->type = MIO_TYPE_FILE;
       mio->impl.file.fp = fp;
       mio->impl.file.close_func = close_func;
+      mio->impl.file.buf = NULL;
+      mio->impl.file.buf_size = file_buffer_size (fp);
+      mio->impl.file.buffered = (mio->impl.file.buf_size > 1);
+      mio->impl.file.dirty = FALSE;
+      mio->impl.file.eof = FALSE;
       /* function table filling */
       FILE_SET_VTABLE (mio);
     }
@@ -183,11 +460,16 @@ mio_new_fp (FILE         *fp,
 {
   MIO *mio;
   
-  mio = MIO_ALLOC ();
+  mio = mio_alloc ();
   if (mio) {
     mio->type = MIO_TYPE_FILE;
     mio->impl.file.fp = fp;
     mio->impl.file.close_func = close_func;
+    mio->impl.file.buf = NULL;
+    mio->impl.file.buf_size = file_buffer_size (fp);
+    mio->impl.file.buffered = (mio->impl.file.buf_size > 1);
+    mio->impl.file.dirty = FALSE;
+    mio->impl.file.eof = FALSE;
     /* function table filling */
     FILE_SET_VTABLE (mio);
   }
@@ -239,7 +521,7 @@ mio_new_memory (unsigned char  *data,
 {
   MIO  *mio;
   
-  mio = MIO_ALLOC ();
+  mio = mio_alloc ();
   if (mio) {
     mio->type = MIO_TYPE_MEMORY;
     mio->impl.mem.buf = data;
@@ -249,6 +531,11 @@ mio_new_memory (unsigned char  *data,
     mio->impl.mem.allocated_size = size;
     mio->impl.mem.realloc_func = realloc_func;
     mio->impl.mem.free_func = free_func;
+    mio->impl.mem.growth_factor = MIO_GROWTH_FACTOR;
+    mio->impl.mem.growth_max_step = MIO_GROWTH_MAX_STEP;
+    mio->impl.mem.shared = NULL;
+    mio->impl.mem.scratch = NULL;
+    mio->impl.mem.reserved = 0;
     mio->impl.mem.eof = FALSE;
     mio->impl.mem.error = FALSE;
     /* function table filling */
@@ -258,12 +545,240 @@ mio_new_memory (unsigned char  *data,
   return mio;
 }
 
+/**
+ * mio_new_memory_from_file:
+ * @filename: Filename to load
+ * @realloc_func: A function with the realloc() semantic used to allocate the
+ *                buffer and to grow it later
+ * @free_func: A function with the free() semantic to destroy the data together
+ *             with the object, or %NULL not to destroy the data
+ * 
+ * Creates a new #MIO object working on memory, initialized with the whole
+ * content of a file.  This is a lot cheaper than reading a file stream into a
+ * memory one, as the size of the file is queried beforehand so the buffer is
+ * allocated only once, and the data is read in large chunks without the
+ * intermediate stdio buffer.
+ * 
+ * If the file size cannot be known in advance (e.g. for pipes or procfs files)
+ * the buffer grows as needed, and may be bigger than the data afterwards; see
+ * mio_memory_shrink_to_fit().
+ * 
+ * The cursor is at the start of the data, and the stream can be written to
+ * just like one created with mio_new_memory().
+ * 
+ * Free-function: mio_free()
+ * 
+ * Returns: A new #MIO on success, or %NULL on failure, in which case errno is
+ *          set to indicate the error.
+ */
+MIO *
+mio_new_memory_from_file (const char     *filename,
+                          MIOReallocFunc  realloc_func,
+                          MIOFreeFunc     free_func)
+{
+  MIO *mio = NULL;
+  
+  if (! realloc_func) {
+    errno = EINVAL;
+  } else {
+    mio = mio_new_memory (NULL, 0, realloc_func, free_func);
+    if (mio && ! mem_load_file (mio, filename)) {
+      int errnum = errno;
+      
+      /* release the buffer even if we don't have a free function */
+      mem_try_set_capacity (mio, 0);
+      mio_free (mio);
+      mio = NULL;
+      errno = errnum;
+    }
+  }
+  
+  return mio;
+}
+
+/**
+ * mio_new_memory_chunked:
+ * @chunk_size: Size of the chunks, or 0 for the default
+ * 
+ * Creates a new empty #MIO object working on memory, storing the data in a
+ * list of chunks of @chunk_size bytes instead of a single buffer.  Growing the
+ * stream only ever adds new chunks, so data already written is never moved:
+ * appending takes constant time and doesn't need twice as much memory
+ * temporarily like reallocating a big buffer does, which is better suited to
+ * build large outputs.  Reading and seeking work the same as with other
+ * streams.
+ * 
+ * The data is only gathered in a single buffer when calling
+ * mio_memory_get_data(), see there.
+ * 
+ * Free-function: mio_free()
+ * 
+ * Returns: A new #MIO on success, or %NULL on failure, in which case errno is
+ *          set to indicate the error.
+ */
+MIO *
+mio_new_memory_chunked (size_t chunk_size)
+{
+  MIO *mio;
+  
+  mio = mio_alloc ();
+  if (mio) {
+    if (! chunked_open (mio, chunk_size)) {
+      MIO_FREE (mio);
+      mio = NULL;
+    } else {
+      mio->type = MIO_TYPE_CHUNKED;
+      /* function table filling */
+      CHUNKED_SET_VTABLE (mio);
+    }
+  }
+  
+  return mio;
+}
+
+/**
+ * mio_new_mmap_full:
+ * @filename: Filename to map
+ * @flags: Hints on how the file will be accessed
+ * @window_size: Maximum size of the file to map at once, or 0 to map it all
+ * 
+ * Creates a new read-only #MIO object working on a memory-mapped file.  Reads
+ * are served directly from the mapping, avoiding both the copies of stdio and
+ * loading the whole file in memory beforehand.  See also mio_new_mmap().
+ * 
+ * If @window_size is not 0, only a window of that many bytes (rounded up to
+ * the page size) is mapped at a time, and slides as the cursor moves.  This is
+ * required for files bigger than the address space, and reduces the address
+ * space usage for big files.
+ * 
+ * Any attempt to write to the returned object fails, setting the error
+ * indicator and errno to %EBADF.  The file size is read when the object is
+ * created, so the file should not be modified while the object is in use.
+ * 
+ * Free-function: mio_free()
+ * 
+ * Returns: A new #MIO on success, or %NULL on failure, in which case errno is
+ *          set to indicate the error.
+ */
+MIO *
+mio_new_mmap_full (const char  *filename,
+                   MIOMmapFlags flags,
+                   size_t       window_size)
+{
+  MIO *mio;
+  
+  mio = mio_alloc ();
+  if (mio) {
+    if (! mmap_open (mio, filename, flags, window_size)) {
+      MIO_FREE (mio);
+      mio = NULL;
+    } else {
+      mio->type = MIO_TYPE_MMAP;
+      /* function table filling */
+      MMAP_SET_VTABLE (mio);
+    }
+  }
+  
+  return mio;
+}
+
+/**
+ * mio_new_mmap:
+ * @filename: Filename to map
+ * 
+ * Creates a new read-only #MIO object working on a whole memory-mapped file,
+ * hinting the system it will be read sequentially.
+ * This function simply calls mio_new_mmap_full().
+ * 
+ * Free-function: mio_free()
+ * 
+ * Returns: A new #MIO on success, or %NULL on failure.
+ */
+MIO *
+mio_new_mmap (const char *filename)
+{
+  return mio_new_mmap_full (filename, MIO_MMAP_SEQUENTIAL, 0);
+}
+
+/**
+ * mio_new_fd_full:
+ * @fd: An opened file descriptor
+ * @buffer_size: Size of the internal buffer, or 0 for the default
+ * @close_func: A function with the close() semantic to close the file
+ *              descriptor when the #MIO object is destroyed, or %NULL not to
+ *              close it
+ * 
+ * Creates a new #MIO object working directly on a file descriptor, bypassing
+ * stdio.  See also mio_new_fd().
+ * 
+ * The stream has its own buffer of @buffer_size bytes and keeps track of its
+ * position itself, so telling the position is free and seeking within the
+ * buffered data doesn't need any system call, which makes saving and restoring
+ * positions with mio_getpos() and mio_setpos() very cheap.  Non-seekable file
+ * descriptors like pipes are supported, although seeking outside the buffered
+ * data fails for them.
+ * 
+ * The file descriptor should not be used directly while the #MIO object is
+ * alive, see mio_fd_get_fd().
+ * 
+ * Free-function: mio_free()
+ * 
+ * Returns: A new #MIO on success, or %NULL on failure, in which case errno is
+ *          set to indicate the error.
+ */
+MIO *
+mio_new_fd_full (int          fd,
+                 size_t       buffer_size,
+                 MIOCloseFunc close_func)
+{
+  MIO *mio;
+  
+  mio = mio_alloc ();
+  if (mio) {
+    if (! fd_open (mio, fd, buffer_size, close_func)) {
+      MIO_FREE (mio);
+      mio = NULL;
+    } else {
+      mio->type = MIO_TYPE_FD;
+      /* function table filling */
+      FD_SET_VTABLE (mio);
+    }
+  }
+  
+  return mio;
+}
+
+/**
+ * mio_new_fd:
+ * @fd: An opened file descriptor
+ * @close_func: A function with the close() semantic to close the file
+ *              descriptor when the #MIO object is destroyed, or %NULL not to
+ *              close it
+ * 
+ * Creates a new #MIO object working on a file descriptor with the default
+ * buffer size.
+ * This function simply calls mio_new_fd_full().
+ * 
+ * Free-function: mio_free()
+ * 
+ * Returns: A new #MIO on success, or %NULL on failure.
+ */
+MIO *
+mio_new_fd (int          fd,
+            MIOCloseFunc close_func)
+{
+  return mio_new_fd_full (fd, 0, close_func);
+}
+
 /**
  * mio_file_get_fp:
  * @mio: A #MIO object
  * 
  * Gets the underlying #FILE object associated with a #MIO file stream.
  * 
+ * The stream's internal buffer is synchronized with the #FILE object before
+ * it is returned, but any character pushed back with mio_ungetc() is lost.
+ * 
  * <warning><para>The returned object may become invalid after a call to
  * mio_free() if the stream was configured to close the file when
  * destroyed.</para></warning>
@@ -277,12 +792,47 @@ mio_file_get_fp (MIO *mio)
   FILE *fp = NULL;
   
   if (mio->type == MIO_TYPE_FILE) {
+    slow_path_begin (mio);
+    unget_discard (mio);
+    mio->mark.active = FALSE;
+    file_sync (mio);
     fp = mio->impl.file.fp;
+    slow_path_end (mio);
   }
   
   return fp;
 }
 
+/**
+ * mio_fd_get_fd:
+ * @mio: A #MIO object
+ * 
+ * Gets the underlying file descriptor associated with a #MIO file descriptor
+ * stream.
+ * 
+ * The staged writes are written out and the file descriptor is moved to the
+ * logical position of the stream before it is returned.
+ * 
+ * Returns: The underlying file descriptor of the given stream, or -1 if the
+ *          stream is not a file descriptor stream.
+ */
+int
+mio_fd_get_fd (MIO *mio)
+{
+  int fd = -1;
+  
+  if (mio->type == MIO_TYPE_FD) {
+    slow_path_begin (mio);
+    unget_discard (mio);
+    mio->mark.active = FALSE;
+    fd_sync_descriptor (mio);
+    fd = mio->impl.fd.fd;
+    slow_path_end (mio);
+  }
+  
+  return fd;
+}
+
 /**
  * mio_memory_get_data:
  * @mio: A #MIO object
@@ -291,12 +841,16 @@ mio_file_get_fp (MIO *mio)
  * 
  * Gets the underlying memory buffer associated with a #MIO memory stream.
  * 
+ * For streams created with mio_new_memory_chunked(), this first gathers all
+ * the chunks in a single one, which requires copying the data, and fails if
+ * memory runs out.  Later writes then go to new chunks.
+ * 
  * <warning><para>The returned pointer and size may become invalid after a
  * successful write on the stream or after a call to mio_free() if the stream
  * was configured to free the memory when destroyed.</para></warning>
  * 
  * Returns: The memory buffer of the given #MIO stream, or %NULL if the stream
- *          is not a memory stream.
+ *          is not a memory stream or on failure.
  */
 unsigned char *
 mio_memory_get_data (MIO     *mio,
@@ -305,42 +859,348 @@ mio_memory_get_data (MIO     *mio,
   unsigned char *ptr = NULL;
   
   if (mio->type == MIO_TYPE_MEMORY) {
+    slow_path_begin (mio);
+    mem_sync (mio);
     ptr = mio->impl.mem.buf;
     if (size) *size = mio->impl.mem.size;
+    slow_path_end (mio);
+  } else if (mio->type == MIO_TYPE_CHUNKED) {
+    slow_path_begin (mio);
+    chunked_sync (mio);
+    if (chunked_flatten (mio)) {
+      ptr = mio->impl.chunked.chunks[0].data;
+      if (size) *size = mio->impl.chunked.size;
+    }
+    slow_path_end (mio);
   }
   
   return ptr;
 }
 
 /**
- * mio_free:
+ * mio_memory_set_growth:
  * @mio: A #MIO object
- * 
- * Destroys a #MIO object.
+ * @factor: Factor by which multiply the buffer size when it needs to grow, or
+ *          1.0 or less to grow it linearly
+ * @max_step: Maximum number of bytes to add to the buffer at once, or 0 for no
+ *            limit
+ * 
+ * Sets the growth policy of a #MIO memory stream, that is how much memory
+ * is allocated ahead when a write goes past the end of the buffer.  The
+ * default is to double the buffer size with no limit, which keeps the cost of
+ * many small writes amortized constant.
+ * 
+ * The buffer is never grown by less than a few kilobytes, nor by less than
+ * what the write needs.  This has no effect on non-memory streams.
  */
 void
-mio_free (MIO *mio)
+mio_memory_set_growth (MIO     *mio,
+                       double   factor,
+                       size_t   max_step)
 {
-  if (mio) {
-    mio->v_free (mio);
-    MIO_FREE (mio);
+  if (mio->type == MIO_TYPE_MEMORY) {
+    mio->impl.mem.growth_factor = factor;
+    mio->impl.mem.growth_max_step = max_step;
   }
 }
 
 /**
- * mio_read:
+ * mio_memory_reserve:
  * @mio: A #MIO object
- * @ptr: Pointer to the memory to fill with the read data
- * @size: Size of each block to read
- * @nmemb: Number o blocks to read
+ * @capacity: Number of bytes to allocate
  * 
- * Reads raw data from a #MIO stream. This function behave the same as fread().
+ * Makes sure the buffer of a #MIO memory stream can hold at least @capacity
+ * bytes without growing.  This doesn't change the size of the data, but avoids
+ * reallocations if the final size is known in advance.
  * 
- * Returns: The number of actually read blocks. If an error occurs or if the
- *          end of the stream is reached, the return value may be smaller than
- *          the requested block count, or even 0. This function doesn't
- *          distinguish between end-of-stream and an error, you should then use
- *          mio_eof() and mio_error() to determine which occurred.
+ * Returns: 0 on success, -1 otherwise, in which case errno may be set to
+ *          indicate the error.
+ */
+int
+mio_memory_reserve (MIO    *mio,
+                    size_t  capacity)
+{
+  int rv = -1;
+  
+  if (mio->type != MIO_TYPE_MEMORY) {
+    errno = EINVAL;
+  } else {
+    slow_path_begin (mio);
+    mem_sync (mio);
+    if (capacity <= mio->impl.mem.allocated_size ||
+        mem_try_set_capacity (mio, capacity)) {
+      rv = 0;
+    }
+    slow_path_end (mio);
+  }
+  
+  return rv;
+}
+
+/**
+ * mio_memory_shrink_to_fit:
+ * @mio: A #MIO object
+ * 
+ * Releases the memory allocated ahead by a #MIO memory stream, so that its
+ * buffer is exactly the size of the data.
+ * 
+ * Returns: 0 on success, -1 otherwise, in which case errno may be set to
+ *          indicate the error.
+ */
+int
+mio_memory_shrink_to_fit (MIO *mio)
+{
+  int rv = -1;
+  
+  if (mio->type != MIO_TYPE_MEMORY) {
+    errno = EINVAL;
+  } else {
+    slow_path_begin (mio);
+    mem_sync (mio);
+    if (mio->impl.mem.size == mio->impl.mem.allocated_size ||
+        mem_try_set_capacity (mio, mio->impl.mem.size)) {
+      rv = 0;
+    }
+    slow_path_end (mio);
+  }
+  
+  return rv;
+}
+
+/**
+ * mio_dup:
+ * @mio: A #MIO object
+ * 
+ * Creates a new cursor over the data of a #MIO memory stream.  The returned
+ * object shares the buffer of @mio instead of copying it, but has its own
+ * position, pushed back character and end-of-file and error indicators.  It
+ * starts at the same position as @mio.
+ * 
+ * The buffer is reference-counted and released with the free function given
+ * to mio_new_memory() when the last stream using it is destroyed, so the
+ * streams can be freed in any order.  Reading concurrently from different
+ * streams sharing a buffer is safe.
+ * 
+ * Writing to a stream whose buffer is shared first gives it a private copy of
+ * the data, so other streams are not affected.  This requires the stream to
+ * have both a reallocation and a free function, otherwise writing fails with
+ * errno set to %EBADF.
+ * 
+ * Only memory streams can be duplicated.
+ * 
+ * Free-function: mio_free()
+ * 
+ * Returns: A new #MIO on success, or %NULL on failure, in which case errno is
+ *          set to indicate the error.
+ */
+MIO *
+mio_dup (MIO *mio)
+{
+  MIO *dup = NULL;
+  
+  if (mio->type != MIO_TYPE_MEMORY) {
+    errno = EINVAL;
+  } else {
+    slow_path_begin (mio);
+    mem_sync (mio);
+    if (! mio->impl.mem.shared) {
+      mio->impl.mem.shared = shared_new (mio->impl.mem.buf,
+                                         mio->impl.mem.free_func);
+    }
+    if (! mio->impl.mem.shared || ! (dup = mio_alloc ())) {
+      errno = ENOMEM;
+    } else {
+      shared_ref (mio->impl.mem.shared);
+      dup->type = MIO_TYPE_MEMORY;
+      dup->impl.mem = mio->impl.mem;
+      dup->impl.mem.scratch = NULL;
+      dup->impl.mem.reserved = 0;
+      dup->impl.mem.error = FALSE;
+      if (mio->unget.active) {
+        dup->unget = mio->unget;
+        dup->read_ptr = &dup->unget.buf[mio->unget.ptr - mio->unget.buf];
+        dup->read_end = &dup->unget.buf[MIO_UNGET_MAX];
+        dup->unget.ptr = NULL;
+        dup->unget.end = NULL;
+      }
+      /* function table filling */
+      MEM_SET_VTABLE (dup);
+    }
+    slow_path_end (mio);
+  }
+  
+  return dup;
+}
+
+/**
+ * mio_new_slice:
+ * @parent: A #MIO object
+ * @offset: Position in @parent at which the slice starts
+ * @length: Length of the slice
+ * 
+ * Creates a new read-only #MIO object giving access to @length bytes of
+ * @parent starting at @offset, e.g. to hand a member of an archive to a parser
+ * expecting a whole stream.  Positions in the returned object are relative to
+ * the start of the slice, and reaching its end reports end-of-file.
+ * 
+ * If @parent is a memory stream the slice shares its buffer like mio_dup()
+ * does, without copying anything, and may outlive it.  Otherwise the slice
+ * reads from @parent with mio_pread(), so it never moves the cursor of @parent
+ * but requires it to support positional reads, and @parent must not be
+ * destroyed before the slice.  If @parent turns out to be shorter than
+ * @offset + @length, the slice ends where @parent ends.
+ * 
+ * Any attempt to write to the returned object fails, setting errno to %EBADF.
+ * 
+ * Free-function: mio_free()
+ * 
+ * Returns: A new #MIO on success, or %NULL on failure, in which case errno is
+ *          set to indicate the error.
+ */
+MIO *
+mio_new_slice (MIO   *parent,
+               off_t  offset,
+               off_t  length)
+{
+  MIO *mio = NULL;
+  
+  if (offset < 0 || length < 0 || length > MIO_OFF_MAX - offset) {
+    errno = EINVAL;
+  } else if (parent->type == MIO_TYPE_MEMORY) {
+    slow_path_begin (parent);
+    mem_sync (parent);
+    /* end where the parent ends, like mio_pread() would */
+    if ((uintmax_t) offset > parent->impl.mem.size) {
+      offset = (off_t) parent->impl.mem.size;
+    }
+    if ((uintmax_t) length > parent->impl.mem.size - (size_t) offset) {
+      length = (off_t) (parent->impl.mem.size - (size_t) offset);
+    }
+    if (! parent->impl.mem.shared) {
+      parent->impl.mem.shared = shared_new (parent->impl.mem.buf,
+                                            parent->impl.mem.free_func);
+    }
+    if (! parent->impl.mem.shared || ! (mio = mio_alloc ())) {
+      errno = ENOMEM;
+    } else {
+      shared_ref (parent->impl.mem.shared);
+      mio->type = MIO_TYPE_MEMORY;
+      mio->impl.mem = parent->impl.mem;
+      if (offset > 0) {
+        mio->impl.mem.buf = parent->impl.mem.buf + offset;
+      }
+      mio->impl.mem.ungetch = EOF;
+      mio->impl.mem.pos = 0;
+      mio->impl.mem.size = (size_t) length;
+      mio->impl.mem.allocated_size = (size_t) length;
+      /* without these, the slice can't get a private copy to write to */
+      mio->impl.mem.realloc_func = NULL;
+      mio->impl.mem.free_func = NULL;
+      mio->impl.mem.scratch = NULL;
+      mio->impl.mem.reserved = 0;
+      mio->impl.mem.error = FALSE;
+      mio->impl.mem.eof = FALSE;
+      /* function table filling */
+      MEM_SET_VTABLE (mio);
+    }
+    slow_path_end (parent);
+  } else {
+    mio = mio_alloc ();
+    if (mio) {
+      if (! slice_open (mio, parent, offset, length)) {
+        MIO_FREE (mio);
+        mio = NULL;
+      } else {
+        mio->type = MIO_TYPE_SLICE;
+        /* function table filling */
+        SLICE_SET_VTABLE (mio);
+      }
+    }
+  }
+  
+  return mio;
+}
+
+/**
+ * mio_new_concat:
+ * @segments: The segments to concatenate
+ * @n_segments: The number of elements in @segments
+ * 
+ * Creates a new read-only #MIO object reading @segments one after the other,
+ * as if they were a single stream, without copying them.  Each segment is
+ * either raw data or a whole #MIO stream, which may itself be e.g. a slice
+ * created with mio_new_slice().  The stream can be seeked freely, and
+ * positions, pushed back characters and mio_mark() all work across segment
+ * boundaries.
+ * 
+ * Data segments and memory streams are read in place.  Other streams are read
+ * with mio_pread(), so they must support positional reads, and their cursor is
+ * never moved past creation, when their size is computed.  Neither the data
+ * nor the streams are copied nor owned by the returned object, so they must
+ * not be modified nor destroyed before it.
+ * 
+ * Any attempt to write to the returned object fails, setting errno to %EBADF.
+ * 
+ * Free-function: mio_free()
+ * 
+ * Returns: A new #MIO on success, or %NULL on failure, in which case errno is
+ *          set to indicate the error.
+ */
+MIO *
+mio_new_concat (const MIOSegment *segments,
+                size_t            n_segments)
+{
+  MIO *mio;
+  
+  mio = mio_alloc ();
+  if (mio) {
+    if (! concat_open (mio, segments, n_segments)) {
+      MIO_FREE (mio);
+      mio = NULL;
+    } else {
+      mio->type = MIO_TYPE_CONCAT;
+      /* function table filling */
+      CONCAT_SET_VTABLE (mio);
+    }
+  }
+  
+  return mio;
+}
+
+/**
+ * mio_free:
+ * @mio: A #MIO object
+ * 
+ * Destroys a #MIO object.
+ */
+void
+mio_free (MIO *mio)
+{
+  if (mio) {
+    mio->v_free (mio);
+    free (mio->line_buf);
+    if (mio->line_index) {
+      free (mio->line_index->samples);
+      free (mio->line_index);
+    }
+    MIO_FREE (mio);
+  }
+}
+
+/**
+ * mio_read:
+ * @mio: A #MIO object
+ * @ptr: Pointer to the memory to fill with the read data
+ * @size: Size of each block to read
+ * @nmemb: Number o blocks to read
+ * 
+ * Reads raw data from a #MIO stream. This function behave the same as fread().
+ * 
+ * Returns: The number of actually read blocks. If an error occurs or if the
+ *          end of the stream is reached, the return value may be smaller than
+ *          the requested block count, or even 0. This function doesn't
+ *          distinguish between end-of-stream and an error, you should then use
+ *          mio_eof() and mio_error() to determine which occurred.
  */
 size_t
 mio_read (MIO    *mio,
@@ -348,7 +1208,35 @@ mio_read (MIO    *mio,
           size_t  size,
           size_t  nmemb)
 {
-  return mio->v_read (mio, ptr, size, nmemb);
+  size_t rv;
+  size_t n = 0;
+  size_t got;
+  
+  if (mio->read_ptr < mio->read_end && size > 0 &&
+      nmemb <= ((size_t) -1) / size) {
+    /* start with what's in the read window, e.g. pushed back characters */
+    n = MIN (size * nmemb, (size_t) (mio->read_end - mio->read_ptr));
+    memcpy (ptr, mio->read_ptr, n);
+    mio->read_ptr += n;
+  }
+  
+  slow_path_begin (mio);
+  if (n == 0) {
+    rv = mio->v_read (mio, ptr, size, nmemb);
+    got = rv * size;
+  } else {
+    got = 0;
+    if (n < size * nmemb) {
+      got = mio->v_read (mio, (unsigned char *) ptr + n, 1, size * nmemb - n);
+    }
+    rv = (n + got) / size;
+  }
+  if (mio->track.enabled) {
+    track_count (mio, (const unsigned char *) ptr + n, got);
+  }
+  slow_path_end (mio);
+  
+  return rv;
 }
 
 /**
@@ -369,7 +1257,180 @@ mio_write (MIO         *mio,
            size_t       size,
            size_t       nmemb)
 {
-  return mio->v_write (mio, ptr, size, nmemb);
+  size_t rv;
+  
+  slow_path_begin (mio);
+  unget_discard (mio);
+  mio->mark.active = FALSE;
+  rv = mio->v_write (mio, ptr, size, nmemb);
+  track_set (mio, 0, -1);
+  slow_path_end (mio);
+  
+  return rv;
+}
+
+/*
+ * iov_total:
+ * @iov: An array of vectors
+ * @iovcnt: Number of vectors in @iov
+ * @total: Return location for the total length of @iov
+ * 
+ * Computes the total length of a vector array, checking that it is valid for
+ * mio_readv() and mio_writev().
+ * 
+ * Returns: %TRUE on success, %FALSE if @iovcnt is negative or if the total
+ *          length doesn't fit in a #ssize_t.
+ */
+static int
+iov_total (const struct iovec  *iov,
+           int                  iovcnt,
+           size_t              *total)
+{
+  int success = (iovcnt >= 0);
+  int i;
+  
+  *total = 0;
+  for (i = 0; success && i < iovcnt; i++) {
+    if (iov[i].iov_len > (((size_t) -1) >> 1) - *total) {
+      success = FALSE;
+    } else {
+      *total += iov[i].iov_len;
+    }
+  }
+  
+  return success;
+}
+
+/**
+ * mio_readv:
+ * @mio: A #MIO object
+ * @iov: Array of buffers to fill with the read data
+ * @iovcnt: Number of buffers in @iov
+ * 
+ * Reads raw data from a #MIO stream into several buffers, filling each one
+ * in turn.  This function behaves the same as readv(), and is equivalent to
+ * reading into each buffer with mio_read() until one is not filled, but maps
+ * to a single readv() call on file descriptor streams when the data doesn't
+ * fit in their buffer.
+ * 
+ * Returns: The number of bytes read, which may be smaller than the total
+ *          length of the buffers if an error occurs or if the end of the
+ *          stream is reached (use mio_eof() and mio_error() to determine
+ *          which occurred), or -1 if @iovcnt is negative or the total length
+ *          of the buffers overflows a #ssize_t, in which case errno is set to
+ *          %EINVAL.
+ */
+ssize_t
+mio_readv (MIO                 *mio,
+           const struct iovec  *iov,
+           int                  iovcnt)
+{
+  size_t  total;
+  size_t  n     = 0;
+  size_t  got   = 0;
+  size_t  skip  = 0;
+  int     i     = 0;
+  int     first;
+  size_t  first_skip;
+  
+  if (! iov_total (iov, iovcnt, &total)) {
+    errno = EINVAL;
+    return -1;
+  }
+  
+  /* start with what's in the read window, e.g. pushed back characters */
+  while (i < iovcnt && mio->read_ptr < mio->read_end) {
+    size_t len = MIN (iov[i].iov_len - skip,
+                      (size_t) (mio->read_end - mio->read_ptr));
+    
+    memcpy ((unsigned char *) iov[i].iov_base + skip, mio->read_ptr, len);
+    mio->read_ptr += len;
+    n += len;
+    skip += len;
+    if (skip == iov[i].iov_len) {
+      i++;
+      skip = 0;
+    }
+  }
+  
+  slow_path_begin (mio);
+  first = i;
+  first_skip = skip;
+  if (i < iovcnt && skip > 0) {
+    /* finish the buffer the read window stopped in */
+    size_t len = iov[i].iov_len - skip;
+    
+    got = mio->v_read (mio, (unsigned char *) iov[i].iov_base + skip, 1, len);
+    i = (got == len) ? i + 1 : iovcnt;
+  }
+  if (i < iovcnt) {
+    got += mio->v_readv (mio, &iov[i], iovcnt - i);
+  }
+  if (mio->track.enabled) {
+    size_t left = got;
+    
+    for (i = first; left > 0; i++) {
+      size_t len = MIN (left, iov[i].iov_len - first_skip);
+      
+      track_count (mio, (const unsigned char *) iov[i].iov_base + first_skip,
+                   len);
+      left -= len;
+      first_skip = 0;
+    }
+  }
+  slow_path_end (mio);
+  
+  return (ssize_t) (n + got);
+}
+
+/**
+ * mio_writev:
+ * @mio: A #MIO object
+ * @iov: Array of buffers to write on the stream
+ * @iovcnt: Number of buffers in @iov
+ * 
+ * Writes raw data from several buffers to a #MIO stream, one after the
+ * other.  This function behaves the same as writev(), and is equivalent to
+ * writing each buffer with mio_write(), but reserves space only once for the
+ * whole batch on memory streams and maps to a single writev() call on file
+ * descriptor streams when the data doesn't fit in their buffer.
+ * 
+ * Returns: The number of bytes written, which may be smaller than the total
+ *          length of the buffers if a write error occurs, or -1 if @iovcnt
+ *          is negative or the total length of the buffers overflows a
+ *          #ssize_t, in which case errno is set to %EINVAL.
+ */
+ssize_t
+mio_writev (MIO                 *mio,
+            const struct iovec  *iov,
+            int                  iovcnt)
+{
+  size_t  total;
+  size_t  rv;
+  int     i;
+  
+  if (! iov_total (iov, iovcnt, &total)) {
+    errno = EINVAL;
+    return -1;
+  }
+  
+  if (mio->write_ptr < mio->write_end &&
+      total <= (size_t) (mio->write_end - mio->write_ptr)) {
+    for (i = 0; i < iovcnt; i++) {
+      memcpy (mio->write_ptr, iov[i].iov_base, iov[i].iov_len);
+      mio->write_ptr += iov[i].iov_len;
+    }
+    return (ssize_t) total;
+  }
+  
+  slow_path_begin (mio);
+  unget_discard (mio);
+  mio->mark.active = FALSE;
+  rv = mio->v_writev (mio, iov, iovcnt);
+  track_set (mio, 0, -1);
+  slow_path_end (mio);
+  
+  return (ssize_t) rv;
 }
 
 /**
@@ -378,7 +1439,7 @@ mio_write (MIO         *mio,
  * @c: The character to write
  * 
  * Writes a character to a #MIO stream. This function behaves the same as
- * fputc().
+ * fputc(). See also MIO_PUTC().
  * 
  * Returns: The written wharacter, or %EOF on error.
  */
@@ -386,7 +1447,21 @@ int
 mio_putc (MIO  *mio,
           int   c)
 {
-  return mio->v_putc (mio, c);
+  int rv;
+  
+  if (mio->write_ptr < mio->write_end) {
+    *mio->write_ptr++ = (unsigned char) c;
+    return (int) ((unsigned char) c);
+  }
+  
+  slow_path_begin (mio);
+  unget_discard (mio);
+  mio->mark.active = FALSE;
+  track_set (mio, 0, -1);
+  rv = mio->v_putc (mio, c);
+  slow_path_end (mio);
+  
+  return rv;
 }
 
 /**
@@ -402,7 +1477,16 @@ int
 mio_puts (MIO        *mio,
           const char *s)
 {
-  return mio->v_puts (mio, s);
+  int rv;
+  
+  slow_path_begin (mio);
+  unget_discard (mio);
+  mio->mark.active = FALSE;
+  track_set (mio, 0, -1);
+  rv = mio->v_puts (mio, s);
+  slow_path_end (mio);
+  
+  return rv;
 }
 
 /**
@@ -412,7 +1496,13 @@ mio_puts (MIO        *mio,
  * @ap: The variadic argument list for the format
  * 
  * Writes a formatted string into a #MIO stream. This function behaves the same
- * as vfprintf().
+ * as vfprintf(), but doesn't depend on the current locale: the output always is
+ * the one of the C locale, so for example the decimal point is always a dot.
+ * Wide characters and strings (%%lc and %%ls) and positional arguments are not
+ * supported, and long doubles are printed with the precision of a double.
+ * 
+ * Memory, file and file descriptor streams format the output right into their
+ * buffer, without needing a temporary one.
  * 
  * Returns: The number of bytes written in the stream, or a negative value on
  *          failure.
@@ -422,7 +1512,16 @@ mio_vprintf (MIO         *mio,
              const char  *format,
              va_list      ap)
 {
-  return mio->v_vprintf (mio, format, ap);
+  int rv;
+  
+  slow_path_begin (mio);
+  unget_discard (mio);
+  mio->mark.active = FALSE;
+  track_set (mio, 0, -1);
+  rv = mio->v_vprintf (mio, format, ap);
+  slow_path_end (mio);
+  
+  return rv;
 }
 
 /**
@@ -432,7 +1531,7 @@ mio_vprintf (MIO         *mio,
  * @...: Arguments of the format
  * 
  * Writes a formatted string to a #MIO stream. This function behaves the same as
- * fprintf().
+ * fprintf(), with the same differences as mio_vprintf().
  * 
  * Returns: The number of bytes written to the stream, or a negative value on
  *          failure.
@@ -445,228 +1544,2132 @@ mio_printf (MIO         *mio,
   int     rv;
   va_list ap;
   
+  slow_path_begin (mio);
+  unget_discard (mio);
+  mio->mark.active = FALSE;
+  track_set (mio, 0, -1);
   va_start (ap, format);
   rv = mio->v_vprintf (mio, format, ap);
   va_end (ap);
+  slow_path_end (mio);
   
   return rv;
 }
 
 /**
- * mio_getc:
- * @mio: A #MIO object
+ * mio_format_compile:
+ * @format: A printf format string
  * 
- * Gets the current character from a #MIO stream. This function behaves the same
- * as fgetc().
+ * Compiles a printf format string for mio_printf_compiled(), so that writing
+ * it again and again doesn't require parsing it each time.  The literal text
+ * of the format is written with a plain copy, and the conversions directly
+ * formatted.  The format string is copied and may be freed afterwards.
  * 
- * Returns: The read character as a #gint, or %EOF on error.
+ * The format supports the same conversions as mio_printf().
+ * 
+ * Returns: A new #MIOFormat to free with mio_format_free(), or %NULL on
+ *          failure, in which case errno is set to indicate the error.  An
+ *          invalid or unsupported format sets errno to %EINVAL.
  */
-int
-mio_getc (MIO *mio)
+MIOFormat *
+mio_format_compile (const char *format)
 {
-  return mio->v_getc (mio);
+  return format_compile (format);
 }
 
 /**
- * mio_ungetc:
+ * mio_format_free:
+ * @format: A #MIOFormat
+ * 
+ * Frees a format compiled with mio_format_compile().
+ */
+void
+mio_format_free (MIOFormat *format)
+{
+  free (format);
+}
+
+/**
+ * mio_vprintf_compiled:
  * @mio: A #MIO object
- * @ch: Character to put back in the stream
+ * @format: A format compiled with mio_format_compile()
+ * @ap: The variadic argument list for the format
  * 
- * Puts a character back in a #MIO stream. This function behaves the sames as
- * ungetc().
+ * Writes a formatted string into a #MIO stream, the same as mio_vprintf()
+ * would with the format @format was compiled from.
  * 
- * <warning><para>It is only guaranteed that one character can be but back at a
- * time, even if the implementation may allow more.</para></warning>
- * <warning><para>Using this function while the stream cursor is at offset 0 is
- * not guaranteed to function properly. As the C99 standard says, it is "an
- * obsolescent feature".</para></warning>
+ * <warning><para>As the compiler doesn't know about the format, it can't check
+ * that the arguments match it.</para></warning>
  * 
- * Returns: The character put back, or %EOF on error.
+ * Returns: The number of bytes written in the stream, or a negative value on
+ *          failure.
  */
 int
-mio_ungetc (MIO  *mio,
-            int   ch)
+mio_vprintf_compiled (MIO             *mio,
+                      const MIOFormat *format,
+                      va_list          ap)
 {
-  return mio->v_ungetc (mio, ch);
+  int rv;
+  
+  slow_path_begin (mio);
+  unget_discard (mio);
+  mio->mark.active = FALSE;
+  track_set (mio, 0, -1);
+  rv = format_vprintf_compiled (mio, format, ap);
+  slow_path_end (mio);
+  
+  return rv;
 }
 
 /**
- * mio_gets:
+ * mio_printf_compiled:
  * @mio: A #MIO object
- * @s: A string to fill with the read data
- * @size: The maximum number of bytes to read
+ * @format: A format compiled with mio_format_compile()
+ * @...: Arguments of the format
  * 
- * Reads a string from a #MIO stream, stopping after the first new-line
- * character or at the end of the stream. This function behaves the same as
- * fgets().
+ * Writes a formatted string to a #MIO stream.  See mio_vprintf_compiled().
  * 
- * Returns: @s on success, %NULL otherwise.
+ * Returns: The number of bytes written to the stream, or a negative value on
+ *          failure.
  */
-char *
-mio_gets (MIO    *mio,
-          char   *s,
-          size_t  size)
+int
+mio_printf_compiled (MIO             *mio,
+                     const MIOFormat *format,
+                     ...)
 {
-  return mio->v_gets (mio, s, size);
+  int     rv;
+  va_list ap;
+  
+  slow_path_begin (mio);
+  unget_discard (mio);
+  mio->mark.active = FALSE;
+  track_set (mio, 0, -1);
+  va_start (ap, format);
+  rv = format_vprintf_compiled (mio, format, ap);
+  va_end (ap);
+  slow_path_end (mio);
+  
+  return rv;
 }
 
-/**
- * mio_clearerr:
+/*
+ * put_raw:
+ * @mio: A #MIO object
+ * @ptr: The bytes to write
+ * @n: Number of bytes to write
+ * 
+ * Writes @n bytes to @mio, copying them right into the write window when there
+ * is room.  Short writes otherwise go through mio_write_reserve() so that the
+ * window is open for the next ones, and only large writes fall back to
+ * mio_write().
+ * 
+ * Returns: 0 on success, -1 on failure.
+ */
+static int
+put_raw (MIO         *mio,
+         const void  *ptr,
+         size_t       n)
+{
+  int rv = 0;
+  
+  if (mio->write_ptr && n <= (size_t) (mio->write_end - mio->write_ptr)) {
+    memcpy (mio->write_ptr, ptr, n);
+    mio->write_ptr += n;
+  } else if (n <= MIO_PUT_RESERVE_MAX) {
+    void *dest = mio_write_reserve (mio, n);
+    
+    if (! dest) {
+      rv = -1;
+    } else {
+      memcpy (dest, ptr, n);
+      rv = mio_write_commit (mio, n);
+    }
+  } else if (n > 0 && mio_write (mio, ptr, n, 1) != 1) {
+    rv = -1;
+  }
+  
+  return rv;
+}
+
+/**
+ * mio_put_n:
+ * @mio: A #MIO object
+ * @s: The string to write
+ * @n: Number of bytes of @s to write
+ * 
+ * Writes the first @n bytes of @s to a #MIO stream.  Unlike mio_puts(), @s
+ * doesn't need to be nul-terminated and may contain nul bytes.  Short strings
+ * are copied straight into the stream's buffer.
+ * 
+ * Returns: 0 on success, -1 on failure.
+ */
+int
+mio_put_n (MIO         *mio,
+           const char  *s,
+           size_t       n)
+{
+  return put_raw (mio, s, n);
+}
+
+/**
+ * mio_put_uint64:
+ * @mio: A #MIO object
+ * @value: The value to write
+ * 
+ * Writes the decimal representation of @value to a #MIO stream, the same as
+ * mio_printf() with a "%" PRIu64 format would, but without parsing any format
+ * and straight into the stream's buffer.
+ * 
+ * Returns: 0 on success, -1 on failure.
+ */
+int
+mio_put_uint64 (MIO     *mio,
+                uint64_t value)
+{
+  char  buf[24];
+  char *p = format_decimal (&buf[sizeof buf], value);
+  
+  return put_raw (mio, p, (size_t) (&buf[sizeof buf] - p));
+}
+
+/**
+ * mio_put_int:
+ * @mio: A #MIO object
+ * @value: The value to write
+ * 
+ * Writes the decimal representation of @value to a #MIO stream, the same as
+ * mio_printf() with a "%ld" format would.  See mio_put_uint64().
+ * 
+ * Returns: 0 on success, -1 on failure.
+ */
+int
+mio_put_int (MIO *mio,
+             long value)
+{
+  char      buf[24];
+  char     *p;
+  uint64_t  magnitude;
+  
+  /* negate as unsigned so that LONG_MIN doesn't overflow */
+  magnitude = (value < 0) ? 0 - (uint64_t) value : (uint64_t) value;
+  p = format_decimal (&buf[sizeof buf], magnitude);
+  if (value < 0) {
+    *--p = '-';
+  }
+  
+  return put_raw (mio, p, (size_t) (&buf[sizeof buf] - p));
+}
+
+/**
+ * mio_put_hex:
+ * @mio: A #MIO object
+ * @value: The value to write
+ * 
+ * Writes the hexadecimal representation of @value to a #MIO stream, in lower
+ * case and without any prefix, the same as mio_printf() with a "%" PRIx64
+ * format would.
+ * 
+ * Returns: 0 on success, -1 on failure.
+ */
+int
+mio_put_hex (MIO     *mio,
+             uint64_t value)
+{
+  static const char digits[] = "0123456789abcdef";
+  char              buf[16];
+  char             *p = &buf[sizeof buf];
+  
+  do {
+    *--p = digits[value & 0xf];
+    value >>= 4;
+  } while (value);
+  
+  return put_raw (mio, p, (size_t) (&buf[sizeof buf] - p));
+}
+
+/*
+ * put_double_round_trips:
+ * @value: A finite double
+ * @precision: Number of significant digits
+ * 
+ * Checks whether @value rounded to @precision significant digits reads back
+ * as @value.  The digits are given to strtod() without any decimal point so
+ * that the current locale doesn't matter.
+ * 
+ * Returns: %TRUE if @value round-trips, %FALSE otherwise.
+ */
+static int
+put_double_round_trips (double value,
+                        int    precision)
+{
+  char    buf[FORMAT_FLOAT_BUFFER_SIZE];
+  char    ebuf[8];
+  char   *estr;
+  char   *e;
+  char   *p;
+  size_t  len = format_float_buffer (buf, precision - 1, 'e', value);
+  long    exponent = 0;
+  
+  /* turn [-]d.ddde[+-]xx into [-]dddde[-]yy */
+  e = memchr (buf, 'e', len);
+  for (p = e + 2; p < &buf[len]; p++) {
+    exponent = exponent * 10 + (*p - '0');
+  }
+  if (e[1] == '-') {
+    exponent = -exponent;
+  }
+  exponent -= precision - 1;
+  p = memchr (buf, '.', (size_t) (e - buf));
+  if (p) {
+    memmove (p, p + 1, (size_t) (e - p - 1));
+    e--;
+  }
+  *e++ = 'e';
+  if (exponent < 0) {
+    *e++ = '-';
+    exponent = -exponent;
+  }
+  estr = format_decimal (&ebuf[sizeof ebuf], (uintmax_t) exponent);
+  len = (size_t) (&ebuf[sizeof ebuf] - estr);
+  memcpy (e, estr, len);
+  e[len] = 0;
+  
+  return strtod (buf, NULL) == value;
+}
+
+/**
+ * mio_put_double:
+ * @mio: A #MIO object
+ * @value: The value to write
+ * 
+ * Writes @value to a #MIO stream with just enough digits for it to read back as
+ * exactly the same double, so 0.1 is written as "0.1" rather than
+ * "0.10000000000000001" and 5e-324 as "5e-324".  The digits are the ones of
+ * the closest decimal that reads back exactly.  For a few powers of two a
+ * shorter decimal that isn't the closest one exists, so the output is not
+ * always the shortest possible.  The layout is the one of the "%.15g" format,
+ * or "%.16g" or "%.17g" when more digits are needed, so values from 0.0001 up
+ * to about 1e15 are written without an exponent.  The decimal separator is
+ * always a dot whatever the current locale is.  Infinities and NaNs are
+ * written as "inf" and "nan".
+ * 
+ * Returns: 0 on success, -1 on failure.
+ */
+int
+mio_put_double (MIO   *mio,
+                double value)
+{
+  char      buf[FORMAT_FLOAT_BUFFER_SIZE];
+  int       precision = 17;
+  uint64_t  bits;
+  
+  memcpy (&bits, &value, sizeof bits);
+  if (value - value == 0 && value != 0) {
+    /* any decimal of at most 15 digits reads back as the closest normal
+     * double, so when a normal double has a representation that short it's
+     * the one rounded to 15 digits, and %g strips the trailing zeros.
+     * Subnormals have fewer significant bits and powers of two are closer to
+     * their lower neighbor, so look at every precision for them */
+    if ((bits & ((uint64_t) 0x7ff << 52)) == 0 ||
+        (bits & (((uint64_t) 1 << 52) - 1)) == 0) {
+      precision = 1;
+    } else {
+      precision = 15;
+    }
+    while (precision < 17 && ! put_double_round_trips (value, precision)) {
+      precision++;
+    }
+  }
+  
+  return put_raw (mio, buf, format_float_buffer (buf, precision, 'g', value));
+}
+
+/**
+ * mio_getc:
+ * @mio: A #MIO object
+ * 
+ * Gets the current character from a #MIO stream. This function behaves the same
+ * as fgetc(). See also MIO_GETC().
+ * 
+ * Returns: The read character as a #gint, or %EOF on error.
+ */
+int
+mio_getc (MIO *mio)
+{
+  int c;
+  
+  if (mio->read_ptr < mio->read_end) {
+    return *mio->read_ptr++;
+  }
+  
+  slow_path_begin (mio);
+  c = mio->v_getc (mio);
+  if (c != EOF && mio->track.enabled) {
+    unsigned char b = (unsigned char) c;
+    
+    track_count (mio, &b, 1);
+  }
+  slow_path_end (mio);
+  
+  return c;
+}
+
+/**
+ * mio_ungetc:
+ * @mio: A #MIO object
+ * @ch: Character to put back in the stream
+ * 
+ * Puts a character back in a #MIO stream. This function behaves the sames as
+ * ungetc().
+ * 
+ * Up to %MIO_UNGET_MAX characters can be put back in a row, on all kinds of
+ * streams.  They are read again before the stream's data, in the reverse order
+ * they were put back, and the cursor moves back by one for each of them.
+ * Seeking, writing or calling mio_setpos() drops them.  See also mio_ungetn().
+ * 
+ * <warning><para>Using this function while the stream cursor is at offset 0 is
+ * not guaranteed to function properly. As the C99 standard says, it is "an
+ * obsolescent feature".</para></warning>
+ * 
+ * Returns: The character put back, or %EOF on error.
+ */
+int
+mio_ungetc (MIO  *mio,
+            int   ch)
+{
+  int rv = EOF;
+  
+  slow_path_begin (mio);
+  if (ch != EOF) {
+    /* let the implementation take the character if it can, unless it would
+     * come before others already pushed back or change the data kept for
+     * mio_reset() */
+    if (! mio->unget.active && ! mio->mark.active) {
+      rv = mio->v_ungetc (mio, ch);
+    }
+    if (rv == EOF &&
+        (! mio->unget.active || mio->unget.ptr > mio->unget.buf)) {
+      unget_push (mio, (unsigned char) ch);
+      rv = (int) ((unsigned char) ch);
+    }
+    if (rv != EOF) {
+      track_unget (mio, (unsigned char) rv);
+    }
+  }
+  slow_path_end (mio);
+  
+  return rv;
+}
+
+/**
+ * mio_ungetn:
+ * @mio: A #MIO object
+ * @ptr: The characters to put back
+ * @n: The number of characters to put back
+ * 
+ * Puts several characters back in a #MIO stream at once, so that they are read
+ * again in the same order they appear in @ptr.  This is the same as calling
+ * mio_ungetc() on each of them starting from the last one, except that either
+ * all of them or none are put back.
+ * 
+ * Returns: 0 on success, -1 if there isn't enough room for @n more characters,
+ *          see %MIO_UNGET_MAX, in which case errno is set to %ENOSPC.
+ */
+int
+mio_ungetn (MIO        *mio,
+            const void *ptr,
+            size_t      n)
+{
+  const unsigned char  *p   = ptr;
+  int                   rv  = -1;
+  size_t                room;
+  
+  slow_path_begin (mio);
+  if (mio->unget.active) {
+    room = (size_t) (mio->unget.ptr - mio->unget.buf);
+  } else {
+    room = MIO_UNGET_MAX;
+  }
+  if (n > room) {
+    errno = ENOSPC;
+  } else {
+    /* always give the last character to the implementation first if it can
+     * take it, as this also finishes pending writes */
+    if (n > 0 && ! mio->unget.active && ! mio->mark.active &&
+        mio->v_ungetc (mio, p[n - 1]) != EOF) {
+      track_unget (mio, p[--n]);
+    }
+    while (n > 0) {
+      unget_push (mio, p[--n]);
+      track_unget (mio, p[n]);
+    }
+    rv = 0;
+  }
+  slow_path_end (mio);
+  
+  return rv;
+}
+
+/**
+ * mio_gets:
+ * @mio: A #MIO object
+ * @s: A string to fill with the read data
+ * @size: The maximum number of bytes to read
+ * 
+ * Reads a string from a #MIO stream, stopping after the first new-line
+ * character or at the end of the stream. This function behaves the same as
+ * fgets().
+ * 
+ * Returns: @s on success, %NULL otherwise.
+ */
+char *
+mio_gets (MIO    *mio,
+          char   *s,
+          size_t  size)
+{
+  char   *rv = NULL;
+  size_t  i  = 0;
+  
+  if (size > 1 && mio->read_ptr < mio->read_end) {
+    /* start with what's in the read window, e.g. pushed back characters */
+    const unsigned char *nl;
+    
+    i = MIN (size - 1, (size_t) (mio->read_end - mio->read_ptr));
+    nl = memchr (mio->read_ptr, '\n', i);
+    if (nl) {
+      i = (size_t) (nl - mio->read_ptr) + 1;
+    }
+    memcpy (s, mio->read_ptr, i);
+    mio->read_ptr += i;
+  }
+  
+  slow_path_begin (mio);
+  if (i > 0 && (s[i - 1] == '\n' || i == size - 1)) {
+    s[i] = 0;
+    rv = s;
+  } else if (mio->v_gets (mio, &s[i], size - i)) {
+    if (mio->track.enabled) {
+      track_count (mio, (const unsigned char *) &s[i], strlen (&s[i]));
+    }
+    rv = s;
+  } else if (i > 0) {
+    s[i] = 0;
+    rv = s;
+  }
+  slow_path_end (mio);
+  
+  return rv;
+}
+
+/**
+ * mio_gets_len:
+ * @mio: A #MIO object
+ * @s: A string to fill with the read data
+ * @size: The maximum number of bytes to read
+ * 
+ * Reads a string from a #MIO stream just like mio_gets(), but returns its
+ * length so it doesn't have to be computed again.  This also allows to read
+ * data containing nul bytes.
+ * 
+ * Returns: The number of bytes read, not including the trailing nul byte, or
+ *          -1 if the end of the stream was reached or an error occurred before
+ *          anything could be read.
+ */
+ssize_t
+mio_gets_len (MIO    *mio,
+              char   *s,
+              size_t  size)
+{
+  ssize_t rv = -1;
+  
+  if (size > 0) {
+    size_t i = 0;
+    
+    while (i < size - 1) {
+      const unsigned char  *p;
+      const unsigned char  *nl;
+      size_t                n;
+      
+      p = mio_peek (mio, &n);
+      if (! p) {
+        break;
+      }
+      if (n > size - 1 - i) {
+        n = size - 1 - i;
+      }
+      nl = memchr (p, '\n', n);
+      if (nl) {
+        n = (size_t) (nl - p) + 1;
+      }
+      memcpy (&s[i], p, n);
+      mio_consume (mio, n);
+      i += n;
+      if (nl) {
+        break;
+      }
+    }
+    if (i > 0 || size == 1) {
+      s[i] = 0;
+      rv = (ssize_t) i;
+    }
+  }
+  
+  return rv;
+}
+
+/**
+ * mio_getdelim:
+ * @mio: A #MIO object
+ * @lineptr: (inout): Location of a buffer allocated with malloc(), or of
+ *           %NULL
+ * @n: (inout): Location of the size of *@lineptr
+ * @delim: The delimiter character
+ * 
+ * Reads a string from a #MIO stream, stopping after the first occurrence of
+ * @delim or at the end of the stream.  This function behaves the same as
+ * getdelim(): *@lineptr is grown with realloc() as needed to hold the whole
+ * string and its trailing nul byte, and *@n is updated accordingly.  The
+ * caller should free *@lineptr with free() when done with it.
+ * 
+ * Returns: The number of bytes read, including the delimiter but not the
+ *          trailing nul byte, or -1 if the end of the stream was reached or an
+ *          error occurred before anything could be read, in which case errno
+ *          may be set to indicate the error.
+ */
+ssize_t
+mio_getdelim (MIO     *mio,
+              char   **lineptr,
+              size_t  *n,
+              int      delim)
+{
+  ssize_t rv  = -1;
+  size_t  len = 0;
+  
+  if (! lineptr || ! n) {
+    errno = EINVAL;
+    return -1;
+  }
+  
+  for (;;) {
+    const unsigned char  *p;
+    const unsigned char  *d;
+    size_t                avail;
+    
+    p = mio_peek (mio, &avail);
+    if (! p) {
+      break;
+    }
+    d = memchr (p, delim, avail);
+    if (d) {
+      avail = (size_t) (d - p) + 1;
+    }
+    if (avail >= ((size_t) -1 >> 1) - len) {
+      #ifdef EOVERFLOW
+      errno = EOVERFLOW;
+      #endif
+      return -1;
+    }
+    if (len + avail + 1 > *n || ! *lineptr) {
+      size_t  new_size  = MAX (MAX (len + avail + 1, *n * 2), 128);
+      char   *new_line  = realloc (*lineptr, new_size);
+      
+      if (! new_line) {
+        errno = ENOMEM;
+        return -1;
+      }
+      *lineptr = new_line;
+      *n = new_size;
+    }
+    memcpy (&(*lineptr)[len], p, avail);
+    mio_consume (mio, avail);
+    len += avail;
+    if (d) {
+      break;
+    }
+  }
+  if (len > 0) {
+    (*lineptr)[len] = 0;
+    rv = (ssize_t) len;
+  }
+  
+  return rv;
+}
+
+/*
+ * peek_reaches_end:
+ * @mio: A #MIO object
+ * @p: The value returned by the last call to mio_peek()
+ * @avail: The size returned by the last call to mio_peek()
+ * 
+ * Checks whether a block returned by mio_peek() extends up to the end of the
+ * stream, in which case it is known to stay valid after being consumed.
+ * 
+ * Returns: %TRUE if there is no data past the block, %FALSE if there is or if
+ *          it is unknown.
+ */
+static int
+peek_reaches_end (MIO                  *mio,
+                  const unsigned char  *p,
+                  size_t                avail)
+{
+  int rv = FALSE;
+  
+  /* pushed back characters aren't part of the stream's buffer */
+  if (p == mio->read_ptr && ! mio->unget.active) {
+    switch (mio->type) {
+      case MIO_TYPE_MEMORY:
+        rv = TRUE;
+        break;
+      
+      case MIO_TYPE_MMAP:
+        rv = mio->impl.mmap.pos + (off_t) avail >= mio->impl.mmap.size;
+        break;
+    }
+  }
+  
+  return rv;
+}
+
+/*
+ * line_buf_grow:
+ * @mio: A #MIO object
+ * @n: The number of bytes already in mio->line_buf
+ * @more: The number of bytes to add
+ * 
+ * Makes room in the buffer used to gather data that isn't contiguous in the
+ * stream's buffer, see mio_next_line().
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise, in which case errno is set to
+ *          indicate the error.
+ */
+static int
+line_buf_grow (MIO    *mio,
+               size_t  n,
+               size_t  more)
+{
+  int success = TRUE;
+  
+  if (more >= ((size_t) -1 >> 1) - n) {
+    #ifdef EOVERFLOW
+    errno = EOVERFLOW;
+    #endif
+    success = FALSE;
+  } else if (n + more > mio->line_buf_size) {
+    size_t          new_size;
+    unsigned char  *new_buf;
+    
+    new_size = MAX (MAX (n + more, mio->line_buf_size * 2), 128);
+    new_buf = realloc (mio->line_buf, new_size);
+    if (! new_buf) {
+      errno = ENOMEM;
+      success = FALSE;
+    } else {
+      mio->line_buf = new_buf;
+      mio->line_buf_size = new_size;
+    }
+  }
+  
+  return success;
+}
+
+/**
+ * mio_next_line:
+ * @mio: A #MIO object
+ * @ptr: (out): Return location for the address of the line
+ * @len: (out): Return location for the length of the line
+ * 
+ * Reads a line from a #MIO stream without copying it when possible.  The line
+ * ends after the first newline character or at the end of the stream, and
+ * *@len includes the newline if any.
+ * 
+ * When the whole line is available in the stream's buffer, as is always the
+ * case with memory streams, *@ptr points directly into it.  Otherwise the line
+ * is gathered in a buffer owned by @mio that grows as needed, so lines of any
+ * length are returned at once.
+ * 
+ * <warning><para>The returned line is not nul-terminated, must not be
+ * modified, and is only valid until the next operation on the
+ * stream.</para></warning>
+ * 
+ * Returns: 0 on success, -1 if the end of the stream was reached or an error
+ *          occurred before anything could be read, in which case errno may be
+ *          set to indicate the error.
+ */
+int
+mio_next_line (MIO                  *mio,
+               const unsigned char **ptr,
+               size_t               *len)
+{
+  const unsigned char  *p;
+  const unsigned char  *nl;
+  size_t                avail;
+  size_t                n = 0;
+  
+  p = mio_peek (mio, &avail);
+  if (! p) {
+    return -1;
+  }
+  nl = memchr (p, '\n', avail);
+  if (nl || peek_reaches_end (mio, p, avail)) {
+    /* fast path, the line is contiguous */
+    *ptr = p;
+    *len = nl ? (size_t) (nl - p) + 1 : avail;
+    mio_consume (mio, *len);
+    return 0;
+  }
+  
+  /* the line straddles the end of the buffer, gather it */
+  for (;;) {
+    if (nl) {
+      avail = (size_t) (nl - p) + 1;
+    }
+    if (! line_buf_grow (mio, n, avail)) {
+      return -1;
+    }
+    memcpy (&mio->line_buf[n], p, avail);
+    mio_consume (mio, avail);
+    n += avail;
+    if (nl || ! (p = mio_peek (mio, &avail))) {
+      break;
+    }
+    nl = memchr (p, '\n', avail);
+  }
+  
+  *ptr = mio->line_buf;
+  *len = n;
+  
+  return 0;
+}
+
+/* builds a character class table out of a predicate on a byte value, which
+ * must be a constant expression */
+#define CLASS_ROW(f, i)                                                   \
+  f ((i) + 0x0), f ((i) + 0x1), f ((i) + 0x2), f ((i) + 0x3),             \
+  f ((i) + 0x4), f ((i) + 0x5), f ((i) + 0x6), f ((i) + 0x7),             \
+  f ((i) + 0x8), f ((i) + 0x9), f ((i) + 0xa), f ((i) + 0xb),             \
+  f ((i) + 0xc), f ((i) + 0xd), f ((i) + 0xe), f ((i) + 0xf)
+#define CLASS_TABLE(f)                                                    \
+  { CLASS_ROW (f, 0x00), CLASS_ROW (f, 0x10), CLASS_ROW (f, 0x20),        \
+    CLASS_ROW (f, 0x30), CLASS_ROW (f, 0x40), CLASS_ROW (f, 0x50),        \
+    CLASS_ROW (f, 0x60), CLASS_ROW (f, 0x70), CLASS_ROW (f, 0x80),        \
+    CLASS_ROW (f, 0x90), CLASS_ROW (f, 0xa0), CLASS_ROW (f, 0xb0),        \
+    CLASS_ROW (f, 0xc0), CLASS_ROW (f, 0xd0), CLASS_ROW (f, 0xe0),        \
+    CLASS_ROW (f, 0xf0) }
+
+#define CLASS_IS_SPACE(c)   ((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
+#define CLASS_IS_BLANK(c)   ((c) == ' ' || (c) == '\t')
+#define CLASS_IS_DIGIT(c)   ((c) >= '0' && (c) <= '9')
+#define CLASS_IS_XDIGIT(c)  (CLASS_IS_DIGIT (c) || \
+                             ((c) >= 'a' && (c) <= 'f') || \
+                             ((c) >= 'A' && (c) <= 'F'))
+#define CLASS_IS_ALPHA(c)   (((c) >= 'a' && (c) <= 'z') || \
+                             ((c) >= 'A' && (c) <= 'Z'))
+#define CLASS_IS_IDENT(c)   (CLASS_IS_ALPHA (c) || CLASS_IS_DIGIT (c) || \
+                             (c) == '_')
+
+/**
+ * mio_class_space:
+ * 
+ * Character class table for white spaces: space, \t, \n, \v, \f and \r.
+ * See mio_skip_span().
+ */
+const unsigned char mio_class_space[256] = CLASS_TABLE (CLASS_IS_SPACE);
+/**
+ * mio_class_blank:
+ * 
+ * Character class table for blanks: space and \t.  See mio_skip_span().
+ */
+const unsigned char mio_class_blank[256] = CLASS_TABLE (CLASS_IS_BLANK);
+/**
+ * mio_class_digit:
+ * 
+ * Character class table for decimal digits.  See mio_skip_span().
+ */
+const unsigned char mio_class_digit[256] = CLASS_TABLE (CLASS_IS_DIGIT);
+/**
+ * mio_class_xdigit:
+ * 
+ * Character class table for hexadecimal digits, in both cases.  See
+ * mio_skip_span().
+ */
+const unsigned char mio_class_xdigit[256] = CLASS_TABLE (CLASS_IS_XDIGIT);
+/**
+ * mio_class_alpha:
+ * 
+ * Character class table for ASCII letters.  See mio_skip_span().
+ */
+const unsigned char mio_class_alpha[256] = CLASS_TABLE (CLASS_IS_ALPHA);
+/**
+ * mio_class_ident:
+ * 
+ * Character class table for identifier characters: ASCII letters, decimal
+ * digits and underscore.  See mio_skip_span().
+ */
+const unsigned char mio_class_ident[256] = CLASS_TABLE (CLASS_IS_IDENT);
+
+/*
+ * span_length:
+ * @table: A character class table
+ * @p: Data to scan
+ * @n: Size of @p
+ * 
+ * Returns: The length of the run of characters of @table starting at @p.
+ */
+static size_t
+span_length (const unsigned char *table,
+             const unsigned char *p,
+             size_t               n)
+{
+  size_t i = 0;
+  
+  /* look at several bytes per iteration, the lookups are independent */
+  while (n - i >= 4 &&
+         table[p[i]] && table[p[i + 1]] && table[p[i + 2]] && table[p[i + 3]]) {
+    i += 4;
+  }
+  while (i < n && table[p[i]]) {
+    i++;
+  }
+  
+  return i;
+}
+
+/**
+ * mio_skip_span:
+ * @mio: A #MIO object
+ * @table: A character class table
+ * 
+ * Skips a run of characters belonging to a character class in a #MIO stream,
+ * stopping before the first one that doesn't or at the end of the stream.
+ * 
+ * A character class table has 256 entries, one for each byte value, and a
+ * byte belongs to the class if its entry is not 0.  Some common classes are
+ * predefined, e.g. %mio_class_space or %mio_class_ident.  The run is scanned
+ * directly in the stream's buffer, which is much faster than reading it one
+ * character at a time.
+ * 
+ * Returns: The number of characters skipped.
+ */
+size_t
+mio_skip_span (MIO                 *mio,
+               const unsigned char *table)
+{
+  const unsigned char  *p;
+  size_t                avail;
+  size_t                n;
+  size_t                skipped = 0;
+  
+  while ((p = mio_peek (mio, &avail)) != NULL) {
+    n = span_length (table, p, avail);
+    mio_consume (mio, n);
+    skipped += n;
+    if (n < avail) {
+      break;
+    }
+  }
+  
+  return skipped;
+}
+
+/**
+ * mio_read_span:
+ * @mio: A #MIO object
+ * @table: A character class table
+ * @ptr: (out): Return location for the address of the run
+ * @len: (out): Return location for the length of the run
+ * 
+ * Reads a run of characters belonging to a character class in a #MIO stream,
+ * like mio_skip_span(), without copying it when possible.  *@len is 0 if the
+ * next character doesn't belong to the class, or if the end of the stream was
+ * reached, which can be told apart with mio_eof().
+ * 
+ * As with mio_next_line(), the run points directly into the stream's buffer if
+ * it is entirely there, and is otherwise gathered in a buffer owned by @mio.
+ * 
+ * <warning><para>The returned run is not nul-terminated, must not be modified,
+ * and is only valid until the next operation on the stream.</para></warning>
+ * 
+ * Returns: 0 on success, -1 if the run couldn't be gathered, in which case
+ *          errno is set to indicate the error.
+ */
+int
+mio_read_span (MIO                  *mio,
+               const unsigned char  *table,
+               const unsigned char **ptr,
+               size_t               *len)
+{
+  const unsigned char  *p;
+  size_t                avail;
+  size_t                span;
+  size_t                n = 0;
+  
+  p = mio_peek (mio, &avail);
+  if (! p) {
+    *ptr = NULL;
+    *len = 0;
+    return 0;
+  }
+  span = span_length (table, p, avail);
+  if (span < avail || peek_reaches_end (mio, p, avail)) {
+    /* fast path, the run is contiguous */
+    *ptr = p;
+    *len = span;
+    mio_consume (mio, span);
+    return 0;
+  }
+  
+  /* the run straddles the end of the buffer, gather it */
+  for (;;) {
+    if (! line_buf_grow (mio, n, span)) {
+      return -1;
+    }
+    memcpy (&mio->line_buf[n], p, span);
+    mio_consume (mio, span);
+    n += span;
+    if (span < avail || ! (p = mio_peek (mio, &avail))) {
+      break;
+    }
+    span = span_length (table, p, avail);
+  }
+  
+  *ptr = mio->line_buf;
+  *len = n;
+  
+  return 0;
+}
+
+/**
+ * mio_skip_to_byte:
+ * @mio: A #MIO object
+ * @c: The character to look for
+ * 
+ * Moves the cursor of a #MIO stream just after the next occurrence of @c,
+ * searching directly in the stream's buffer with memchr().  See also
+ * mio_find().
+ * 
+ * Returns: 0 if @c was found, -1 otherwise, in which case the cursor is at the
+ *          end of the stream, or an error occurred.
+ */
+int
+mio_skip_to_byte (MIO *mio,
+                  int  c)
+{
+  const unsigned char  *p;
+  const unsigned char  *found;
+  size_t                avail;
+  
+  while ((p = mio_peek (mio, &avail)) != NULL) {
+    found = memchr (p, c, avail);
+    if (found) {
+      mio_consume (mio, (size_t) (found - p) + 1);
+      return 0;
+    }
+    mio_consume (mio, avail);
+  }
+  
+  return -1;
+}
+
+/*
+ * find_in:
+ * @hay: Data to search in
+ * @n: Size of @hay
+ * @needle: Data to look for
+ * @len: Size of @needle, not 0
+ * 
+ * Returns: The first occurrence of @needle in @hay, or %NULL.
+ */
+static const unsigned char *
+find_in (const unsigned char *hay,
+         size_t               n,
+         const unsigned char *needle,
+         size_t               len)
+{
+  const unsigned char *p = hay;
+  const unsigned char *last;
+  
+  if (n < len) {
+    return NULL;
+  }
+  last = hay + (n - len);
+  /* memchr() is usually heavily optimized, so use it to find candidates */
+  while (p <= last &&
+         (p = memchr (p, needle[0], (size_t) (last - p) + 1)) != NULL) {
+    if (memcmp (p + 1, needle + 1, len - 1) == 0) {
+      return p;
+    }
+    p++;
+  }
+  
+  return NULL;
+}
+
+/*
+ * partial_start:
+ * @hay: Data to search in
+ * @n: Size of @hay
+ * @needle: Data to look for
+ * @len: Size of @needle
+ * 
+ * Finds the first position in the last @len - 1 bytes of @hay where @needle
+ * could start, that is where the rest of @hay is a prefix of @needle.
+ * 
+ * Returns: The offset of that position in @hay, or @n if there is none.
+ */
+static size_t
+partial_start (const unsigned char *hay,
+               size_t               n,
+               const unsigned char *needle,
+               size_t               len)
+{
+  size_t i;
+  
+  for (i = n - MIN (n, len - 1); i < n; i++) {
+    if (hay[i] == needle[0] && memcmp (&hay[i], needle, n - i) == 0) {
+      break;
+    }
+  }
+  
+  return i;
+}
+
+/**
+ * mio_find:
+ * @mio: A #MIO object
+ * @needle: The data to look for
+ * @len: The size of @needle
+ * 
+ * Moves the cursor of a #MIO stream just after the next occurrence of
+ * @needle, e.g. to skip the rest of a comment.  The search is done directly in
+ * the stream's buffer using memchr(), and also finds occurrences straddling
+ * two refills of the buffer.  See also mio_skip_to_byte().
+ * 
+ * Returns: 0 if @needle was found, -1 otherwise, in which case the cursor is
+ *          at the end of the stream, or an error occurred.
+ */
+int
+mio_find (MIO        *mio,
+          const void *needle,
+          size_t      len)
+{
+  const unsigned char  *n = needle;
+  const unsigned char  *p;
+  const unsigned char  *found;
+  size_t                avail;
+  unsigned char         stack_buf[256];
+  /* the end of the data consumed so far that could start an occurrence,
+   * followed by the start of the current block */
+  unsigned char        *carry = stack_buf;
+  size_t                carry_len = 0;
+  int                   rv = -1;
+  
+  if (len < 2) {
+    return len == 0 ? 0 : mio_skip_to_byte (mio, n[0]);
+  }
+  if (len > sizeof stack_buf / 2 && ! (carry = malloc (len * 2))) {
+    errno = ENOMEM;
+    return -1;
+  }
+  
+  while (rv != 0 && (p = mio_peek (mio, &avail)) != NULL) {
+    if (carry_len > 0) {
+      size_t m     = MIN (avail, len - 1);
+      size_t total = carry_len + m;
+      
+      memcpy (&carry[carry_len], p, m);
+      found = find_in (carry, MIN (total, carry_len - 1 + len), n, len);
+      if (found) {
+        mio_consume (mio, (size_t) (found - carry) + len - carry_len);
+        rv = 0;
+        continue;
+      } else if (m < len - 1) {
+        /* the block is too small to tell, keep going with the next one */
+        size_t start = partial_start (carry, total, n, len);
+        
+        memmove (carry, &carry[start], total - start);
+        carry_len = total - start;
+        mio_consume (mio, m);
+        continue;
+      }
+      carry_len = 0;
+    }
+    found = find_in (p, avail, n, len);
+    if (found) {
+      mio_consume (mio, (size_t) (found - p) + len);
+      rv = 0;
+    } else {
+      size_t start = partial_start (p, avail, n, len);
+      
+      carry_len = avail - start;
+      memcpy (carry, &p[start], carry_len);
+      mio_consume (mio, avail);
+    }
+  }
+  
+  if (carry != stack_buf) {
+    free (carry);
+  }
+  
+  return rv;
+}
+
+/**
+ * mio_clearerr:
  * @mio: A #MIO object
  * 
  * Clears the error and end-of-stream indicators of a #MIO stream. This function
  * behaves the same as clearerr().
  */
-void
-mio_clearerr (MIO *mio)
+void
+mio_clearerr (MIO *mio)
+{
+  slow_path_begin (mio);
+  mio->v_clearerr (mio);
+  slow_path_end (mio);
+}
+
+/**
+ * mio_eof:
+ * @mio: A #MIO object
+ * 
+ * Checks whether the end-of-stream indicator of a #MIO stream is set. This
+ * function behaves the same as feof().
+ * 
+ * Returns: A non-null value if the stream reached its end, 0 otherwise.
+ */
+int
+mio_eof (MIO *mio)
+{
+  int rv;
+  
+  slow_path_begin (mio);
+  /* pushed back characters are still to be read */
+  rv = unget_pending (mio) > 0 ? 0 : mio->v_eof (mio);
+  slow_path_end (mio);
+  
+  return rv;
+}
+
+/**
+ * mio_error:
+ * @mio: A #MIO object
+ * 
+ * Checks whether the error indicator of a #MIO stream is set. This function
+ * behaves the same as ferror().
+ * 
+ * Returns: A non-null value if the stream have an error set, 0 otherwise.
+ */
+int
+mio_error (MIO *mio)
+{
+  int rv;
+  
+  slow_path_begin (mio);
+  rv = mio->v_error (mio);
+  slow_path_end (mio);
+  
+  return rv;
+}
+
+/**
+ * mio_seek:
+ * @mio: A #MIO object
+ * @offset: Offset of the new place, from @whence
+ * @whence: Move origin. SEEK_SET moves relative to the start of the stream,
+ *          SEEK_CUR from the current position and SEEK_SET from the end of the
+ *          stream.
+ * 
+ * Sets the curosr position on a #MIO stream. This functions behaves the same as
+ * fseek(). See also mio_tell() and mio_setpos().
+ * 
+ * Returns: 0 on success, -1 otherwise, in which case errno should be set to
+ *          indicate the error.
+ */
+int
+mio_seek (MIO  *mio,
+          long  offset,
+          int   whence)
+{
+  int rv;
+  
+  slow_path_begin (mio);
+  if (whence == SEEK_CUR) {
+    /* the implementation's cursor is after the pushed back characters */
+    offset -= (long) unget_pending (mio);
+  }
+  mio->unget.active = FALSE;
+  mio->mark.active = FALSE;
+  rv = mio->v_seek (mio, offset, whence);
+  if (rv == 0) {
+    if (whence == SEEK_SET && offset == 0) {
+      track_set (mio, 1, 0);
+    } else if (whence != SEEK_CUR || offset != 0) {
+      track_set (mio, 0, -1);
+    }
+  }
+  slow_path_end (mio);
+  
+  return rv;
+}
+
+/**
+ * mio_tell:
+ * @mio: A #MIO object
+ * 
+ * Gets the current cursor position of a #MIO stream. This function behaves the
+ * same as ftell().
+ * 
+ * Returns: The current offset from the start of the stream, or -1 or error, in
+ *          which case errno is set to indicate the error.
+ */
+long
+mio_tell (MIO *mio)
+{
+  long rv;
+  
+  slow_path_begin (mio);
+  rv = mio->v_tell (mio);
+  if (rv >= 0) {
+    rv -= (long) unget_pending (mio);
+  }
+  slow_path_end (mio);
+  
+  return rv;
+}
+
+/**
+ * mio_rewind:
+ * @mio: A #MIO object
+ * 
+ * Resets the cursor position to 0, and also the end-of-stream and the error
+ * indicators of a #MIO stream.
+ * See also mio_seek() and mio_clearerr().
+ */
+void
+mio_rewind (MIO *mio)
+{
+  slow_path_begin (mio);
+  mio->unget.active = FALSE;
+  mio->mark.active = FALSE;
+  mio->v_rewind (mio);
+  track_set (mio, 1, 0);
+  slow_path_end (mio);
+}
+
+/**
+ * mio_getpos:
+ * @mio: A #MIO stream
+ * @pos: (out): A #MIOPos object to fill-in
+ * 
+ * Stores the current position (and maybe other informations about the stream
+ * state) of a #MIO stream in order to restore it later with mio_setpos(). This
+ * function behaves the same as fgetpos().
+ * 
+ * Returns: 0 on success, -1 otherwise, in which case errno is set to indicate
+ *          the error.
+ */
+int
+mio_getpos (MIO    *mio,
+            MIOPos *pos)
+{
+  int rv = -1;
+  
+  slow_path_begin (mio);
+  pos->type = mio->type;
+  pos->line = mio->track.line;
+  pos->column = mio->track.column;
+  pos->unget_len = (unsigned int) unget_pending (mio);
+  rv = mio->v_getpos (mio, pos);
+  slow_path_end (mio);
+  #ifdef MIO_DEBUG
+  if (rv != -1) {
+    pos->tag = mio;
+  }
+  #endif /* MIO_DEBUG */
+  
+  return rv;
+}
+
+/**
+ * mio_setpos:
+ * @mio: A #MIO object
+ * @pos: (in): A #MIOPos object filled-in by a previous call of mio_getpos() on
+ *       the same stream
+ * 
+ * Restores the position and state indicators of a #MIO stream previously saved
+ * by mio_getpos().
+ * 
+ * <warning><para>The #MIOPos object must have been initialized by a previous
+ * call to mio_getpos() on the same stream.</para></warning>
+ * 
+ * Returns: 0 on success, -1 otherwise, in which case errno is set to indicate
+ *          the error.
+ */
+int
+mio_setpos (MIO    *mio,
+            MIOPos *pos)
+{
+  int rv = -1;
+  
+  #ifdef MIO_DEBUG
+  if (pos->tag != mio) {
+    fprintf(stderr, "** MIO-CRITICAL: mio_setpos((MIO*)%p, (MIOPos*)%p): "
+                    "Given MIOPos was not set by a previous call to "
+                    "mio_getpos() on the same MIO object, which means there is "
+                    "a bug in someone's code.\n",
+                    (void *) mio, (void *) pos);
+    errno = EINVAL;
+    return -1;
+  }
+  #endif /* MIO_DEBUG */
+  slow_path_begin (mio);
+  mio->unget.active = FALSE;
+  mio->mark.active = FALSE;
+  rv = mio->v_setpos (mio, pos);
+  if (rv == 0 && pos->unget_len > 0) {
+    /* the implementation's position was after the characters pushed back */
+    rv = mio->v_seek (mio, - (long) pos->unget_len, SEEK_CUR);
+  }
+  if (rv == 0) {
+    track_set (mio, pos->line, pos->column);
+  }
+  slow_path_end (mio);
+  
+  return rv;
+}
+
+/**
+ * mio_mark:
+ * @mio: A #MIO object
+ * @limit: The number of bytes that can be read before the mark is dropped
+ * 
+ * Marks the current position of a #MIO stream, so that mio_reset() can go back
+ * to it without seeking as long as no more than @limit bytes were read since.
+ * 
+ * This works on all kinds of streams, including pipes and other files that
+ * can't seek: the data read after the mark is kept in the stream's buffer,
+ * which grows as needed.  Memory and mapped streams only remember the position
+ * and can always go back to it.  Characters pushed back with mio_ungetc() are
+ * part of the marked position.
+ * 
+ * Setting a mark replaces the previous one.  Writing, seeking or calling
+ * mio_setpos() drops it.
+ * 
+ * Returns: 0 on success, -1 otherwise, in which case errno is set to indicate
+ *          the error.
+ */
+int
+mio_mark (MIO    *mio,
+          size_t  limit)
+{
+  int rv;
+  
+  slow_path_begin (mio);
+  mio->mark.active = FALSE;
+  rv = mio->v_mark (mio);
+  if (rv == 0) {
+    mio->mark.limit = limit;
+    mio->mark.line = mio->track.line;
+    mio->mark.column = mio->track.column;
+    mio->mark.unget_len = (unsigned int) unget_pending (mio);
+    if (mio->mark.unget_len > 0) {
+      memcpy (mio->mark.unget, mio->unget.ptr, mio->mark.unget_len);
+    }
+    mio->mark.active = TRUE;
+  }
+  slow_path_end (mio);
+  
+  return rv;
+}
+
+/**
+ * mio_reset:
+ * @mio: A #MIO object
+ * 
+ * Moves the cursor of a #MIO stream back to the position saved by the last
+ * call to mio_mark().  The mark stays, so this can be done several times.
+ * 
+ * Returns: 0 on success, -1 otherwise, in which case errno is set to indicate
+ *          the error.  If there is no mark, or if it was dropped because more
+ *          than its limit was read, errno is set to %EINVAL.
+ */
+int
+mio_reset (MIO *mio)
+{
+  int rv = -1;
+  
+  slow_path_begin (mio);
+  if (! mio->mark.active) {
+    errno = EINVAL;
+  } else {
+    mio->unget.active = FALSE;
+    rv = mio->v_reset (mio);
+    if (rv == 0) {
+      size_t i;
+      
+      for (i = mio->mark.unget_len; i > 0; i--) {
+        unget_push (mio, mio->mark.unget[i - 1]);
+      }
+      track_set (mio, mio->mark.line, mio->mark.column);
+    }
+  }
+  slow_path_end (mio);
+  
+  return rv;
+}
+
+/*
+ * line_index_size:
+ * @mio: A #MIO object of the type %MIO_TYPE_MEMORY or %MIO_TYPE_MMAP
+ * 
+ * Returns: The size of the data of @mio.
+ */
+static off_t
+line_index_size (MIO *mio)
 {
-  mio->v_clearerr (mio);
+  if (mio->type == MIO_TYPE_MEMORY) {
+    return (off_t) mio->impl.mem.size;
+  } else {
+    return mio->impl.mmap.size;
+  }
+}
+
+/*
+ * line_index_data:
+ * @mio: A #MIO object of the type %MIO_TYPE_MEMORY or %MIO_TYPE_MMAP
+ * @offset: Offset of the data to get
+ * @buf: A buffer to use if the data isn't directly accessible
+ * @buf_size: The size of @buf
+ * @len: (out): Return location for the number of bytes available
+ * 
+ * Gets the data of @mio at @offset without moving its cursor, pointing
+ * directly into the stream's memory when possible.
+ * 
+ * Returns: A pointer to the next *@len bytes of data, or %NULL if @offset is
+ *          at the end of the data or on error.
+ */
+static const unsigned char *
+line_index_data (MIO            *mio,
+                 off_t           offset,
+                 unsigned char  *buf,
+                 size_t          buf_size,
+                 size_t         *len)
+{
+  const unsigned char  *ptr = NULL;
+  off_t                 size = line_index_size (mio);
+  
+  if (offset >= size) {
+    /* nothing left */
+  } else if (mio->type == MIO_TYPE_MEMORY) {
+    ptr = &mio->impl.mem.buf[offset];
+    *len = (size_t) (size - offset);
+  } else if (mio->impl.mmap.map_offset == 0 &&
+             (off_t) mio->impl.mmap.map_size >= size) {
+    ptr = &mio->impl.mmap.map[offset];
+    *len = (size_t) (size - offset);
+  } else {
+    ssize_t n = mio->v_pread (mio, buf, buf_size, offset);
+    
+    if (n > 0) {
+      ptr = buf;
+      *len = (size_t) n;
+    }
+  }
+  
+  return ptr;
+}
+
+/*
+ * line_index_scan:
+ * @mio: A #MIO object of the type %MIO_TYPE_MEMORY or %MIO_TYPE_MMAP
+ * @offset: Offset up to which index the data
+ * @lines: Number of newlines after which stop indexing
+ * 
+ * Extends the line index of @mio, creating it if needed, until it either
+ * covers @offset, counts @lines newlines or reaches the end of the data.
+ * 
+ * Returns: The line index of @mio, or %NULL on failure, with errno set.
+ */
+static struct _MIOLineIndex *
+line_index_scan (MIO    *mio,
+                 off_t   offset,
+                 size_t  lines)
+{
+  struct _MIOLineIndex *index = mio->line_index;
+  
+  if (! index) {
+    index = malloc (sizeof *index);
+    if (! index || ! (index->samples = malloc (16 * sizeof *index->samples))) {
+      free (index);
+      errno = ENOMEM;
+      return NULL;
+    }
+    index->samples[0] = 0;
+    index->n_samples = 1;
+    index->allocated = 16;
+    index->scanned = 0;
+    index->lines = 0;
+    mio->line_index = index;
+  }
+  
+  while (index->scanned < offset && index->lines < lines) {
+    unsigned char         buf[4096];
+    const unsigned char  *p;
+    const unsigned char  *q;
+    const unsigned char  *nl;
+    size_t                len;
+    
+    p = line_index_data (mio, index->scanned, buf, sizeof buf, &len);
+    if (! p) {
+      break;
+    }
+    if ((off_t) len > offset - index->scanned) {
+      len = (size_t) (offset - index->scanned);
+    }
+    for (q = p; index->lines < lines &&
+                (nl = memchr (q, '\n', len - (size_t) (q - p))) != NULL;
+         q = nl + 1) {
+      if ((index->lines + 1) % MIO_LINE_INDEX_STEP == 0) {
+        if (index->n_samples >= index->allocated) {
+          off_t *samples;
+          
+          samples = realloc (index->samples,
+                             index->allocated * 2 * sizeof *samples);
+          if (! samples) {
+            index->scanned += (off_t) (nl - p);
+            errno = ENOMEM;
+            return NULL;
+          }
+          index->samples = samples;
+          index->allocated *= 2;
+        }
+        index->samples[index->n_samples++] = index->scanned +
+                                             (off_t) (nl + 1 - p);
+      }
+      index->lines++;
+    }
+    if (index->lines < lines) {
+      index->scanned += (off_t) len;
+    } else {
+      index->scanned += (off_t) (q - p);
+    }
+  }
+  
+  return index;
+}
+
+/*
+ * line_index_skip:
+ * @mio: A #MIO object of the type %MIO_TYPE_MEMORY or %MIO_TYPE_MMAP
+ * @offset: Offset from which start
+ * @end: Offset at which stop
+ * @lines: Maximum number of newlines to skip
+ * @count: (out): Return location for the number of newlines skipped
+ * 
+ * Moves past up to @lines newlines from @offset, without going past @end.
+ * 
+ * Returns: The offset after the last newline skipped, or @end if less than
+ *          @lines newlines were found.
+ */
+static off_t
+line_index_skip (MIO    *mio,
+                 off_t   offset,
+                 off_t   end,
+                 size_t  lines,
+                 size_t *count)
+{
+  *count = 0;
+  while (offset < end && *count < lines) {
+    unsigned char         buf[4096];
+    const unsigned char  *p;
+    const unsigned char  *nl;
+    size_t                len;
+    
+    p = line_index_data (mio, offset, buf, sizeof buf, &len);
+    if (! p) {
+      break;
+    }
+    if ((off_t) len > end - offset) {
+      len = (size_t) (end - offset);
+    }
+    while (*count < lines && (nl = memchr (p, '\n', len)) != NULL) {
+      (*count)++;
+      len -= (size_t) (nl + 1 - p);
+      offset += (off_t) (nl + 1 - p);
+      p = nl + 1;
+    }
+    if (*count < lines) {
+      offset += (off_t) len;
+    }
+  }
+  
+  return MIN (offset, end);
+}
+
+/*
+ * line_index_prepare:
+ * @mio: A #MIO object
+ * 
+ * Checks that @mio supports line indexing and makes sure its data size is up to
+ * date.
+ * 
+ * Returns: %TRUE if @mio supports line indexing, %FALSE otherwise, with errno
+ *          set.
+ */
+static int
+line_index_prepare (MIO *mio)
+{
+  int rv = TRUE;
+  
+  if (mio->type == MIO_TYPE_MEMORY) {
+    slow_path_begin (mio);
+    mem_sync (mio);
+    slow_path_end (mio);
+  } else if (mio->type != MIO_TYPE_MMAP) {
+    errno = EINVAL;
+    rv = FALSE;
+  }
+  
+  return rv;
 }
 
 /**
- * mio_eof:
+ * mio_seek_line:
  * @mio: A #MIO object
+ * @line: The line to go to, starting at 1
  * 
- * Checks whether the end-of-stream indicator of a #MIO stream is set. This
- * function behaves the same as feof().
+ * Moves the cursor of a #MIO stream to the start of a line.  This is only
+ * supported by memory and memory-mapped streams.
  * 
- * Returns: A non-null value if the stream reached its end, 0 otherwise.
+ * The offsets of the start of some lines are saved as the data is scanned, so
+ * going to a given line is fast even in large streams.  Scanning is done
+ * lazily, only as far as needed, and writing to the stream only invalidates
+ * the part of the index after the changed data.  Note however that data
+ * modified directly, e.g. through the memory returned by
+ * mio_memory_get_data(), is not noticed.
+ * 
+ * If line tracking is enabled, the line is updated accordingly.  See
+ * mio_set_line_tracking().
+ * 
+ * Returns: 0 on success, -1 otherwise, in which case errno is set to indicate
+ *          the error.  If @line doesn't exist errno is set to %EINVAL.
  */
 int
-mio_eof (MIO *mio)
+mio_seek_line (MIO  *mio,
+               long  line)
 {
-  return mio->v_eof (mio);
+  struct _MIOLineIndex *index;
+  off_t                 offset;
+  size_t                count;
+  
+  if (line < 1) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (! line_index_prepare (mio) ||
+      ! (index = line_index_scan (mio, line_index_size (mio),
+                                  (size_t) line - 1))) {
+    return -1;
+  }
+  if (index->lines < (size_t) line - 1) {
+    errno = EINVAL;
+    return -1;
+  }
+  
+  offset = line_index_skip (mio,
+                            index->samples[(line - 1) / MIO_LINE_INDEX_STEP],
+                            index->scanned,
+                            (size_t) (line - 1) % MIO_LINE_INDEX_STEP, &count);
+  if (offset != (off_t) (long) offset) {
+    #ifdef EOVERFLOW
+    errno = EOVERFLOW;
+    #endif
+    return -1;
+  }
+  if (mio_seek (mio, (long) offset, SEEK_SET) != 0) {
+    return -1;
+  }
+  track_set (mio, line, 0);
+  
+  return 0;
 }
 
 /**
- * mio_error:
+ * mio_offset_to_line:
  * @mio: A #MIO object
+ * @offset: An offset in the stream
  * 
- * Checks whether the error indicator of a #MIO stream is set. This function
- * behaves the same as ferror().
+ * Finds the line containing a given offset of a #MIO stream, without moving
+ * its cursor.  This uses the same index as mio_seek_line(), and is only
+ * supported by memory and memory-mapped streams.
  * 
- * Returns: A non-null value if the stream have an error set, 0 otherwise.
+ * Returns: The line at @offset, starting at 1, or -1 on error, in which case
+ *          errno is set to indicate the error.
  */
-int
-mio_error (MIO *mio)
+long
+mio_offset_to_line (MIO  *mio,
+                    long  offset)
+{
+  struct _MIOLineIndex *index;
+  size_t                lo;
+  size_t                hi;
+  size_t                count;
+  
+  if (! line_index_prepare (mio)) {
+    return -1;
+  }
+  if (offset < 0 || (off_t) offset > line_index_size (mio)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (! (index = line_index_scan (mio, (off_t) offset, (size_t) -1))) {
+    return -1;
+  }
+  
+  /* find the last sample not after @offset */
+  lo = 0;
+  hi = index->n_samples;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    
+    if (index->samples[mid] <= (off_t) offset) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  line_index_skip (mio, index->samples[lo], (off_t) offset, (size_t) -1,
+                   &count);
+  
+  return (long) (lo * MIO_LINE_INDEX_STEP + count + 1);
+}
+
+/**
+ * mio_set_line_tracking:
+ * @mio: A #MIO object
+ * @enabled: Whether to track the line and column of the cursor
+ * 
+ * Enables or disables line tracking on a #MIO stream.  When enabled, the stream
+ * keeps track of the line and column of its cursor as data is read, which can
+ * then be queried with mio_get_line(), mio_get_column() and
+ * mio_get_line_start().  The current position is taken as the start of the
+ * first line.
+ * 
+ * Newlines are counted in bulk when needed rather than on each character read,
+ * so MIO_GETC() is as fast as without tracking.  Pushing back characters with
+ * mio_ungetc() is accounted for, and mio_getpos() and mio_setpos() save and
+ * restore the line and column along with the position.
+ * 
+ * Only reading moves the tracked position: after writing to the stream, or
+ * seeking elsewhere than to the start of the stream, the line and column are
+ * unknown until the next call to mio_rewind() or mio_setpos().
+ */
+void
+mio_set_line_tracking (MIO *mio,
+                       int  enabled)
 {
-  return mio->v_error (mio);
+  track_sync (mio);
+  mio->track.enabled = enabled;
+  if (enabled) {
+    track_set (mio, 1, 0);
+  } else {
+    track_set (mio, 0, -1);
+  }
+  track_resume (mio);
 }
 
 /**
- * mio_seek:
+ * mio_get_line:
  * @mio: A #MIO object
- * @offset: Offset of the new place, from @whence
- * @whence: Move origin. SEEK_SET moves relative to the start of the stream,
- *          SEEK_CUR from the current position and SEEK_SET from the end of the
- *          stream.
  * 
- * Sets the curosr position on a #MIO stream. This functions behaves the same as
- * fseek(). See also mio_tell() and mio_setpos().
+ * Gets the line of the cursor of a #MIO stream with line tracking enabled.  See
+ * mio_set_line_tracking().
  * 
- * Returns: 0 on success, -1 otherwise, in which case errno should be set to
- *          indicate the error.
+ * Returns: The line number, starting at 1, or 0 if unknown.
  */
-int
-mio_seek (MIO  *mio,
-          long  offset,
-          int   whence)
+long
+mio_get_line (MIO *mio)
 {
-  return mio->v_seek (mio, offset, whence);
+  track_sync (mio);
+  track_resume (mio);
+  
+  return mio->track.enabled ? mio->track.line : 0;
 }
 
 /**
- * mio_tell:
+ * mio_get_column:
  * @mio: A #MIO object
  * 
- * Gets the current cursor position of a #MIO stream. This function behaves the
- * same as ftell().
+ * Gets the column of the cursor of a #MIO stream with line tracking enabled,
+ * that is the number of bytes between the start of the line and the cursor.
+ * See mio_set_line_tracking().
  * 
- * Returns: The current offset from the start of the stream, or -1 or error, in
- *          which case errno is set to indicate the error.
+ * Returns: The column, starting at 0, or -1 if unknown.
  */
 long
-mio_tell (MIO *mio)
+mio_get_column (MIO *mio)
 {
-  return mio->v_tell (mio);
+  track_sync (mio);
+  track_resume (mio);
+  
+  return mio->track.enabled ? mio->track.column : -1;
 }
 
 /**
- * mio_rewind:
+ * mio_get_line_start:
  * @mio: A #MIO object
  * 
- * Resets the cursor position to 0, and also the end-of-stream and the error
- * indicators of a #MIO stream.
- * See also mio_seek() and mio_clearerr().
+ * Gets the offset of the start of the current line of a #MIO stream with line
+ * tracking enabled.  See mio_set_line_tracking().
+ * 
+ * Returns: The offset of the start of the line, or -1 if unknown or on error.
  */
-void
-mio_rewind (MIO *mio)
+long
+mio_get_line_start (MIO *mio)
 {
-  mio->v_rewind (mio);
+  long column = mio_get_column (mio);
+  long offset = -1;
+  
+  if (column >= 0 && (offset = mio_tell (mio)) >= 0) {
+    offset -= column;
+  }
+  
+  return offset;
 }
 
 /**
- * mio_getpos:
- * @mio: A #MIO stream
- * @pos: (out): A #MIOPos object to fill-in
+ * mio_peek:
+ * @mio: A #MIO object
+ * @avail: (out): Return location for the number of bytes available at the
+ *         returned address
  * 
- * Stores the current position (and maybe other informations about the stream
- * state) of a #MIO stream in order to restore it later with mio_setpos(). This
- * function behaves the same as fgetpos().
+ * Gives direct access to the next bytes of a #MIO stream, without copying them
+ * nor moving the cursor.  Use mio_consume() to move the cursor past the bytes
+ * actually used.
  * 
- * Returns: 0 on success, -1 otherwise, in which case errno is set to indicate
- *          the error.
+ * The returned memory is the stream's own buffer: for memory streams this is
+ * the actual data, while file streams give their internal read buffer.  There
+ * is no guarantee on how many bytes are returned at once, only that there is
+ * at least one unless the end of the stream is reached.
+ * 
+ * <warning><para>The returned memory must not be modified, and is only valid
+ * until the next operation on the stream other than mio_consume() and
+ * mio_peek().</para></warning>
+ * 
+ * Returns: A pointer to the next @avail bytes of the stream, or %NULL if the
+ *          end of the stream is reached or an error occurred.
+ */
+const unsigned char *
+mio_peek (MIO    *mio,
+          size_t *avail)
+{
+  const unsigned char *p;
+  
+  if (mio->read_ptr < mio->read_end) {
+    *avail = (size_t) (mio->read_end - mio->read_ptr);
+    return mio->read_ptr;
+  }
+  
+  slow_path_begin (mio);
+  p = mio->v_peek (mio, avail);
+  slow_path_end (mio);
+  
+  return p;
+}
+
+/**
+ * mio_consume:
+ * @mio: A #MIO object
+ * @n: Number of bytes to consume
+ * 
+ * Moves the cursor of a #MIO stream past @n bytes previously returned by
+ * mio_peek().
+ * 
+ * Returns: 0 on success, -1 if @n is larger than what the last call to
+ *          mio_peek() returned, in which case errno is set to %EINVAL.
  */
 int
-mio_getpos (MIO    *mio,
-            MIOPos *pos)
+mio_consume (MIO   *mio,
+             size_t n)
 {
-  int rv = -1;
+  int rv;
   
-  pos->type = mio->type;
-  rv = mio->v_getpos (mio, pos);
-  #ifdef MIO_DEBUG
-  if (rv != -1) {
-    pos->tag = mio;
+  if (mio->read_ptr && n <= (size_t) (mio->read_end - mio->read_ptr)) {
+    mio->read_ptr += n;
+    return 0;
   }
-  #endif /* MIO_DEBUG */
+  
+  slow_path_begin (mio);
+  if (unget_pending (mio) > 0) {
+    /* mio_peek() only gave the pushed back characters */
+    errno = EINVAL;
+    rv = -1;
+  } else {
+    if (mio->track.enabled) {
+      const unsigned char  *p;
+      size_t                avail;
+      
+      /* the consumed data isn't in the window, e.g. a pushed back
+       * character */
+      p = mio->v_peek (mio, &avail);
+      if (p && n <= avail) {
+        track_count (mio, p, n);
+      }
+    }
+    rv = mio->v_consume (mio, n);
+  }
+  slow_path_end (mio);
   
   return rv;
 }
 
 /**
- * mio_setpos:
+ * mio_write_reserve:
  * @mio: A #MIO object
- * @pos: (in): A #MIOPos object filled-in by a previous call of mio_getpos() on
- *       the same stream
+ * @n: Number of bytes to reserve
  * 
- * Restores the position and state indicators of a #MIO stream previously saved
- * by mio_getpos().
+ * Gives direct access to the stream's buffer for writing up to @n bytes at the
+ * cursor position, without having to prepare them in a separate buffer first.
+ * Once the data is written, call mio_write_commit() with the number of bytes
+ * actually used.
  * 
- * <warning><para>The #MIOPos object must have been initialized by a previous
- * call to mio_getpos() on the same stream.</para></warning>
+ * For memory streams the returned memory is the stream's data itself, grown as
+ * needed, while file streams give their internal write buffer.  When the
+ * reserved bytes would overlap existing data, a separate buffer is given
+ * instead, so that the data past the committed bytes is left untouched.
+ * 
+ * <warning><para>The returned memory is only valid until the next call to
+ * mio_write_commit() or any other operation on the stream.</para></warning>
+ * 
+ * Returns: A pointer to at least @n writable bytes, or %NULL on failure.
+ */
+void *
+mio_write_reserve (MIO   *mio,
+                   size_t n)
+{
+  void *ptr;
+  
+  /* the window can only be handed out if it doesn't hold any data the caller
+   * might not commit */
+  if (mio->write_ptr && n <= (size_t) (mio->write_end - mio->write_ptr) &&
+      (! mio->write_data_end || mio->write_ptr >= mio->write_data_end)) {
+    return mio->write_ptr;
+  }
+  
+  slow_path_begin (mio);
+  unget_discard (mio);
+  mio->mark.active = FALSE;
+  track_set (mio, 0, -1);
+  ptr = mio->v_reserve (mio, n);
+  slow_path_end (mio);
+  
+  return ptr;
+}
+
+/**
+ * mio_write_commit:
+ * @mio: A #MIO object
+ * @n: Number of bytes actually written
+ * 
+ * Writes the first @n bytes of the memory returned by the last call to
+ * mio_write_reserve() to the stream, and moves the cursor past them.
  * 
  * Returns: 0 on success, -1 otherwise, in which case errno is set to indicate
- *          the error.
+ *          the error.  Committing more bytes than reserved is an error, and
+ *          sets errno to %EINVAL.
  */
 int
-mio_setpos (MIO    *mio,
-            MIOPos *pos)
+mio_write_commit (MIO   *mio,
+                  size_t n)
 {
-  int rv = -1;
+  int rv;
   
-  #ifdef MIO_DEBUG
-  if (pos->tag != mio) {
-    fprintf(stderr, "** MIO-CRITICAL: mio_setpos((MIO*)%p, (MIOPos*)%p): "
-                    "Given MIOPos was not set by a previous call to "
-                    "mio_getpos() on the same MIO object, which means there is "
-                    "a bug in someone's code.\n",
-                    (void *) mio, (void *) pos);
+  if (mio->write_ptr && n <= (size_t) (mio->write_end - mio->write_ptr)) {
+    mio->write_ptr += n;
+    return 0;
+  }
+  
+  slow_path_begin (mio);
+  unget_discard (mio);
+  mio->mark.active = FALSE;
+  track_set (mio, 0, -1);
+  rv = mio->v_commit (mio, n);
+  slow_path_end (mio);
+  
+  return rv;
+}
+
+/**
+ * mio_pread:
+ * @mio: A #MIO object
+ * @ptr: Pointer to the memory to fill with the read data
+ * @count: Maximum number of bytes to read
+ * @offset: Position in the stream from which to read
+ * 
+ * Reads raw data at a given position of a #MIO stream, without moving its
+ * cursor.  This function behaves the same as pread(), and ignores any
+ * character pushed back with mio_ungetc().
+ * 
+ * Concurrent calls to mio_pread() on the same stream from several threads are
+ * safe, as long as no other operation is performed on it at the same time.
+ * This allows to process different parts of a single stream in parallel.
+ * Note that the first call after writing to the stream may flush the written
+ * data, and is then not safe to call concurrently.
+ * 
+ * Not all file streams support this, e.g. pipes don't.
+ * 
+ * Returns: The number of bytes read, which may be smaller than @count e.g. if
+ *          the end of the stream was reached, or -1 on failure, in which case
+ *          errno is set to indicate the error.
+ */
+ssize_t
+mio_pread (MIO   *mio,
+           void  *ptr,
+           size_t count,
+           off_t  offset)
+{
+  if (offset < 0) {
     errno = EINVAL;
     return -1;
   }
-  #endif /* MIO_DEBUG */
-  rv = mio->v_setpos (mio, pos);
+  
+  return mio->v_pread (mio, ptr, count, offset);
+}
+
+/**
+ * mio_pwrite:
+ * @mio: A #MIO object
+ * @ptr: Pointer to the data to write
+ * @count: Number of bytes to write
+ * @offset: Position in the stream at which to write
+ * 
+ * Writes raw data at a given position of a #MIO stream, without moving its
+ * cursor.  This function behaves the same as pwrite(): writing after the end
+ * of the stream extends it, filling the gap with zeros.
+ * 
+ * Unlike mio_pread(), this function is not safe to call concurrently with any
+ * other operation on the same stream.
+ * 
+ * Returns: The number of bytes written, or -1 on failure, in which case errno
+ *          is set to indicate the error.
+ */
+ssize_t
+mio_pwrite (MIO        *mio,
+            const void *ptr,
+            size_t      count,
+            off_t       offset)
+{
+  ssize_t rv;
+  
+  if (offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  
+  slow_path_begin (mio);
+  mio->mark.active = FALSE;
+  rv = mio->v_pwrite (mio, ptr, count, offset);
+  slow_path_end (mio);
   
   return rv;
 }
@@ -23,6 +23,9 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #if ! (defined (__attribute__) || defined (__GNUC__))
 # define __attribute__(x) /* nothing */
@@ -33,17 +36,50 @@
  * MIOType:
  * @MIO_TYPE_FILE: #MIO object works on a file
  * @MIO_TYPE_MEMORY: #MIO object works in-memory
+ * @MIO_TYPE_MMAP: #MIO object works on a read-only memory-mapped file
+ * @MIO_TYPE_FD: #MIO object works on a file descriptor
+ * @MIO_TYPE_SLICE: #MIO object works on a read-only range of another #MIO
+ * @MIO_TYPE_CONCAT: #MIO object works on read-only concatenated segments
+ * @MIO_TYPE_CHUNKED: #MIO object works in-memory, in chunks
  * 
  * Existing implementations.
  */
 enum _MIOType {
   MIO_TYPE_FILE,
-  MIO_TYPE_MEMORY
+  MIO_TYPE_MEMORY,
+  MIO_TYPE_MMAP,
+  MIO_TYPE_FD,
+  MIO_TYPE_SLICE,
+  MIO_TYPE_CONCAT,
+  MIO_TYPE_CHUNKED
 };
 
-typedef enum _MIOType   MIOType;
+/**
+ * MIOMmapFlags:
+ * @MIO_MMAP_SEQUENTIAL: The file will be read mostly sequentially, so the
+ *                       system may read ahead aggressively
+ * @MIO_MMAP_RANDOM: The file will be read in random order, so the system
+ *                   should not read ahead
+ * @MIO_MMAP_WILLNEED: The whole mapping will be needed soon, so the system
+ *                     may start reading it right away
+ * @MIO_MMAP_POPULATE: Read the whole mapping in memory when it is created,
+ *                     where supported
+ * 
+ * Hints on how a memory-mapped file will be accessed, see mio_new_mmap_full().
+ */
+enum _MIOMmapFlags {
+  MIO_MMAP_SEQUENTIAL = 1 << 0,
+  MIO_MMAP_RANDOM     = 1 << 1,
+  MIO_MMAP_WILLNEED   = 1 << 2,
+  MIO_MMAP_POPULATE   = 1 << 3
+};
+
+typedef enum _MIOType       MIOType;
+typedef enum _MIOMmapFlags  MIOMmapFlags;
 typedef struct _MIO     MIO;
 typedef struct _MIOPos  MIOPos;
+typedef struct _MIOSegment  MIOSegment;
+typedef struct _MIOFormat   MIOFormat;
 /**
  * MIOReallocFunc:
  * @ptr: Pointer to the memory to resize
@@ -87,6 +123,45 @@ typedef FILE    *(* MIOFOpenFunc)   (const char *filename,
  */
 typedef int      (* MIOFCloseFunc)  (FILE *fp);
 
+/**
+ * MIOCloseFunc:
+ * @fd: An opened file descriptor
+ * 
+ * A function following the close() semantic, used to close a file
+ * descriptor.
+ * 
+ * Returns: 0 on success, -1 otherwise.
+ */
+typedef int      (* MIOCloseFunc)   (int fd);
+
+/**
+ * MIO_UNGET_MAX:
+ * 
+ * The number of characters that can always be pushed back in a #MIO stream
+ * with mio_ungetc() or mio_ungetn() before reading them again.
+ */
+#define MIO_UNGET_MAX 16
+
+/**
+ * MIOSegment:
+ * @mio: A #MIO object to read, or %NULL to read @data
+ * @data: The data of the segment, if @mio is %NULL
+ * @size: The size of @data, ignored if @mio is not %NULL
+ * 
+ * A segment of a stream created with mio_new_concat().
+ */
+struct _MIOSegment {
+  MIO        *mio;
+  const void *data;
+  size_t      size;
+};
+
+/**
+ * MIOFormat:
+ * 
+ * A printf format compiled with mio_format_compile().  This object is opaque.
+ */
+
 /**
  * MIOPos:
  * 
@@ -101,9 +176,20 @@ struct _MIOPos {
   void *tag;
 #endif
   union {
-    fpos_t file;
+    struct {
+      fpos_t  pos;
+      size_t  unread;
+    } file;
     size_t mem;
+    off_t mmap;
+    off_t fd;
+    off_t slice;
+    off_t concat;
+    size_t chunked;
   } impl;
+  long line;
+  long column;
+  unsigned int unget_len;
 };
 
 /**
@@ -119,6 +205,11 @@ struct _MIO {
     struct {
       FILE           *fp;
       MIOFCloseFunc   close_func;
+      unsigned char  *buf;
+      size_t          buf_size;
+      unsigned int    buffered;
+      unsigned int    dirty;
+      unsigned int    eof;
     } file;
     struct {
       unsigned char  *buf;
@@ -128,13 +219,128 @@ struct _MIO {
       size_t          allocated_size;
       MIOReallocFunc  realloc_func;
       MIOFreeFunc     free_func;
+      double          growth_factor;
+      size_t          growth_max_step;
+      struct _MIOShared *shared;
+      unsigned char  *scratch;
+      size_t          reserved;
       /* flags */
       /* FIXME: these could be 1-bit bitfields, but it would break the ABI
        * since it would change the size of the structure */
       unsigned int    error;
       unsigned int    eof;
     } mem;
+    struct {
+      int             fd;
+      unsigned char  *map;
+      off_t           map_offset;
+      size_t          map_size;
+      size_t          window_size;
+      off_t           size;
+      off_t           pos;
+      int             ungetch;
+      unsigned int    flags;
+      unsigned int    error;
+      unsigned int    eof;
+    } mmap;
+    struct {
+      int             fd;
+      MIOCloseFunc    close_func;
+      unsigned char  *buf;
+      size_t          buf_size;
+      off_t           offset;
+      size_t          len;
+      size_t          pos;
+      size_t          dirty;
+      unsigned int    patched;
+      unsigned int    error;
+      unsigned int    eof;
+    } fd;
+    struct {
+      MIO            *parent;
+      off_t           base;
+      off_t           size;
+      off_t           pos;
+      unsigned char  *buf;
+      size_t          buf_size;
+      off_t           buf_offset;
+      size_t          len;
+      int             ungetch;
+      unsigned int    error;
+      unsigned int    eof;
+    } slice;
+    struct {
+      struct _MIOConcatSegment *segments;
+      size_t          n_segments;
+      size_t          current;
+      off_t           size;
+      off_t           pos;
+      unsigned char  *window;
+      off_t           window_offset;
+      unsigned char  *buf;
+      size_t          buf_size;
+      off_t           buf_offset;
+      size_t          buf_len;
+      int             ungetch;
+      unsigned int    error;
+      unsigned int    eof;
+    } concat;
+    struct {
+      struct _MIOChunk *chunks;
+      size_t          n_chunks;
+      size_t          n_allocated;
+      size_t          chunk_size;
+      size_t          current;
+      size_t          pos;
+      size_t          size;
+      unsigned char  *scratch;
+      size_t          reserved;
+      int             ungetch;
+      unsigned int    error;
+      unsigned int    eof;
+    } chunked;
   } impl;
+  /* fast path buffer windows, see MIO_GETC() and MIO_PUTC() */
+  unsigned char  *read_ptr;
+  unsigned char  *read_end;
+  unsigned char  *write_ptr;
+  unsigned char  *write_end;
+  /* end of the stream's existing data within the write window, or %NULL */
+  unsigned char  *write_data_end;
+  /* line tracking state, see mio_set_line_tracking() */
+  struct {
+    const unsigned char  *ptr;
+    unsigned int          enabled;
+    long                  line;
+    long                  column;
+    long                  prev_column;
+  } track;
+  /* characters pushed back that the implementation couldn't take, read
+   * through the read window.  While they are, the implementation's window is
+   * saved in ptr and end */
+  struct {
+    unsigned char   buf[MIO_UNGET_MAX];
+    unsigned char  *ptr;
+    unsigned char  *end;
+    unsigned int    active;
+  } unget;
+  /* position saved by mio_mark().  The implementation fills offset, and
+   * ungetch if it has its own pushed back character */
+  struct {
+    off_t           offset;
+    int             ungetch;
+    size_t          limit;
+    long            line;
+    long            column;
+    unsigned char   unget[MIO_UNGET_MAX];
+    unsigned int    unget_len;
+    unsigned int    active;
+  } mark;
+  /* storage for lines returned by mio_next_line() that aren't contiguous */
+  unsigned char  *line_buf;
+  size_t          line_buf_size;
+  /* sampled line offsets, see mio_seek_line() */
+  struct _MIOLineIndex *line_index;
   /* virtual function table */
   void    (*v_free)     (MIO *mio);
   size_t  (*v_read)     (MIO     *mio,
@@ -170,9 +376,41 @@ struct _MIO {
                          MIOPos  *pos);
   int     (*v_setpos)   (MIO     *mio,
                          MIOPos  *pos);
+  const unsigned char
+         *(*v_peek)     (MIO     *mio,
+                         size_t  *avail);
+  int     (*v_consume)  (MIO     *mio,
+                         size_t   n);
+  void   *(*v_reserve)  (MIO     *mio,
+                         size_t   n);
+  int     (*v_commit)   (MIO     *mio,
+                         size_t   n);
+  ssize_t (*v_pread)    (MIO     *mio,
+                         void    *ptr,
+                         size_t   count,
+                         off_t    offset);
+  ssize_t (*v_pwrite)   (MIO         *mio,
+                         const void  *ptr,
+                         size_t       count,
+                         off_t        offset);
+  size_t  (*v_readv)    (MIO                 *mio,
+                         const struct iovec  *iov,
+                         int                  iovcnt);
+  size_t  (*v_writev)   (MIO                 *mio,
+                         const struct iovec  *iov,
+                         int                  iovcnt);
+  int     (*v_mark)     (MIO *mio);
+  int     (*v_reset)    (MIO *mio);
 };
 
 
+extern const unsigned char  mio_class_space[256];
+extern const unsigned char  mio_class_blank[256];
+extern const unsigned char  mio_class_digit[256];
+extern const unsigned char  mio_class_xdigit[256];
+extern const unsigned char  mio_class_alpha[256];
+extern const unsigned char  mio_class_ident[256];
+
 MIO            *mio_new_file            (const char  *filename,
                                          const char  *mode);
 MIO            *mio_new_file_full       (const char    *filename,
@@ -185,10 +423,36 @@ MIO            *mio_new_memory          (unsigned char *data,
                                          size_t         size,
                                          MIOReallocFunc realloc_func,
                                          MIOFreeFunc    free_func);
+MIO            *mio_new_memory_from_file(const char    *filename,
+                                         MIOReallocFunc realloc_func,
+                                         MIOFreeFunc    free_func);
+MIO            *mio_new_memory_chunked  (size_t         chunk_size);
+MIO            *mio_new_mmap            (const char    *filename);
+MIO            *mio_new_mmap_full       (const char    *filename,
+                                         MIOMmapFlags   flags,
+                                         size_t         window_size);
+MIO            *mio_new_fd              (int            fd,
+                                         MIOCloseFunc   close_func);
+MIO            *mio_new_fd_full         (int            fd,
+                                         size_t         buffer_size,
+                                         MIOCloseFunc   close_func);
+MIO            *mio_dup                 (MIO *mio);
+MIO            *mio_new_slice           (MIO   *parent,
+                                         off_t  offset,
+                                         off_t  length);
+MIO            *mio_new_concat          (const MIOSegment *segments,
+                                         size_t            n_segments);
 void            mio_free                (MIO *mio);
 FILE           *mio_file_get_fp         (MIO *mio);
+int             mio_fd_get_fd           (MIO *mio);
 unsigned char  *mio_memory_get_data     (MIO     *mio,
                                          size_t  *size);
+void            mio_memory_set_growth   (MIO     *mio,
+                                         double   factor,
+                                         size_t   max_step);
+int             mio_memory_reserve      (MIO     *mio,
+                                         size_t   capacity);
+int             mio_memory_shrink_to_fit (MIO *mio);
 size_t          mio_read                (MIO     *mio,
                                          void    *ptr,
                                          size_t   size,
@@ -197,12 +461,42 @@ size_t          mio_write               (MIO         *mio,
                                          const void  *ptr,
                                          size_t       size,
                                          size_t       nmemb);
+ssize_t         mio_readv               (MIO                 *mio,
+                                         const struct iovec  *iov,
+                                         int                  iovcnt);
+ssize_t         mio_writev              (MIO                 *mio,
+                                         const struct iovec  *iov,
+                                         int                  iovcnt);
 int             mio_getc                (MIO *mio);
 char           *mio_gets                (MIO   *mio,
                                          char  *s,
                                          size_t size);
+ssize_t         mio_gets_len            (MIO   *mio,
+                                         char  *s,
+                                         size_t size);
+ssize_t         mio_getdelim            (MIO     *mio,
+                                         char   **lineptr,
+                                         size_t  *n,
+                                         int      delim);
+int             mio_next_line           (MIO                  *mio,
+                                         const unsigned char **ptr,
+                                         size_t               *len);
+size_t          mio_skip_span           (MIO                 *mio,
+                                         const unsigned char *table);
+int             mio_read_span           (MIO                  *mio,
+                                         const unsigned char  *table,
+                                         const unsigned char **ptr,
+                                         size_t               *len);
+int             mio_skip_to_byte        (MIO *mio,
+                                         int  c);
+int             mio_find                (MIO        *mio,
+                                         const void *needle,
+                                         size_t      len);
 int             mio_ungetc              (MIO *mio,
                                          int  ch);
+int             mio_ungetn              (MIO        *mio,
+                                         const void *ptr,
+                                         size_t      n);
 int             mio_putc                (MIO *mio,
                                          int  c);
 int             mio_puts                (MIO         *mio,
@@ -214,6 +508,25 @@ int             mio_vprintf             (MIO         *mio,
 int             mio_printf              (MIO         *mio,
                                          const char  *format,
                                          ...) __attribute__((__format__ (__printf__, 2, 3)));
+MIOFormat      *mio_format_compile      (const char *format);
+void            mio_format_free         (MIOFormat *format);
+int             mio_vprintf_compiled    (MIO             *mio,
+                                         const MIOFormat *format,
+                                         va_list          ap);
+int             mio_printf_compiled     (MIO             *mio,
+                                         const MIOFormat *format,
+                                         ...);
+int             mio_put_n               (MIO         *mio,
+                                         const char  *s,
+                                         size_t       n);
+int             mio_put_int             (MIO *mio,
+                                         long value);
+int             mio_put_uint64          (MIO     *mio,
+                                         uint64_t value);
+int             mio_put_hex             (MIO     *mio,
+                                         uint64_t value);
+int             mio_put_double          (MIO   *mio,
+                                         double value);
 
 void            mio_clearerr            (MIO *mio);
 int             mio_eof                 (MIO *mio);
@@ -227,7 +540,70 @@ int             mio_getpos              (MIO     *mio,
                                          MIOPos  *pos);
 int             mio_setpos              (MIO     *mio,
                                          MIOPos  *pos);
+int             mio_mark                (MIO    *mio,
+                                         size_t  limit);
+int             mio_reset               (MIO *mio);
+int             mio_seek_line           (MIO  *mio,
+                                         long  line);
+long            mio_offset_to_line      (MIO  *mio,
+                                         long  offset);
+void            mio_set_line_tracking   (MIO *mio,
+                                         int  enabled);
+long            mio_get_line            (MIO *mio);
+long            mio_get_column          (MIO *mio);
+long            mio_get_line_start      (MIO *mio);
+const unsigned char *
+                mio_peek                (MIO     *mio,
+                                         size_t  *avail);
+int             mio_consume             (MIO     *mio,
+                                         size_t   n);
+void           *mio_write_reserve       (MIO     *mio,
+                                         size_t   n);
+int             mio_write_commit        (MIO     *mio,
+                                         size_t   n);
+ssize_t         mio_pread               (MIO     *mio,
+                                         void    *ptr,
+                                         size_t   count,
+                                         off_t    offset);
+ssize_t         mio_pwrite              (MIO         *mio,
+                                         const void  *ptr,
+                                         size_t       count,
+                                         off_t        offset);
+
+
+/**
+ * MIO_GETC:
+ * @mio: A #MIO object
+ * 
+ * Same as mio_getc(), but implemented as a macro reading directly from the
+ * stream's buffer, and only calling mio_getc() when the buffer needs to be
+ * refilled.
+ * 
+ * <warning><para>@mio is evaluated more than once.</para></warning>
+ * 
+ * Returns: The read character, or %EOF on error.
+ */
+#define MIO_GETC(mio)                                                          \
+  ((mio)->read_ptr < (mio)->read_end                                           \
+   ? (int) *(mio)->read_ptr++                                                  \
+   : mio_getc (mio))
 
+/**
+ * MIO_PUTC:
+ * @mio: A #MIO object
+ * @c: The character to write
+ * 
+ * Same as mio_putc(), but implemented as a macro writing directly to the
+ * stream's buffer, and only calling mio_putc() when the buffer is full.
+ * 
+ * <warning><para>@mio is evaluated more than once.</para></warning>
+ * 
+ * Returns: The written character, or %EOF on error.
+ */
+#define MIO_PUTC(mio, c)                                                       \
+  ((mio)->write_ptr < (mio)->write_end                                         \
+   ? (int) (*(mio)->write_ptr++ = (unsigned char) (c))                         \
+   : mio_putc ((mio), (c)))
 
 
 #endif /* guard */